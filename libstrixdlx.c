@@ -0,0 +1,121 @@
+/*
+ * libstrixdlx: access to /dev/strixdlx for userspace programs
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libstrixdlx.h"
+
+//read buffer, enough for several event lines
+#define READ_BUFFER_SIZE	(8 * STRIXDLX_EVENT_LINE_SIZE)
+
+int strixdlx_device_open(const char *path)
+{
+	return open(path ? path : STRIXDLX_DEFAULT_DEVICE, O_RDWR | O_CLOEXEC | O_NONBLOCK);
+}
+
+void strixdlx_device_close(int fd)
+{
+	if (fd >= 0)
+		close(fd);
+}
+
+/**
+ * \brief Read all pending events
+ * The module returns whatever is queued with one read() and 0 if nothing
+ * is, so the loop ends with the first empty read.
+ */
+int strixdlx_read_events(int fd, struct strixdlx_event *events, int max)
+{
+	char buf[READ_BUFFER_SIZE];
+	char *line, *nl;
+	ssize_t n;
+	int count = 0;
+
+	while (count < max) {
+		n = read(fd, buf, sizeof(buf) - 1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			return count ? count : -1;
+		}
+		if (n == 0)
+			break;
+		buf[n] = '\0';
+
+		for (line = buf; *line && count < max; line = nl + 1) {
+			if (strixdlx_parse_event(line, &events[count]) == 0)
+				count++;
+			nl = strchr(line, '\n');
+			if (nl == NULL)
+				break;
+		}
+	}
+	return count;
+}
+
+void strixdlx_discard_events(int fd)
+{
+	struct strixdlx_event ev;
+
+	while (strixdlx_read_events(fd, &ev, 1) > 0)
+		;
+}
+
+int strixdlx_send(int fd, const __u8 *cmds, int count)
+{
+	int i;
+	ssize_t n;
+
+	//the module takes one command per write()
+	for (i = 0; i < count; i++) {
+		do {
+			n = write(fd, &cmds[i], 1);
+		} while (n < 0 && errno == EINTR);
+		if (n != 1)
+			return i ? i : -1;
+	}
+	return count;
+}
+
+int strixdlx_set_volume(int fd, int volume)
+{
+	__u8 cmd = strixdlx_volume_cmd(volume);
+
+	return strixdlx_send(fd, &cmd, 1) == 1 ? 0 : -1;
+}
+
+int strixdlx_set_output(int fd, int output)
+{
+	__u8 cmd = strixdlx_output_cmd(output);
+
+	return strixdlx_send(fd, &cmd, 1) == 1 ? 0 : -1;
+}
+
+int strixdlx_set_output_volume(int fd, int output, int volume)
+{
+	__u8 cmd[STRIXDLX_CMD_MAX_SIZE];
+	int len = strixdlx_output_volume_cmd(cmd, output, volume);
+	ssize_t n;
+
+	do {
+		n = write(fd, cmd, len);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0)
+		return -1;
+	if (n != len) {
+		errno = EIO;
+		return -1;
+	}
+	return 0;
+}
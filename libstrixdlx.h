@@ -0,0 +1,63 @@
+/*
+ * libstrixdlx: access to /dev/strixdlx for userspace programs
+ *
+ * Opens the control box, reads its events in batches and sends commands
+ * with the protocol of strixdlx-proto.h. The daemon and the tools use this
+ * instead of talking to the device directly.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#ifndef LIBSTRIXDLX_H
+#define LIBSTRIXDLX_H
+
+#include "strixdlx-proto.h"
+
+#define STRIXDLX_DEFAULT_DEVICE	"/dev/strixdlx"
+
+/*
+ * open the control box for reading events and sending commands,
+ * returns the file descriptor or -1 with errno set
+ */
+int strixdlx_device_open(const char *path);
+
+void strixdlx_device_close(int fd);
+
+/*
+ * read all pending events, at most max
+ * returns the number of events, 0 if none is pending, -1 with errno set
+ * if the device failed or has gone
+ */
+int strixdlx_read_events(int fd, struct strixdlx_event *events, int max);
+
+/*
+ * drop all pending events
+ */
+void strixdlx_discard_events(int fd);
+
+/*
+ * send commands (STRIXDLX_CMD_* or a volume 0-100) in order,
+ * returns the number of commands sent or -1 with errno set
+ */
+int strixdlx_send(int fd, const __u8 *cmds, int count);
+
+/*
+ * set the volume of the active output, 0 or -1 with errno set
+ */
+int strixdlx_set_volume(int fd, int volume);
+
+/*
+ * switch the relay, 0 = speaker, 1 = headphone, 0 or -1 with errno set
+ */
+int strixdlx_set_output(int fd, int output);
+
+/*
+ * set the volume of one output, the leds only change if it is active;
+ * 0 or -1 with errno set, EINVAL from modules without the command
+ */
+int strixdlx_set_output_volume(int fd, int output, int volume);
+
+#endif
@@ -0,0 +1,158 @@
+/*
+ * Audio backends for the strix-daemon: ALSA simple mixer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <alsa/asoundlib.h>
+
+#include "strix-backend.h"
+
+struct alsa_priv {
+	snd_mixer_t *handle;
+	snd_mixer_elem_t *elem[STRIX_OUTPUTS];
+	long min[STRIX_OUTPUTS];
+	long max[STRIX_OUTPUTS];
+};
+
+/**
+ * \brief Look up a simple mixer element and its volume range
+ */
+static int alsa_find_elem(struct alsa_priv *priv, int output, const char *name)
+{
+	snd_mixer_selem_id_t *sid;
+	int err;
+
+	snd_mixer_selem_id_alloca(&sid);
+	snd_mixer_selem_id_set_index(sid, 0);
+	snd_mixer_selem_id_set_name(sid, name);
+
+	priv->elem[output] = snd_mixer_find_selem(priv->handle, sid);
+	if (priv->elem[output] == NULL) {
+		fprintf(stderr, "alsa: mixer element %s not found\n", name);
+		return -1;
+	}
+
+	err = snd_mixer_selem_get_playback_volume_range(priv->elem[output],
+			&priv->min[output], &priv->max[output]);
+	if (err < 0)
+		return err;
+	if (priv->max[output] <= priv->min[output])
+		return -1;
+	return 0;
+}
+
+static int alsa_open(struct strix_backend *be)
+{
+	struct alsa_priv *priv;
+	int err, i;
+
+	priv = calloc(1, sizeof(*priv));
+	if (priv == NULL)
+		return -1;
+	be->priv = priv;
+
+	err = snd_mixer_open(&priv->handle, 0);
+	if (err < 0)
+		goto error;
+	err = snd_mixer_attach(priv->handle, be->card ? be->card : "default");
+	if (err < 0)
+		goto error;
+	err = snd_mixer_selem_register(priv->handle, NULL, NULL);
+	if (err < 0)
+		goto error;
+	err = snd_mixer_load(priv->handle);
+	if (err < 0)
+		goto error;
+
+	for (i = 0; i < STRIX_OUTPUTS; i++) {
+		err = alsa_find_elem(priv, i, be->element[i] ? be->element[i] : "Master");
+		if (err < 0)
+			goto error;
+	}
+	return 0;
+
+error:
+	if (priv->handle)
+		snd_mixer_close(priv->handle);
+	free(priv);
+	be->priv = NULL;
+	return err < 0 ? err : -1;
+}
+
+static void alsa_close(struct strix_backend *be)
+{
+	struct alsa_priv *priv = be->priv;
+
+	if (priv == NULL)
+		return;
+	snd_mixer_close(priv->handle);
+	free(priv);
+	be->priv = NULL;
+}
+
+static int alsa_get_volume(struct strix_backend *be, int output, int *pct)
+{
+	struct alsa_priv *priv = be->priv;
+	long value, range;
+	int err;
+
+	err = snd_mixer_selem_get_playback_volume(priv->elem[output], 0, &value);
+	if (err < 0)
+		return err;
+
+	//round to the nearest percent, so set_volume() and get_volume() agree
+	range = priv->max[output] - priv->min[output];
+	*pct = (int)(((value - priv->min[output]) * 100 + range / 2) / range);
+	return 0;
+}
+
+static int alsa_set_volume(struct strix_backend *be, int output, int pct)
+{
+	struct alsa_priv *priv = be->priv;
+	long range;
+
+	range = priv->max[output] - priv->min[output];
+	return snd_mixer_selem_set_playback_volume_all(priv->elem[output],
+			priv->min[output] + (pct * range + 50) / 100);
+}
+
+static int alsa_poll_descriptors(struct strix_backend *be, struct pollfd *pfds, int space)
+{
+	struct alsa_priv *priv = be->priv;
+
+	return snd_mixer_poll_descriptors(priv->handle, pfds, space);
+}
+
+static int alsa_handle_events(struct strix_backend *be, struct pollfd *pfds, int nfds)
+{
+	struct alsa_priv *priv = be->priv;
+	unsigned short revents = 0;
+	int err;
+
+	snd_mixer_poll_descriptors_revents(priv->handle, pfds, nfds, &revents);
+	if (!(revents & (POLLIN | POLLERR)))
+		return 0;
+
+	err = snd_mixer_handle_events(priv->handle);
+	if (err < 0)
+		return err;
+	return 1;
+}
+
+const struct strix_backend_ops strix_backend_alsa = {
+	.name = "alsa",
+	.open = alsa_open,
+	.close = alsa_close,
+	.get_volume = alsa_get_volume,
+	.set_volume = alsa_set_volume,
+	.poll_descriptors = alsa_poll_descriptors,
+	.handle_events = alsa_handle_events,
+};
@@ -0,0 +1,267 @@
+/*
+ * Benchmark of the audio backends of the strix-daemon
+ *
+ * Measures what the daemon pays per backend:
+ *
+ *   open		time of open() and poll_descriptors(), the startup cost
+ *   update		a volume change by somebody else (a desktop slider): wakeups
+ *			until get_volume() returns the new value and the CPU time of
+ *			poll(), handle_events() and get_volume() for it
+ *   foreign		a change of another control of the card (--noise): wakeups,
+ *			how often handle_events() reported a change and the CPU time
+ *
+ * The changes are made through a separate simple mixer handle, like another
+ * program would. The original volume is restored at the end.
+ *
+ *   strix-backend-bench --card hw:0 --element Master --noise PCM --count 1000
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+
+#include "strix-backend.h"
+
+#define DEFAULT_COUNT		500
+//time a notification may take before the update counts as lost
+#define NOTIFY_TIMEOUT_MS	200
+//time to collect the wakeups of a foreign change
+#define FOREIGN_WAIT_MS		20
+
+struct bench_result {
+	double open_ms;
+	unsigned long updates, lost, wakeups;
+	uint64_t cpu_ns;
+	unsigned long foreign, foreign_wakeups, foreign_changes;
+	uint64_t foreign_cpu_ns;
+};
+
+static const char *card = NULL;
+static const char *element = NULL;
+static const char *noise = NULL;
+static int count = DEFAULT_COUNT;
+
+static uint64_t clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * \brief Open a backend on the card and element of the command line
+ */
+static int backend_open(struct strix_backend *be, const struct strix_backend_ops *ops, const char *elem)
+{
+	memset(be, 0, sizeof(*be));
+	be->ops = ops;
+	be->card = card;
+	be->element[STRIX_OUTPUT_SPEAKER] = elem;
+	be->element[STRIX_OUTPUT_HEADPHONE] = elem;
+	return ops->open(be);
+}
+
+/**
+ * \brief Wait for notifications, like the write thread of the daemon does
+ * \param target	volume to wait for, -1 to collect for timeout_ms
+ * \return 1 if target was seen, 0 otherwise
+ */
+static int wait_notify(struct strix_backend *be, struct pollfd *pfds, int nfds, int target,
+		       int timeout_ms, unsigned long *wakeups, unsigned long *changes, uint64_t *cpu_ns)
+{
+	uint64_t deadline = clock_ns(CLOCK_MONOTONIC) + timeout_ms * 1000000ull, now, cpu;
+	int i, ret, pct;
+
+	while ((now = clock_ns(CLOCK_MONOTONIC)) < deadline) {
+		i = poll(pfds, nfds, (int)((deadline - now) / 1000000) + 1);
+		if (i < 0 && errno != EINTR)
+			return 0;
+		if (i <= 0)
+			continue;
+
+		cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+		(*wakeups)++;
+		ret = be->ops->handle_events(be, pfds, nfds);
+		if (ret > 0 && changes)
+			(*changes)++;
+		ret = be->ops->get_volume(be, STRIX_OUTPUT_SPEAKER, &pct);
+		*cpu_ns += clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu;
+		if (target >= 0 && ret >= 0 && pct == target)
+			return 1;
+	}
+	return 0;
+}
+
+static int bench_backend(const struct strix_backend_ops *ops, struct strix_backend *writer,
+			 struct strix_backend *noisy, struct bench_result *res)
+{
+	struct strix_backend be;
+	struct pollfd pfds[STRIX_BACKEND_MAX_FDS];
+	uint64_t start;
+	int i, nfds, pct, noise_pct = 0;
+
+	memset(res, 0, sizeof(*res));
+
+	start = clock_ns(CLOCK_MONOTONIC);
+	if (backend_open(&be, ops, element) < 0) {
+		fprintf(stderr, "could not open %s backend\n", ops->name);
+		return -1;
+	}
+	nfds = be.ops->poll_descriptors(&be, pfds, STRIX_BACKEND_MAX_FDS);
+	res->open_ms = (clock_ns(CLOCK_MONOTONIC) - start) / 1e6;
+	if (nfds < 0) {
+		be.ops->close(&be);
+		return -1;
+	}
+
+	//changes of the element itself, never the value it has
+	be.ops->get_volume(&be, STRIX_OUTPUT_SPEAKER, &pct);
+	for (i = 0; i < count; i++) {
+		pct = pct >= 50 ? pct - 37 : pct + 41;
+		if (writer->ops->set_volume(writer, STRIX_OUTPUT_SPEAKER, pct) < 0)
+			break;
+		res->updates++;
+		if (!wait_notify(&be, pfds, nfds, pct, NOTIFY_TIMEOUT_MS, &res->wakeups, NULL, &res->cpu_ns))
+			res->lost++;
+	}
+
+	//changes of another control on the same card
+	if (noisy != NULL) {
+		noisy->ops->get_volume(noisy, STRIX_OUTPUT_SPEAKER, &noise_pct);
+		for (i = 0; i < count; i++) {
+			noise_pct = noise_pct >= 50 ? noise_pct - 37 : noise_pct + 41;
+			if (noisy->ops->set_volume(noisy, STRIX_OUTPUT_SPEAKER, noise_pct) < 0)
+				break;
+			res->foreign++;
+			wait_notify(&be, pfds, nfds, -1, FOREIGN_WAIT_MS, &res->foreign_wakeups,
+				    &res->foreign_changes, &res->foreign_cpu_ns);
+		}
+	}
+
+	be.ops->close(&be);
+	return 0;
+}
+
+static void print_help(const char *app_name)
+{
+	printf("\n Usage: %s [OPTIONS] [backend ...]\n\n", app_name);
+	printf("  Compares the backends given (default alsa alsa-ctl) on one card.\n\n");
+	printf("  Options:\n");
+	printf("   -h --help                 Print this help\n");
+	printf("   -c --card name            Card to use (default default)\n");
+	printf("   -e --element name         Element the backends follow (default Master)\n");
+	printf("   -x --noise name           Another element, changed to cause foreign events\n");
+	printf("   -n --count number         Changes per test (default %d)\n", DEFAULT_COUNT);
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static struct option long_options[] = {
+		{"card", required_argument, 0, 'c'},
+		{"element", required_argument, 0, 'e'},
+		{"noise", required_argument, 0, 'x'},
+		{"count", required_argument, 0, 'n'},
+		{"help", no_argument, 0, 'h'},
+		{NULL, 0, 0, 0}
+	};
+	static const char *default_backends[] = { "alsa", "alsa-ctl", NULL };
+	const char **names = default_backends;
+	const struct strix_backend_ops *ops;
+	struct strix_backend writer, noisy;
+	struct bench_result res;
+	int value, option_index = 0;
+	int orig = -1, noise_orig = -1, have_noise = 0;
+	int i, ret = EXIT_SUCCESS;
+
+	while ((value = getopt_long(argc, argv, "c:e:x:n:h", long_options, &option_index)) != -1) {
+		switch (value) {
+		case 'c':
+			card = optarg;
+			break;
+		case 'e':
+			element = optarg;
+			break;
+		case 'x':
+			noise = optarg;
+			break;
+		case 'n':
+			count = atoi(optarg);
+			if (count < 1)
+				count = 1;
+			break;
+		case 'h':
+			print_help(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			print_help(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind < argc)
+		names = (const char **)&argv[optind];
+
+	//the other program changing the volume
+	if (backend_open(&writer, &strix_backend_alsa, element) < 0) {
+		fprintf(stderr, "could not open the mixer\n");
+		return EXIT_FAILURE;
+	}
+	writer.ops->get_volume(&writer, STRIX_OUTPUT_SPEAKER, &orig);
+	if (noise != NULL) {
+		if (backend_open(&noisy, &strix_backend_alsa, noise) < 0) {
+			fprintf(stderr, "could not open the noise element %s\n", noise);
+			writer.ops->close(&writer);
+			return EXIT_FAILURE;
+		}
+		have_noise = 1;
+		noisy.ops->get_volume(&noisy, STRIX_OUTPUT_SPEAKER, &noise_orig);
+	}
+
+	printf("%-10s %9s %8s %6s %10s %12s", "backend", "open ms", "updates", "lost",
+	       "wakeups/u", "cpu/update us");
+	if (have_noise)
+		printf(" %10s %10s %12s", "reported", "wakeups/f", "cpu/foreign us");
+	printf("\n");
+
+	for (i = 0; names[i] != NULL; i++) {
+		ops = strix_backend_find(names[i]);
+		if (ops == NULL) {
+			fprintf(stderr, "unknown backend %s\n", names[i]);
+			ret = EXIT_FAILURE;
+			continue;
+		}
+		if (bench_backend(ops, &writer, have_noise ? &noisy : NULL, &res) < 0) {
+			ret = EXIT_FAILURE;
+			continue;
+		}
+		printf("%-10s %9.2f %8lu %6lu %10.2f %12.2f", ops->name, res.open_ms, res.updates,
+		       res.lost, res.updates ? (double)res.wakeups / res.updates : 0.0,
+		       res.updates ? res.cpu_ns / 1e3 / res.updates : 0.0);
+		if (have_noise)
+			printf(" %4lu/%-5lu %10.2f %12.2f", res.foreign_changes, res.foreign,
+			       res.foreign ? (double)res.foreign_wakeups / res.foreign : 0.0,
+			       res.foreign ? res.foreign_cpu_ns / 1e3 / res.foreign : 0.0);
+		printf("\n");
+	}
+
+	if (orig >= 0)
+		writer.ops->set_volume(&writer, STRIX_OUTPUT_SPEAKER, orig);
+	writer.ops->close(&writer);
+	if (have_noise) {
+		if (noise_orig >= 0)
+			noisy.ops->set_volume(&noisy, STRIX_OUTPUT_SPEAKER, noise_orig);
+		noisy.ops->close(&noisy);
+	}
+	return ret;
+}
@@ -0,0 +1,246 @@
+/*
+ * Audio backends for the strix-daemon: ALSA control interface
+ *
+ * The simple mixer loads every element of the card on open and processes
+ * the events of all of them. This backend binds to the volume controls of
+ * the two outputs only: it looks them up by name on the control device,
+ * reads and writes them with one ioctl each and keeps the last volume, so a
+ * wakeup caused by any other control of the card is dismissed after reading
+ * the event, without touching a control.
+ *
+ * Elements are given like for the simple mixer ("Master", "PCM"), the
+ * control " Playback Volume" of it is used. A name which already ends in
+ * "Volume" is taken as the full control name.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <alsa/asoundlib.h>
+
+#include "strix-backend.h"
+
+#define CTL_NAME_SIZE	64
+
+struct ctl_output {
+	snd_ctl_elem_value_t *value;	/* id of the control, reused for every access */
+	unsigned int numid;
+	unsigned int channels;
+	long min, max;
+	int pct;			/* last known volume, -1 after a change event */
+};
+
+struct ctl_priv {
+	snd_ctl_t *handle;
+	struct ctl_output out[STRIX_OUTPUTS];
+};
+
+/**
+ * \brief Look up the volume control of an element and its range
+ */
+static int ctl_find_elem(struct ctl_priv *priv, struct ctl_output *out, const char *name)
+{
+	snd_ctl_elem_id_t *id;
+	snd_ctl_elem_info_t *info;
+	char full[CTL_NAME_SIZE];
+	size_t len = strlen(name);
+	int err;
+
+	//simple mixer names lack the suffix of the control
+	if (len >= 6 && strcmp(name + len - 6, "Volume") == 0)
+		snprintf(full, sizeof(full), "%s", name);
+	else
+		snprintf(full, sizeof(full), "%s Playback Volume", name);
+
+	snd_ctl_elem_id_alloca(&id);
+	snd_ctl_elem_id_set_interface(id, SND_CTL_ELEM_IFACE_MIXER);
+	snd_ctl_elem_id_set_name(id, full);
+	snd_ctl_elem_id_set_index(id, 0);
+
+	snd_ctl_elem_info_alloca(&info);
+	snd_ctl_elem_info_set_id(info, id);
+	err = snd_ctl_elem_info(priv->handle, info);
+	if (err < 0) {
+		fprintf(stderr, "alsa-ctl: control %s not found\n", full);
+		return err;
+	}
+	if (snd_ctl_elem_info_get_type(info) != SND_CTL_ELEM_TYPE_INTEGER) {
+		fprintf(stderr, "alsa-ctl: control %s is no integer volume\n", full);
+		return -1;
+	}
+	out->min = snd_ctl_elem_info_get_min(info);
+	out->max = snd_ctl_elem_info_get_max(info);
+	out->channels = snd_ctl_elem_info_get_count(info);
+	if (out->max <= out->min || out->channels == 0)
+		return -1;
+
+	//the info filled in the numid, events are matched against it
+	snd_ctl_elem_info_get_id(info, id);
+	out->numid = snd_ctl_elem_id_get_numid(id);
+
+	err = snd_ctl_elem_value_malloc(&out->value);
+	if (err < 0)
+		return err;
+	snd_ctl_elem_value_set_id(out->value, id);
+	out->pct = -1;
+	return 0;
+}
+
+static void ctl_free(struct ctl_priv *priv)
+{
+	int i;
+
+	for (i = 0; i < STRIX_OUTPUTS; i++)
+		if (priv->out[i].value)
+			snd_ctl_elem_value_free(priv->out[i].value);
+	if (priv->handle)
+		snd_ctl_close(priv->handle);
+	free(priv);
+}
+
+static int ctl_open(struct strix_backend *be)
+{
+	struct ctl_priv *priv;
+	int err, i;
+
+	priv = calloc(1, sizeof(*priv));
+	if (priv == NULL)
+		return -1;
+	be->priv = priv;
+
+	err = snd_ctl_open(&priv->handle, be->card ? be->card : "default", SND_CTL_NONBLOCK);
+	if (err < 0)
+		goto error;
+
+	for (i = 0; i < STRIX_OUTPUTS; i++) {
+		err = ctl_find_elem(priv, &priv->out[i], be->element[i] ? be->element[i] : "Master");
+		if (err < 0)
+			goto error;
+	}
+
+	err = snd_ctl_subscribe_events(priv->handle, 1);
+	if (err < 0)
+		goto error;
+	return 0;
+
+error:
+	ctl_free(priv);
+	be->priv = NULL;
+	return err < 0 ? err : -1;
+}
+
+static void ctl_close(struct strix_backend *be)
+{
+	if (be->priv == NULL)
+		return;
+	ctl_free(be->priv);
+	be->priv = NULL;
+}
+
+static int ctl_get_volume(struct strix_backend *be, int output, int *pct)
+{
+	struct ctl_priv *priv = be->priv;
+	struct ctl_output *out = &priv->out[output];
+	long value, range;
+	int err;
+
+	//nothing changed since the last read or write
+	if (out->pct >= 0) {
+		*pct = out->pct;
+		return 0;
+	}
+
+	err = snd_ctl_elem_read(priv->handle, out->value);
+	if (err < 0)
+		return err;
+	value = snd_ctl_elem_value_get_integer(out->value, 0);
+
+	//round to the nearest percent, so set_volume() and get_volume() agree
+	range = out->max - out->min;
+	out->pct = (int)(((value - out->min) * 100 + range / 2) / range);
+	*pct = out->pct;
+	return 0;
+}
+
+static int ctl_set_volume(struct strix_backend *be, int output, int pct)
+{
+	struct ctl_priv *priv = be->priv;
+	struct ctl_output *out = &priv->out[output];
+	long value;
+	unsigned int ch;
+	int err, i;
+
+	value = out->min + (pct * (out->max - out->min) + 50) / 100;
+	for (ch = 0; ch < out->channels; ch++)
+		snd_ctl_elem_value_set_integer(out->value, ch, value);
+	err = snd_ctl_elem_write(priv->handle, out->value);
+	if (err < 0) {
+		out->pct = -1;
+		return err;
+	}
+
+	//both outputs may be bound to the same control
+	for (i = 0; i < STRIX_OUTPUTS; i++)
+		if (priv->out[i].numid == out->numid)
+			priv->out[i].pct = pct;
+	return 0;
+}
+
+static int ctl_poll_descriptors(struct strix_backend *be, struct pollfd *pfds, int space)
+{
+	struct ctl_priv *priv = be->priv;
+
+	return snd_ctl_poll_descriptors(priv->handle, pfds, space);
+}
+
+static int ctl_handle_events(struct strix_backend *be, struct pollfd *pfds, int nfds)
+{
+	struct ctl_priv *priv = be->priv;
+	snd_ctl_event_t *event;
+	unsigned short revents = 0;
+	unsigned int mask, numid;
+	int err, i, changed = 0;
+
+	snd_ctl_poll_descriptors_revents(priv->handle, pfds, nfds, &revents);
+	if (!(revents & (POLLIN | POLLERR)))
+		return 0;
+
+	snd_ctl_event_alloca(&event);
+	while ((err = snd_ctl_read(priv->handle, event)) > 0) {
+		if (snd_ctl_event_get_type(event) != SND_CTL_EVENT_ELEM)
+			continue;
+		mask = snd_ctl_event_elem_get_mask(event);
+		numid = snd_ctl_event_elem_get_numid(event);
+		for (i = 0; i < STRIX_OUTPUTS; i++) {
+			if (priv->out[i].numid != numid)
+				continue;
+			//the card is going away
+			if (mask == SND_CTL_EVENT_MASK_REMOVE)
+				return -ENODEV;
+			if (mask & SND_CTL_EVENT_MASK_VALUE) {
+				priv->out[i].pct = -1;
+				changed = 1;
+			}
+		}
+	}
+	if (err < 0 && err != -EAGAIN)
+		return err;
+	return changed;
+}
+
+const struct strix_backend_ops strix_backend_ctl = {
+	.name = "alsa-ctl",
+	.open = ctl_open,
+	.close = ctl_close,
+	.get_volume = ctl_get_volume,
+	.set_volume = ctl_set_volume,
+	.poll_descriptors = ctl_poll_descriptors,
+	.handle_events = ctl_handle_events,
+};
@@ -0,0 +1,121 @@
+/*
+ * Audio backends for the strix-daemon: null backend
+ *
+ * Keeps the volumes in memory. Used for benchmarks and tests of the daemon
+ * on machines without sound hardware. Volume changes "from outside" can be
+ * injected with strix_backend_null_inject().
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "strix-backend.h"
+#include "strix-backend-null.h"
+
+struct null_priv {
+	int volume[STRIX_OUTPUTS];
+	int efd;			/* signals injected changes */
+};
+
+static int null_open(struct strix_backend *be)
+{
+	struct null_priv *priv;
+	int i;
+
+	priv = calloc(1, sizeof(*priv));
+	if (priv == NULL)
+		return -1;
+
+	priv->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (priv->efd < 0) {
+		free(priv);
+		return -1;
+	}
+	for (i = 0; i < STRIX_OUTPUTS; i++)
+		priv->volume[i] = 100;
+
+	be->priv = priv;
+	return 0;
+}
+
+static void null_close(struct strix_backend *be)
+{
+	struct null_priv *priv = be->priv;
+
+	if (priv == NULL)
+		return;
+	close(priv->efd);
+	free(priv);
+	be->priv = NULL;
+}
+
+static int null_get_volume(struct strix_backend *be, int output, int *pct)
+{
+	struct null_priv *priv = be->priv;
+
+	*pct = __atomic_load_n(&priv->volume[output], __ATOMIC_RELAXED);
+	return 0;
+}
+
+static int null_set_volume(struct strix_backend *be, int output, int pct)
+{
+	struct null_priv *priv = be->priv;
+
+	__atomic_store_n(&priv->volume[output], pct, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static int null_poll_descriptors(struct strix_backend *be, struct pollfd *pfds, int space)
+{
+	struct null_priv *priv = be->priv;
+
+	if (space < 1)
+		return -1;
+	pfds[0].fd = priv->efd;
+	pfds[0].events = POLLIN;
+	pfds[0].revents = 0;
+	return 1;
+}
+
+static int null_handle_events(struct strix_backend *be, struct pollfd *pfds, int nfds)
+{
+	struct null_priv *priv = be->priv;
+	uint64_t count;
+
+	if (nfds < 1 || !(pfds[0].revents & POLLIN))
+		return 0;
+	if (read(priv->efd, &count, sizeof(count)) != sizeof(count))
+		return 0;
+	return 1;
+}
+
+/**
+ * \brief Change a volume like an external mixer would do
+ * May be called from any thread.
+ */
+void strix_backend_null_inject(struct strix_backend *be, int output, int pct)
+{
+	struct null_priv *priv = be->priv;
+	uint64_t one = 1;
+
+	__atomic_store_n(&priv->volume[output], pct, __ATOMIC_RELAXED);
+	if (write(priv->efd, &one, sizeof(one)) < 0)
+		return;
+}
+
+const struct strix_backend_ops strix_backend_null = {
+	.name = "null",
+	.open = null_open,
+	.close = null_close,
+	.get_volume = null_get_volume,
+	.set_volume = null_set_volume,
+	.poll_descriptors = null_poll_descriptors,
+	.handle_events = null_handle_events,
+};
@@ -0,0 +1,20 @@
+/*
+ * Audio backends for the strix-daemon: null backend
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#ifndef STRIX_BACKEND_NULL_H
+#define STRIX_BACKEND_NULL_H
+
+#include "strix-backend.h"
+
+/*
+ * simulate a volume change by another program
+ */
+void strix_backend_null_inject(struct strix_backend *be, int output, int pct);
+
+#endif
@@ -0,0 +1,473 @@
+/*
+ * Audio backends for the strix-daemon: native PipeWire
+ *
+ * Talks to the PipeWire graph directly instead of going through the ALSA
+ * plugin of pipewire. Every output is bound to an Audio/Sink node, either by
+ * its node.name or, if no name is given, to the default sink which is
+ * followed through the "default" metadata. The volume is read from and
+ * written to the channelVolumes of the node's Props parameter. Percent values
+ * use the cubic scale of pactl/wpctl.
+ *
+ * The PipeWire loop runs in its own thread, changes are signalled to the
+ * daemon with an eventfd.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <pipewire/pipewire.h>
+#include <pipewire/extensions/metadata.h>
+#include <spa/param/props.h>
+#include <spa/pod/builder.h>
+#include <spa/pod/iter.h>
+#include <spa/utils/dict.h>
+
+#include "strix-backend.h"
+
+#define PW_MAX_SINKS		32
+#define PW_MAX_CHANNELS		64
+#define PW_NAME_SIZE		256
+#define PW_SYNC_TIMEOUT		2	/* seconds */
+
+struct pw_priv;
+
+struct pw_output {
+	struct pw_priv *priv;
+	uint32_t id;			/* bound node, SPA_ID_INVALID if none */
+	struct pw_node *node;
+	struct spa_hook listener;
+	uint32_t channels;
+	float volume;			/* linear volume of the first channel */
+	int valid;
+};
+
+struct pw_sink {
+	uint32_t id;
+	char name[PW_NAME_SIZE];
+};
+
+struct pw_priv {
+	struct pw_thread_loop *loop;
+	struct pw_context *context;
+	struct pw_core *core;
+	struct spa_hook core_listener;
+	struct pw_registry *registry;
+	struct spa_hook registry_listener;
+	struct pw_metadata *metadata;
+	struct spa_hook metadata_listener;
+	int sync_seq;
+
+	const char *target[STRIX_OUTPUTS];	/* node.name, NULL follows the default sink */
+	char default_sink[PW_NAME_SIZE];
+	struct pw_sink sinks[PW_MAX_SINKS];
+	struct pw_output out[STRIX_OUTPUTS];
+
+	int efd;
+};
+
+static void pw_notify(struct pw_priv *priv)
+{
+	uint64_t one = 1;
+
+	if (write(priv->efd, &one, sizeof(one)) < 0)
+		return;
+}
+
+static void node_param(void *data, int seq, uint32_t id, uint32_t index,
+		uint32_t next, const struct spa_pod *param)
+{
+	struct pw_output *out = data;
+	const struct spa_pod_object *obj = (const struct spa_pod_object *)param;
+	const struct spa_pod_prop *prop;
+	float vols[PW_MAX_CHANNELS];
+	uint32_t n;
+
+	if (param == NULL || id != SPA_PARAM_Props || !spa_pod_is_object(param))
+		return;
+
+	SPA_POD_OBJECT_FOREACH(obj, prop) {
+		if (prop->key != SPA_PROP_channelVolumes)
+			continue;
+		n = spa_pod_copy_array(&prop->value, SPA_TYPE_Float, vols, PW_MAX_CHANNELS);
+		if (n == 0)
+			continue;
+		if (out->valid && out->channels == n && out->volume == vols[0])
+			continue;
+		out->channels = n;
+		out->volume = vols[0];
+		out->valid = 1;
+		pw_notify(out->priv);
+	}
+}
+
+static const struct pw_node_events node_events = {
+	PW_VERSION_NODE_EVENTS,
+	.param = node_param,
+};
+
+static void output_unbind(struct pw_output *out)
+{
+	if (out->node == NULL)
+		return;
+	spa_hook_remove(&out->listener);
+	pw_proxy_destroy((struct pw_proxy *)out->node);
+	out->node = NULL;
+	out->id = SPA_ID_INVALID;
+	out->valid = 0;
+}
+
+static void output_bind(struct pw_priv *priv, struct pw_output *out, uint32_t id)
+{
+	uint32_t params[] = { SPA_PARAM_Props };
+
+	out->node = pw_registry_bind(priv->registry, id, PW_TYPE_INTERFACE_Node,
+			PW_VERSION_NODE, 0);
+	if (out->node == NULL)
+		return;
+	out->id = id;
+	pw_node_add_listener(out->node, &out->listener, &node_events, out);
+	pw_node_subscribe_params(out->node, params, 1);
+}
+
+/**
+ * \brief (Re)bind every output to the sink it should follow
+ */
+static void outputs_update(struct pw_priv *priv)
+{
+	const char *want;
+	int i, j;
+
+	for (i = 0; i < STRIX_OUTPUTS; i++) {
+		want = priv->target[i] ? priv->target[i] : priv->default_sink;
+
+		for (j = 0; j < PW_MAX_SINKS; j++) {
+			if (priv->sinks[j].id != SPA_ID_INVALID && want[0] != '\0'
+			    && strcmp(priv->sinks[j].name, want) == 0)
+				break;
+		}
+		if (j == PW_MAX_SINKS) {
+			output_unbind(&priv->out[i]);
+			continue;
+		}
+		if (priv->out[i].id == priv->sinks[j].id)
+			continue;
+
+		output_unbind(&priv->out[i]);
+		output_bind(priv, &priv->out[i], priv->sinks[j].id);
+	}
+}
+
+/**
+ * \brief Pick the sink name out of the json value {"name":"..."}
+ */
+static void parse_default_sink(const char *value, char *name, size_t size)
+{
+	const char *p, *end;
+
+	name[0] = '\0';
+	if (value == NULL)
+		return;
+	p = strstr(value, "\"name\"");
+	if (p == NULL)
+		return;
+	p = strchr(p + 6, '"');
+	if (p == NULL)
+		return;
+	end = strchr(++p, '"');
+	if (end == NULL || (size_t)(end - p) >= size)
+		return;
+	memcpy(name, p, end - p);
+	name[end - p] = '\0';
+}
+
+static int metadata_property(void *data, uint32_t subject, const char *key,
+		const char *type, const char *value)
+{
+	struct pw_priv *priv = data;
+
+	if (key != NULL && strcmp(key, "default.audio.sink") != 0)
+		return 0;
+
+	parse_default_sink(key ? value : NULL, priv->default_sink, sizeof(priv->default_sink));
+	outputs_update(priv);
+	pw_notify(priv);
+	return 0;
+}
+
+static const struct pw_metadata_events metadata_events = {
+	PW_VERSION_METADATA_EVENTS,
+	.property = metadata_property,
+};
+
+static void registry_global(void *data, uint32_t id, uint32_t permissions,
+		const char *type, uint32_t version, const struct spa_dict *props)
+{
+	struct pw_priv *priv = data;
+	const char *str;
+	int i;
+
+	if (props == NULL)
+		return;
+
+	if (strcmp(type, PW_TYPE_INTERFACE_Metadata) == 0) {
+		str = spa_dict_lookup(props, PW_KEY_METADATA_NAME);
+		if (str == NULL || strcmp(str, "default") != 0 || priv->metadata != NULL)
+			return;
+		priv->metadata = pw_registry_bind(priv->registry, id,
+				PW_TYPE_INTERFACE_Metadata, PW_VERSION_METADATA, 0);
+		if (priv->metadata != NULL)
+			pw_metadata_add_listener(priv->metadata, &priv->metadata_listener,
+					&metadata_events, priv);
+		return;
+	}
+
+	if (strcmp(type, PW_TYPE_INTERFACE_Node) != 0)
+		return;
+	str = spa_dict_lookup(props, PW_KEY_MEDIA_CLASS);
+	if (str == NULL || strcmp(str, "Audio/Sink") != 0)
+		return;
+	str = spa_dict_lookup(props, PW_KEY_NODE_NAME);
+	if (str == NULL)
+		return;
+
+	for (i = 0; i < PW_MAX_SINKS; i++) {
+		if (priv->sinks[i].id == SPA_ID_INVALID) {
+			priv->sinks[i].id = id;
+			snprintf(priv->sinks[i].name, sizeof(priv->sinks[i].name), "%s", str);
+			break;
+		}
+	}
+	outputs_update(priv);
+}
+
+static void registry_global_remove(void *data, uint32_t id)
+{
+	struct pw_priv *priv = data;
+	int i;
+
+	for (i = 0; i < PW_MAX_SINKS; i++) {
+		if (priv->sinks[i].id == id)
+			priv->sinks[i].id = SPA_ID_INVALID;
+	}
+	for (i = 0; i < STRIX_OUTPUTS; i++) {
+		if (priv->out[i].id == id)
+			output_unbind(&priv->out[i]);
+	}
+	outputs_update(priv);
+}
+
+static const struct pw_registry_events registry_events = {
+	PW_VERSION_REGISTRY_EVENTS,
+	.global = registry_global,
+	.global_remove = registry_global_remove,
+};
+
+static void core_done(void *data, uint32_t id, int seq)
+{
+	struct pw_priv *priv = data;
+
+	if (id == PW_ID_CORE && seq == priv->sync_seq)
+		pw_thread_loop_signal(priv->loop, false);
+}
+
+static const struct pw_core_events core_events = {
+	PW_VERSION_CORE_EVENTS,
+	.done = core_done,
+};
+
+/**
+ * \brief Wait until the server processed everything sent so far
+ * Called with the loop locked.
+ */
+static void pw_roundtrip(struct pw_priv *priv)
+{
+	priv->sync_seq = pw_core_sync(priv->core, PW_ID_CORE, priv->sync_seq);
+	pw_thread_loop_timed_wait(priv->loop, PW_SYNC_TIMEOUT);
+}
+
+static void pipewire_close(struct strix_backend *be);
+
+static int pipewire_open(struct strix_backend *be)
+{
+	struct pw_priv *priv;
+	struct pw_properties *props = NULL;
+	int i;
+
+	priv = calloc(1, sizeof(*priv));
+	if (priv == NULL)
+		return -1;
+	be->priv = priv;
+
+	priv->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	for (i = 0; i < PW_MAX_SINKS; i++)
+		priv->sinks[i].id = SPA_ID_INVALID;
+	for (i = 0; i < STRIX_OUTPUTS; i++) {
+		priv->target[i] = be->element[i];
+		priv->out[i].priv = priv;
+		priv->out[i].id = SPA_ID_INVALID;
+	}
+	if (priv->efd < 0)
+		goto error;
+
+	pw_init(NULL, NULL);
+
+	priv->loop = pw_thread_loop_new("strix-pipewire", NULL);
+	if (priv->loop == NULL)
+		goto error;
+	priv->context = pw_context_new(pw_thread_loop_get_loop(priv->loop), NULL, 0);
+	if (priv->context == NULL)
+		goto error;
+	if (pw_thread_loop_start(priv->loop) < 0)
+		goto error;
+
+	pw_thread_loop_lock(priv->loop);
+	if (be->card != NULL)
+		props = pw_properties_new(PW_KEY_REMOTE_NAME, be->card, NULL);
+	priv->core = pw_context_connect(priv->context, props, 0);
+	if (priv->core == NULL) {
+		pw_thread_loop_unlock(priv->loop);
+		fprintf(stderr, "pipewire: could not connect\n");
+		goto error;
+	}
+	pw_core_add_listener(priv->core, &priv->core_listener, &core_events, priv);
+	priv->registry = pw_core_get_registry(priv->core, PW_VERSION_REGISTRY, 0);
+	pw_registry_add_listener(priv->registry, &priv->registry_listener,
+			&registry_events, priv);
+
+	//first roundtrip: globals and metadata, second: params of the bound nodes
+	pw_roundtrip(priv);
+	pw_roundtrip(priv);
+
+	for (i = 0; i < STRIX_OUTPUTS; i++) {
+		if (!priv->out[i].valid) {
+			pw_thread_loop_unlock(priv->loop);
+			fprintf(stderr, "pipewire: no sink for %s\n",
+				priv->target[i] ? priv->target[i] : "default");
+			goto error;
+		}
+	}
+	pw_thread_loop_unlock(priv->loop);
+	return 0;
+
+error:
+	pipewire_close(be);
+	return -1;
+}
+
+static void pipewire_close(struct strix_backend *be)
+{
+	struct pw_priv *priv = be->priv;
+	int i;
+
+	if (priv == NULL)
+		return;
+
+	if (priv->loop != NULL)
+		pw_thread_loop_stop(priv->loop);
+	for (i = 0; i < STRIX_OUTPUTS; i++)
+		output_unbind(&priv->out[i]);
+	if (priv->metadata != NULL) {
+		spa_hook_remove(&priv->metadata_listener);
+		pw_proxy_destroy((struct pw_proxy *)priv->metadata);
+	}
+	if (priv->registry != NULL) {
+		spa_hook_remove(&priv->registry_listener);
+		pw_proxy_destroy((struct pw_proxy *)priv->registry);
+	}
+	if (priv->core != NULL)
+		pw_core_disconnect(priv->core);
+	if (priv->context != NULL)
+		pw_context_destroy(priv->context);
+	if (priv->loop != NULL)
+		pw_thread_loop_destroy(priv->loop);
+	if (priv->efd >= 0)
+		close(priv->efd);
+	free(priv);
+	be->priv = NULL;
+}
+
+static int pipewire_get_volume(struct strix_backend *be, int output, int *pct)
+{
+	struct pw_priv *priv = be->priv;
+	int ret = -1;
+
+	pw_thread_loop_lock(priv->loop);
+	if (priv->out[output].valid) {
+		*pct = (int)lroundf(cbrtf(priv->out[output].volume) * 100.0f);
+		ret = 0;
+	}
+	pw_thread_loop_unlock(priv->loop);
+	return ret;
+}
+
+static int pipewire_set_volume(struct strix_backend *be, int output, int pct)
+{
+	struct pw_priv *priv = be->priv;
+	struct pw_output *out = &priv->out[output];
+	uint8_t buffer[1024];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	struct spa_pod *param;
+	float vols[PW_MAX_CHANNELS];
+	float linear = (pct / 100.0f) * (pct / 100.0f) * (pct / 100.0f);
+	uint32_t i;
+	int ret = -1;
+
+	pw_thread_loop_lock(priv->loop);
+	if (out->node != NULL && out->valid) {
+		for (i = 0; i < out->channels; i++)
+			vols[i] = linear;
+		param = spa_pod_builder_add_object(&b,
+				SPA_TYPE_OBJECT_Props, SPA_PARAM_Props,
+				SPA_PROP_channelVolumes, SPA_POD_Array(sizeof(float),
+					SPA_TYPE_Float, out->channels, vols));
+		ret = pw_node_set_param(out->node, SPA_PARAM_Props, 0, param);
+		//remember it, the param event of our own change is no news
+		out->volume = linear;
+	}
+	pw_thread_loop_unlock(priv->loop);
+	return ret < 0 ? ret : 0;
+}
+
+static int pipewire_poll_descriptors(struct strix_backend *be, struct pollfd *pfds, int space)
+{
+	struct pw_priv *priv = be->priv;
+
+	if (space < 1)
+		return -1;
+	pfds[0].fd = priv->efd;
+	pfds[0].events = POLLIN;
+	pfds[0].revents = 0;
+	return 1;
+}
+
+static int pipewire_handle_events(struct strix_backend *be, struct pollfd *pfds, int nfds)
+{
+	struct pw_priv *priv = be->priv;
+	uint64_t count;
+
+	if (nfds < 1 || !(pfds[0].revents & POLLIN))
+		return 0;
+	if (read(priv->efd, &count, sizeof(count)) != sizeof(count))
+		return 0;
+	return 1;
+}
+
+const struct strix_backend_ops strix_backend_pipewire = {
+	.name = "pipewire",
+	.open = pipewire_open,
+	.close = pipewire_close,
+	.get_volume = pipewire_get_volume,
+	.set_volume = pipewire_set_volume,
+	.poll_descriptors = pipewire_poll_descriptors,
+	.handle_events = pipewire_handle_events,
+};
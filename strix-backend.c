@@ -0,0 +1,60 @@
+/*
+ * Audio backends for the strix-daemon: lookup
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "strix-backend.h"
+
+static const struct strix_backend_ops *backends[] = {
+	&strix_backend_alsa,
+	&strix_backend_ctl,
+#ifdef HAVE_PIPEWIRE
+	&strix_backend_pipewire,
+#endif
+	&strix_backend_null,
+	NULL,
+};
+
+/**
+ * \brief Find a backend by its name
+ * \param name	name of the backend, NULL for the default (alsa)
+ */
+const struct strix_backend_ops *strix_backend_find(const char *name)
+{
+	int i;
+
+	if (name == NULL)
+		return backends[0];
+
+	for (i = 0; backends[i] != NULL; i++) {
+		if (strcmp(backends[i]->name, name) == 0)
+			return backends[i];
+	}
+	return NULL;
+}
+
+/**
+ * \brief Names of all compiled in backends
+ */
+const char *strix_backend_names(void)
+{
+	static char names[64];
+	int i;
+
+	if (names[0] != '\0')
+		return names;
+
+	for (i = 0; backends[i] != NULL; i++) {
+		if (i > 0)
+			strncat(names, "|", sizeof(names) - strlen(names) - 1);
+		strncat(names, backends[i]->name, sizeof(names) - strlen(names) - 1);
+	}
+	return names;
+}
@@ -0,0 +1,81 @@
+/*
+ * Audio backends for the strix-daemon
+ *
+ * The daemon does not talk to a sound system directly. Every backend
+ * implements the operations below, the daemon only sees volumes in percent
+ * per output of the control box and a set of poll descriptors which become
+ * readable when the volume was changed by somebody else.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#ifndef STRIX_BACKEND_H
+#define STRIX_BACKEND_H
+
+#include <poll.h>
+
+//outputs of the control box, same numbering as the kernel module
+#define STRIX_OUTPUT_SPEAKER	0
+#define STRIX_OUTPUT_HEADPHONE	1
+#define STRIX_OUTPUTS		2
+
+//maximum number of poll descriptors a backend may hand out
+#define STRIX_BACKEND_MAX_FDS	8
+
+struct strix_backend;
+
+/*
+ * backend operations
+ * All functions return a negative value on error.
+ */
+struct strix_backend_ops {
+	const char *name;
+
+	/* connect to the sound system, card and element are already set */
+	int (*open)(struct strix_backend *be);
+	/* disconnect and free everything allocated by open */
+	void (*close)(struct strix_backend *be);
+
+	/* volume of one output in percent (0-100) */
+	int (*get_volume)(struct strix_backend *be, int output, int *pct);
+	int (*set_volume)(struct strix_backend *be, int output, int pct);
+
+	/* fill pfds with the change notification descriptors, returns count */
+	int (*poll_descriptors)(struct strix_backend *be, struct pollfd *pfds, int space);
+	/* consume notifications after poll() returned, returns 1 if a volume may have changed */
+	int (*handle_events)(struct strix_backend *be, struct pollfd *pfds, int nfds);
+};
+
+/*
+ * backend instance
+ */
+struct strix_backend {
+	const struct strix_backend_ops *ops;
+
+	const char *card;			/* card, server or NULL for default */
+	const char *element[STRIX_OUTPUTS];	/* mixer element / sink per output */
+
+	void *priv;				/* backend private data */
+};
+
+extern const struct strix_backend_ops strix_backend_alsa;
+extern const struct strix_backend_ops strix_backend_ctl;
+extern const struct strix_backend_ops strix_backend_null;
+#ifdef HAVE_PIPEWIRE
+extern const struct strix_backend_ops strix_backend_pipewire;
+#endif
+
+/*
+ * find backend operations by name, NULL if not compiled in
+ */
+const struct strix_backend_ops *strix_backend_find(const char *name);
+
+/*
+ * list of compiled in backends for help texts, separated by '|'
+ */
+const char *strix_backend_names(void);
+
+#endif
@@ -0,0 +1,154 @@
+/*
+ * Status of the control box for status bars (waybar, polybar, i3blocks)
+ *
+ * Reads the shared memory status of the strix-daemon, without talking to the
+ * daemon or the sound system. Prints the active output and its volume once,
+ * or with --follow a new line on every change:
+ *
+ *   strix-bar			speaker 40%
+ *   strix-bar --json		{"text":"40%","alt":"speaker",...} for waybar
+ *   strix-bar --follow		one line per change, sleeps in between
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "strix-status.h"
+
+//retry interval while the daemon is not running
+#define ATTACH_INTERVAL_MS	1000
+
+static const char *output_names[STRIX_STATUS_OUTPUTS] = { "speaker", "headphone" };
+
+/**
+ * \brief Volume of an output for humans
+ */
+static void format_volume(char *buf, size_t size, const struct strix_status_data *data, int output)
+{
+	if (data->mute & (1 << output))
+		snprintf(buf, size, "muted");
+	else if (data->volume[output] == STRIX_STATUS_UNKNOWN)
+		snprintf(buf, size, "?");
+	else
+		snprintf(buf, size, "%d%%", data->volume[output]);
+}
+
+/**
+ * \brief Print one status line, st is NULL while the daemon is not running
+ * \return change counter of the printed state
+ */
+static uint32_t print_status(const struct strix_status *st, int json)
+{
+	struct strix_status_data data;
+	char active[16], other[16];
+	uint32_t changes;
+	int o;
+
+	if (st == NULL) {
+		if (json)
+			printf("{\"text\":\"\",\"alt\":\"stopped\",\"class\":\"stopped\",\"tooltip\":\"strix-daemon not running\"}\n");
+		else
+			printf("stopped\n");
+		fflush(stdout);
+		return 0;
+	}
+
+	changes = status_read(st, &data);
+	o = data.output < STRIX_STATUS_OUTPUTS ? data.output : 0;
+	format_volume(active, sizeof(active), &data, o);
+	format_volume(other, sizeof(other), &data, !o);
+
+	if (json) {
+		printf("{\"text\":\"%s\",\"alt\":\"%s\",\"class\":\"%s\",\"percentage\":%d,"
+		       "\"tooltip\":\"%s %s, %s %s\"}\n",
+		       active, output_names[o],
+		       !(data.flags & STRIX_STATUS_CONNECTED) ? "disconnected"
+		       : (data.mute & (1 << o)) ? "muted" : output_names[o],
+		       data.volume[o] == STRIX_STATUS_UNKNOWN ? 0 : data.volume[o],
+		       output_names[o], active, output_names[!o], other);
+	} else if (!(data.flags & STRIX_STATUS_CONNECTED)) {
+		printf("%s %s (disconnected)\n", output_names[o], active);
+	} else {
+		printf("%s %s\n", output_names[o], active);
+	}
+	fflush(stdout);
+	return changes;
+}
+
+static void print_help(const char *app_name)
+{
+	printf("\n Usage: %s [OPTIONS]\n\n", app_name);
+	printf("  Options:\n");
+	printf("   -h --help                 Print this help\n");
+	printf("   -U --status name          Shared memory object of the daemon (default %s)\n", STRIX_STATUS_NAME);
+	printf("   -j --json                 Print JSON for waybar custom modules\n");
+	printf("   -f --follow               Print a new line on every change\n");
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static struct option long_options[] = {
+		{"status", required_argument, 0, 'U'},
+		{"json", no_argument, 0, 'j'},
+		{"follow", no_argument, 0, 'f'},
+		{"help", no_argument, 0, 'h'},
+		{NULL, 0, 0, 0}
+	};
+	const struct strix_status *st;
+	const char *name = STRIX_STATUS_NAME;
+	int value, option_index = 0;
+	int json = 0, follow = 0;
+	uint32_t changes;
+
+	while ((value = getopt_long(argc, argv, "U:jfh", long_options, &option_index)) != -1) {
+		switch (value) {
+		case 'U':
+			name = optarg;
+			break;
+		case 'j':
+			json = 1;
+			break;
+		case 'f':
+			follow = 1;
+			break;
+		case 'h':
+			print_help(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			print_help(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	st = status_attach(name);
+	changes = print_status(st, json);
+	if (!follow)
+		return st ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	while (1) {
+		//wait for the daemon to (re)start
+		if (st == NULL) {
+			usleep(ATTACH_INTERVAL_MS * 1000);
+			st = status_attach(name);
+			if (st != NULL)
+				changes = print_status(st, json);
+			continue;
+		}
+
+		status_wait(st, changes, -1);
+		if (!status_valid(st)) {
+			status_detach(st);
+			st = NULL;
+		}
+		changes = print_status(st, json);
+	}
+	return EXIT_SUCCESS;
+}
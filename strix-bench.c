@@ -0,0 +1,420 @@
+/*
+ * Load generator and throughput benchmark for /dev/strixdlx
+ *
+ * Opens the device from several writers and readers, as threads or as
+ * processes, and runs them for a fixed time:
+ *
+ *   writers	write volume commands (and output switches, see --mix) as
+ *		fast as possible or at a fixed rate each
+ *   readers	poll() the device and read the events
+ *
+ * For every worker the latency of its write() or read() calls, the achieved
+ * rate and the errors are printed, readers also count the events they lost
+ * or got twice (from the sequence number of the event lines) and the
+ * wakeups which found nothing to read. The counters of the module (sysfs
+ * attribute "stats" of the interface) are read before and after the run:
+ * USB transfers issued per accepted command, failed submits of the reused
+ * control urbs and how often write() waited for the device lock.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "libstrixdlx.h"
+#include "strix-stats.h"
+
+#define BENCH_MAX_WORKERS	64
+#define BENCH_START_MS		100	/* time for all workers to start */
+#define BENCH_POLL_MS		100
+#define BENCH_EVENT_BATCH	16
+#define BENCH_MAX_COUNTERS	16
+#define BENCH_STATS_PATH	"/sys/class/usbmisc/%s/device/stats"
+
+struct worker {
+	int id;
+	int reader;		/* 0 = writer, 1 = reader */
+	uint64_t calls;		/* successful write() or read() calls */
+	uint64_t errors;
+	uint64_t events;	/* events read */
+	uint64_t lost;		/* gaps in the sequence numbers */
+	uint64_t duplicated;	/* sequence numbers seen again */
+	uint64_t empty;		/* wakeups without an event */
+	int seq_missing;	/* module sends no sequence numbers */
+	struct strix_histogram hist;	/* latency of the system calls */
+};
+
+/*
+ * counters of the module, "name value" lines
+ */
+struct counters {
+	int count;
+	char name[BENCH_MAX_COUNTERS][32];
+	long value[BENCH_MAX_COUNTERS];
+};
+
+static const char *device_path = STRIXDLX_DEFAULT_DEVICE;
+static const char *stats_path = NULL;
+static char stats_buf[PATH_MAX];
+static int rate;		/* commands per second and writer, 0 = unlimited */
+static int mix;			/* percentage of output switches */
+static uint64_t start_ns, end_ns;
+
+static void sleep_until(uint64_t ns)
+{
+	struct timespec ts = { ns / 1000000000ull, ns % 1000000000ull };
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+/**
+ * \brief Hammer the device with commands until the end of the run
+ */
+static void writer_run(struct worker *w, int fd)
+{
+	unsigned int seed = w->id * 7919 + 1;
+	uint64_t next, t0, t1;
+	int output = 0;
+	__u8 cmd;
+
+	next = start_ns;
+	while ((t0 = stats_now()) < end_ns) {
+		if (mix > 0 && (int)(rand_r(&seed) % 100) < mix) {
+			output = !output;
+			cmd = strixdlx_output_cmd(output);
+		} else {
+			cmd = strixdlx_volume_cmd(rand_r(&seed) % 101);
+		}
+
+		if (strixdlx_send(fd, &cmd, 1) == 1)
+			w->calls++;
+		else
+			w->errors++;
+		t1 = stats_now();
+		stats_hist_record(&w->hist, t1 - t0);
+
+		if (rate > 0) {
+			next += 1000000000ull / rate;
+			if (next > t1)
+				sleep_until(next);
+		}
+	}
+}
+
+/**
+ * \brief Read events until the end of the run and check their sequence numbers
+ */
+static void reader_run(struct worker *w, int fd)
+{
+	struct strixdlx_event events[BENCH_EVENT_BATCH];
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	unsigned int last = 0;
+	uint64_t t0;
+	int n, i;
+
+	while (stats_now() < end_ns) {
+		n = poll(&pfd, 1, BENCH_POLL_MS);
+		if (n < 0 && errno != EINTR) {
+			w->errors++;
+			break;
+		}
+		if (n <= 0)
+			continue;
+
+		t0 = stats_now();
+		n = strixdlx_read_events(fd, events, BENCH_EVENT_BATCH);
+		stats_hist_record(&w->hist, stats_now() - t0);
+		if (n < 0) {
+			w->errors++;
+			break;
+		}
+		w->calls++;
+		//another reader took the event, all of them share one slot
+		if (n == 0)
+			w->empty++;
+
+		for (i = 0; i < n; i++) {
+			w->events++;
+			if (events[i].seq == 0) {
+				w->seq_missing = 1;
+				continue;
+			}
+			if (last && events[i].seq <= last)
+				w->duplicated++;
+			else if (last && events[i].seq > last + 1)
+				w->lost += events[i].seq - last - 1;
+			if (events[i].seq > last)
+				last = events[i].seq;
+		}
+	}
+}
+
+static void worker_run(struct worker *w)
+{
+	int fd;
+
+	fd = strixdlx_device_open(device_path);
+	if (fd < 0) {
+		perror(device_path);
+		w->errors++;
+		return;
+	}
+	if (w->reader)
+		strixdlx_discard_events(fd);
+
+	sleep_until(start_ns);
+	if (w->reader)
+		reader_run(w, fd);
+	else
+		writer_run(w, fd);
+
+	strixdlx_device_close(fd);
+}
+
+static void *workerThread(void *vargs)
+{
+	worker_run(vargs);
+	return NULL;
+}
+
+/**
+ * \brief Counters of the device given, /dev/strixdlx may be a link to strixdlx0
+ */
+static const char *counters_path(void)
+{
+	char real[PATH_MAX];
+
+	if (realpath(device_path, real) == NULL)
+		snprintf(real, sizeof(real), "%s", device_path);
+	snprintf(stats_buf, sizeof(stats_buf), BENCH_STATS_PATH, basename(real));
+	return stats_buf;
+}
+
+/**
+ * \brief Read the counters of the module
+ * \return -1 if the module has none (older version or another device)
+ */
+static int counters_read(struct counters *c)
+{
+	FILE *f;
+
+	c->count = 0;
+	f = fopen(stats_path, "r");
+	if (f == NULL)
+		return -1;
+	while (c->count < BENCH_MAX_COUNTERS
+	       && fscanf(f, "%31s %ld", c->name[c->count], &c->value[c->count]) == 2)
+		c->count++;
+	fclose(f);
+	return 0;
+}
+
+static long counter_delta(const struct counters *before, const struct counters *after, const char *name)
+{
+	int i;
+	long value = 0;
+
+	for (i = 0; i < after->count; i++)
+		if (strcmp(after->name[i], name) == 0)
+			value = after->value[i];
+	for (i = 0; i < before->count; i++)
+		if (strcmp(before->name[i], name) == 0)
+			value -= before->value[i];
+	return value;
+}
+
+static void print_us(uint64_t ns)
+{
+	printf(" %9.1f", ns / 1000.0);
+}
+
+static void print_worker(const struct worker *w, double seconds)
+{
+	printf("%-6s %3d %9llu %10.1f", w->reader ? "reader" : "writer", w->id,
+	       (unsigned long long)w->calls, seconds > 0 ? w->calls / seconds : 0.0);
+	print_us(stats_percentile(&w->hist, 50.0));
+	print_us(stats_percentile(&w->hist, 99.0));
+	print_us(stats_percentile(&w->hist, 99.9));
+	print_us(w->hist.max);
+	printf(" %6llu", (unsigned long long)w->errors);
+	if (!w->reader) {
+		printf("\n");
+		return;
+	}
+	printf(" %8llu", (unsigned long long)w->events);
+	if (w->seq_missing)
+		printf(" %8s %6s", "n/a", "n/a");
+	else
+		printf(" %8llu %6llu", (unsigned long long)w->lost, (unsigned long long)w->duplicated);
+	printf(" %8llu\n", (unsigned long long)w->empty);
+}
+
+static void print_help(const char *name)
+{
+	printf("\n Usage: %s [OPTIONS]\n\n", name);
+	printf("  Options:\n");
+	printf("   -h --help                 Print this help\n");
+	printf("   -D --device path          Device (default %s)\n", STRIXDLX_DEFAULT_DEVICE);
+	printf("   -w --writers count        Writers (default 1)\n");
+	printf("   -r --rate count           Commands per second and writer, 0 = as fast as possible (default 0)\n");
+	printf("   -m --mix percent          Percentage of output switches among the commands (default 0)\n");
+	printf("   -R --readers count        Readers (default 1)\n");
+	printf("   -t --time seconds         Duration of the run (default 5)\n");
+	printf("   -P --processes            Run the workers as processes instead of threads\n");
+	printf("   -s --stats path           Counters of the module (default from the device)\n");
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static struct option long_options[] = {
+		{"device", required_argument, 0, 'D'},
+		{"writers", required_argument, 0, 'w'},
+		{"rate", required_argument, 0, 'r'},
+		{"mix", required_argument, 0, 'm'},
+		{"readers", required_argument, 0, 'R'},
+		{"time", required_argument, 0, 't'},
+		{"processes", no_argument, 0, 'P'},
+		{"stats", required_argument, 0, 's'},
+		{"help", no_argument, 0, 'h'},
+		{NULL, 0, 0, 0}
+	};
+	pthread_t threads[BENCH_MAX_WORKERS];
+	pid_t pids[BENCH_MAX_WORKERS];
+	struct counters before, after;
+	struct worker *workers;
+	uint64_t accepted = 0;
+	int writers = 1, readers = 1, seconds = 5, processes = 0;
+	int value, count, have_counters, i;
+	long commands, urbs;
+
+	while ((value = getopt_long(argc, argv, "D:w:r:m:R:t:Ps:h", long_options, NULL)) != -1) {
+		switch (value) {
+		case 'D':
+			device_path = optarg;
+			break;
+		case 'w':
+			writers = atoi(optarg);
+			break;
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		case 'm':
+			mix = atoi(optarg);
+			break;
+		case 'R':
+			readers = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'P':
+			processes = 1;
+			break;
+		case 's':
+			stats_path = optarg;
+			break;
+		case 'h':
+			print_help(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			print_help(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (stats_path == NULL)
+		stats_path = counters_path();
+
+	count = writers + readers;
+	if (writers < 0 || readers < 0 || count < 1 || count > BENCH_MAX_WORKERS) {
+		fprintf(stderr, "between 1 and %d workers are possible\n", BENCH_MAX_WORKERS);
+		return EXIT_FAILURE;
+	}
+	if (rate < 0 || mix < 0 || mix > 100 || seconds < 1) {
+		print_help(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	//shared, so forked workers can return their results
+	workers = mmap(NULL, count * sizeof(*workers), PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (workers == MAP_FAILED) {
+		perror("mmap");
+		return EXIT_FAILURE;
+	}
+	memset(workers, 0, count * sizeof(*workers));
+	for (i = 0; i < count; i++) {
+		workers[i].id = i < writers ? i : i - writers;
+		workers[i].reader = i >= writers;
+	}
+
+	have_counters = counters_read(&before) == 0;
+	start_ns = stats_now() + BENCH_START_MS * 1000000ull;
+	end_ns = start_ns + seconds * 1000000000ull;
+
+	for (i = 0; i < count; i++) {
+		if (!processes) {
+			pthread_create(&threads[i], NULL, workerThread, &workers[i]);
+			continue;
+		}
+		pids[i] = fork();
+		if (pids[i] == 0) {
+			worker_run(&workers[i]);
+			_exit(EXIT_SUCCESS);
+		}
+		if (pids[i] < 0)
+			perror("fork");
+	}
+	for (i = 0; i < count; i++) {
+		if (!processes)
+			pthread_join(threads[i], NULL);
+		else if (pids[i] > 0)
+			waitpid(pids[i], NULL, 0);
+	}
+
+	printf("%-6s %3s %9s %10s %9s %9s %9s %9s %6s %8s %8s %6s %8s\n", "worker", "id",
+	       "calls", "per sec", "p50 us", "p99 us", "p99.9 us", "max us", "errors",
+	       "events", "lost", "dup", "empty");
+	for (i = 0; i < count; i++) {
+		print_worker(&workers[i], seconds);
+		if (!workers[i].reader)
+			accepted += workers[i].calls;
+	}
+	printf("\ncommands accepted: %llu (%.1f per sec)\n", (unsigned long long)accepted,
+	       (double)accepted / seconds);
+
+	if (!have_counters || counters_read(&after) < 0) {
+		printf("module counters: not available (%s)\n", stats_path);
+		goto exit;
+	}
+	printf("module counters:");
+	for (i = 0; i < after.count; i++)
+		printf(" %s %ld", after.name[i], counter_delta(&before, &after, after.name[i]));
+	printf("\n");
+
+	commands = counter_delta(&before, &after, "commands");
+	urbs = counter_delta(&before, &after, "relay_urbs") + counter_delta(&before, &after, "volume_urbs");
+	printf("usb transfers per command: %.2f\n", commands ? (double)urbs / commands : 0.0);
+
+exit:
+	munmap(workers, count * sizeof(*workers));
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,624 @@
+/*
+ * Userspace stand-in for /dev/strixdlx (CUSE)
+ *
+ * Creates a character device with the read, poll and write semantics of the
+ * strixdlx module, so the daemon can be run and benchmarked without the
+ * module, the card or the emulator:
+ *
+ *   modprobe cuse
+ *   strix-cuse --name strixdlx-cuse --control /tmp/strix-cuse.sock
+ *   strix-daemon --device /dev/strixdlx-cuse
+ *
+ * Like the module it holds the volume of both outputs and the active output,
+ * has one slot for the last event (a new event replaces the previous one),
+ * read() returns the slot once per open file or 0 and never blocks, poll()
+ * is readable while the file has not read the slot and write() takes the
+ * commands of the module.
+ *
+ * Events are injected with commands read line by line from stdin and from
+ * clients of the control socket:
+ *
+ *   up | down | switch | sonic		knob step or button, as the box
+ *   init				event of a probed device
+ *   event <volume> <output> <event>	any event, sets volume and output
+ *   spin <count> up|down [ms]		several knob steps
+ *   sleep <ms>				pause the command stream
+ *   stats				print the counters
+ *   quit
+ *
+ * Every event put into the slot and every command written by a program is
+ * logged with a CLOCK_MONOTONIC timestamp in nanoseconds, the same clock the
+ * daemon uses for its statistics, to stdout, to the record file and to every
+ * control client.
+ *
+ * Needs libfuse3, build it with make cuse.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#define FUSE_USE_VERSION 31
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <cuse_lowlevel.h>
+
+#include "strixdlx-proto.h"
+
+#define CUSE_MAX_FILES		16
+#define CUSE_MAX_CLIENTS	8
+#define CUSE_LINE_SIZE		256
+
+/*
+ * state of the device, everything is protected by state_mutex
+ */
+static pthread_mutex_t state_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+	int volume_speaker;
+	int volume_headphone;
+	int control_setting;		/* speaker = 0, headphone = 1 */
+	unsigned int event_seq;
+	char readbuf[STRIXDLX_EVENT_LINE_SIZE];
+	size_t readbuflen;
+} box = { .volume_speaker = 100, .volume_headphone = 100 };
+
+//open files: 1 if used, the poll handle of the last poll() which waits and
+//the sequence number of the last event read, every file has its own cursor
+static int file_used[CUSE_MAX_FILES];
+static struct fuse_pollhandle *file_poll[CUSE_MAX_FILES];
+static unsigned int file_seq[CUSE_MAX_FILES];
+
+static struct {
+	unsigned long events;
+	unsigned long overwritten;	/* events replaced before every file read them */
+	unsigned long reads;
+	unsigned long empty_reads;
+	unsigned long commands;
+	unsigned long rejected;
+} counters;
+
+static FILE *record;
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int clients[CUSE_MAX_CLIENTS];
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * \brief Log a line with timestamp to stdout, the record file and all control clients
+ */
+static void cuse_log(const char *fmt, ...)
+{
+	char line[CUSE_LINE_SIZE];
+	va_list args;
+	int n, i;
+
+	n = snprintf(line, sizeof(line), "%llu ", (unsigned long long)now_ns());
+	va_start(args, fmt);
+	n += vsnprintf(line + n, sizeof(line) - n - 1, fmt, args);
+	va_end(args);
+	if (n > (int)sizeof(line) - 2)
+		n = sizeof(line) - 2;
+	line[n++] = '\n';
+	line[n] = '\0';
+
+	pthread_mutex_lock(&log_mutex);
+	fputs(line, stdout);
+	fflush(stdout);
+	if (record) {
+		fputs(line, record);
+		fflush(record);
+	}
+	for (i = 0; i < CUSE_MAX_CLIENTS; i++) {
+		if (clients[i] >= 0 && send(clients[i], line, n, MSG_DONTWAIT | MSG_NOSIGNAL) < 0
+		    && errno != EAGAIN) {
+			close(clients[i]);
+			clients[i] = -1;
+		}
+	}
+	pthread_mutex_unlock(&log_mutex);
+}
+
+/*
+ * ******	device	******
+ */
+
+/**
+ * \brief Put an event into the slot and wake up all pollers, like strixdlx_notify()
+ * Called with state_mutex held.
+ */
+static void box_notify(int event)
+{
+	struct strixdlx_event ev;
+	int i;
+
+	ev.volume = box.control_setting == 1 ? box.volume_headphone : box.volume_speaker;
+	ev.output = box.control_setting;
+	ev.event = event;
+	ev.seq = ++box.event_seq;
+
+	for (i = 0; i < CUSE_MAX_FILES; i++) {
+		if (file_used[i] && box.readbuflen && file_seq[i] != box.event_seq - 1) {
+			counters.overwritten++;
+			break;
+		}
+	}
+	counters.events++;
+	box.readbuflen = strixdlx_format_event(box.readbuf, sizeof(box.readbuf), &ev);
+	cuse_log("tx event %d %d %d %u", ev.volume, ev.output, ev.event, ev.seq);
+
+	for (i = 0; i < CUSE_MAX_FILES; i++) {
+		if (file_poll[i] == NULL)
+			continue;
+		fuse_lowlevel_notify_poll(file_poll[i]);
+		fuse_pollhandle_destroy(file_poll[i]);
+		file_poll[i] = NULL;
+	}
+}
+
+/**
+ * \brief Volume of the active output, called with state_mutex held
+ */
+static int *box_volume(void)
+{
+	return box.control_setting == 1 ? &box.volume_headphone : &box.volume_speaker;
+}
+
+static void cuse_open(fuse_req_t req, struct fuse_file_info *fi)
+{
+	int i;
+
+	pthread_mutex_lock(&state_mutex);
+	for (i = 0; i < CUSE_MAX_FILES && file_used[i]; i++)
+		;
+	if (i < CUSE_MAX_FILES) {
+		file_used[i] = 1;
+		file_seq[i] = 0;
+	}
+	pthread_mutex_unlock(&state_mutex);
+
+	if (i == CUSE_MAX_FILES) {
+		fuse_reply_err(req, EMFILE);
+		return;
+	}
+	fi->fh = i;
+	fi->nonseekable = 1;
+	fi->direct_io = 1;
+	fuse_reply_open(req, fi);
+}
+
+static void cuse_release(fuse_req_t req, struct fuse_file_info *fi)
+{
+	pthread_mutex_lock(&state_mutex);
+	if (file_poll[fi->fh]) {
+		fuse_pollhandle_destroy(file_poll[fi->fh]);
+		file_poll[fi->fh] = NULL;
+	}
+	file_used[fi->fh] = 0;
+	pthread_mutex_unlock(&state_mutex);
+	fuse_reply_err(req, 0);
+}
+
+/*
+ * returns the last event if this file has not read it yet, 0 bytes otherwise
+ */
+static void cuse_read(fuse_req_t req, size_t size, off_t off, struct fuse_file_info *fi)
+{
+	char buf[STRIXDLX_EVENT_LINE_SIZE];
+	size_t len;
+
+	pthread_mutex_lock(&state_mutex);
+	len = 0;
+	if (file_seq[fi->fh] != box.event_seq) {
+		len = box.readbuflen < size ? box.readbuflen : size;
+		memcpy(buf, box.readbuf, len);
+		file_seq[fi->fh] = box.event_seq;
+	}
+	counters.reads++;
+	if (len == 0)
+		counters.empty_reads++;
+	pthread_mutex_unlock(&state_mutex);
+
+	fuse_reply_buf(req, buf, len);
+}
+
+/*
+ * takes the first byte only: a volume of 0-100 or STRIXDLX_CMD_*,
+ * or the two bytes of an output volume command
+ */
+static void cuse_write(fuse_req_t req, const char *buf, size_t size, off_t off,
+		       struct fuse_file_info *fi)
+{
+	int cmd, value, output;
+
+	if (size == 0) {
+		fuse_reply_write(req, 0);
+		return;
+	}
+	cmd = (unsigned char)buf[0];
+
+	pthread_mutex_lock(&state_mutex);
+	if (cmd == STRIXDLX_CMD_VOLUME_SPEAKER || cmd == STRIXDLX_CMD_VOLUME_HEADPHONE) {
+		value = size >= 2 ? (unsigned char)buf[1] : -1;
+		if (value < 0 || value > 100) {
+			counters.rejected++;
+			cuse_log("rx invalid output volume");
+			pthread_mutex_unlock(&state_mutex);
+			fuse_reply_err(req, EINVAL);
+			return;
+		}
+		output = cmd == STRIXDLX_CMD_VOLUME_HEADPHONE;
+		counters.commands++;
+		cuse_log("rx %s volume %d", output ? "headphone" : "speaker", value);
+		if (output)
+			box.volume_headphone = value;
+		else
+			box.volume_speaker = value;
+		pthread_mutex_unlock(&state_mutex);
+		fuse_reply_write(req, 2);
+		return;
+	} else if (cmd == STRIXDLX_CMD_SPEAKER || cmd == STRIXDLX_CMD_HEADPHONE) {
+		counters.commands++;
+		cuse_log("rx %s", cmd == STRIXDLX_CMD_HEADPHONE ? "headphone" : "speaker");
+		box.control_setting = cmd == STRIXDLX_CMD_HEADPHONE;
+		box_notify(STRIXDLX_EVENT_OUTPUT);
+	} else if (cmd <= 100) {
+		counters.commands++;
+		cuse_log("rx volume %d", cmd);
+		*box_volume() = cmd;
+	} else {
+		counters.rejected++;
+		cuse_log("rx invalid 0x%02x", cmd);
+		pthread_mutex_unlock(&state_mutex);
+		fuse_reply_err(req, EINVAL);
+		return;
+	}
+	pthread_mutex_unlock(&state_mutex);
+
+	fuse_reply_write(req, 1);
+}
+
+static void cuse_poll(fuse_req_t req, struct fuse_file_info *fi, struct fuse_pollhandle *ph)
+{
+	unsigned int revents;
+
+	pthread_mutex_lock(&state_mutex);
+	if (ph) {
+		if (file_poll[fi->fh])
+			fuse_pollhandle_destroy(file_poll[fi->fh]);
+		file_poll[fi->fh] = ph;
+	}
+	revents = file_seq[fi->fh] != box.event_seq ? POLLIN : 0;
+	pthread_mutex_unlock(&state_mutex);
+
+	fuse_reply_poll(req, revents);
+}
+
+static const struct cuse_lowlevel_ops cuse_ops = {
+	.open = cuse_open,
+	.release = cuse_release,
+	.read = cuse_read,
+	.write = cuse_write,
+	.poll = cuse_poll,
+};
+
+static void *cuseThread(void *vargs)
+{
+	fuse_session_loop(vargs);
+	return NULL;
+}
+
+/*
+ * ******	commands	******
+ */
+
+/**
+ * \brief Knob step or button of the box, like the interrupt callback of the module
+ */
+static void gesture(int report)
+{
+	int *volume;
+
+	pthread_mutex_lock(&state_mutex);
+	volume = box_volume();
+	switch (report) {
+	case STRIXDLX_REPORT_UP:
+	case STRIXDLX_REPORT_DOWN:
+		*volume = strixdlx_step_volume(*volume,
+				report == STRIXDLX_REPORT_UP ? STRIXDLX_KNOB_STEP : -STRIXDLX_KNOB_STEP);
+		box_notify(STRIXDLX_EVENT_VOLUME);
+		break;
+	case STRIXDLX_REPORT_SWITCH:
+		box.control_setting = !box.control_setting;
+		box_notify(STRIXDLX_EVENT_OUTPUT);
+		break;
+	case STRIXDLX_REPORT_SONIC:
+		*volume = strixdlx_sonic_volume(*volume);
+		box_notify(STRIXDLX_EVENT_SONIC);
+		break;
+	}
+	pthread_mutex_unlock(&state_mutex);
+}
+
+static void sleep_ms(long ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000;
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
+}
+
+/**
+ * \brief Execute one command line
+ * \return 1 if the stand-in should stop
+ */
+static int command(char *line)
+{
+	struct strixdlx_event ev;
+	char dir[16];
+	int count, ms, i;
+
+	line[strcspn(line, "\r\n")] = '\0';
+
+	if (strcmp(line, "up") == 0)
+		gesture(STRIXDLX_REPORT_UP);
+	else if (strcmp(line, "down") == 0)
+		gesture(STRIXDLX_REPORT_DOWN);
+	else if (strcmp(line, "switch") == 0)
+		gesture(STRIXDLX_REPORT_SWITCH);
+	else if (strcmp(line, "sonic") == 0)
+		gesture(STRIXDLX_REPORT_SONIC);
+	else if (strcmp(line, "init") == 0) {
+		pthread_mutex_lock(&state_mutex);
+		box_notify(STRIXDLX_EVENT_INIT);
+		pthread_mutex_unlock(&state_mutex);
+	} else if (strncmp(line, "event ", 6) == 0) {
+		if (strixdlx_parse_event(line + 6, &ev) < 0 || ev.output < 0) {
+			cuse_log("error invalid event: %s", line + 6);
+			return 0;
+		}
+		pthread_mutex_lock(&state_mutex);
+		box.control_setting = ev.output == 1;
+		*box_volume() = ev.volume;
+		box_notify(ev.event);
+		pthread_mutex_unlock(&state_mutex);
+	} else if (sscanf(line, "spin %d %15s", &count, dir) == 2) {
+		if (sscanf(line, "spin %*d %*s %d", &ms) != 1)
+			ms = 0;
+		for (i = 0; i < count; i++) {
+			gesture(strcmp(dir, "down") == 0 ? STRIXDLX_REPORT_DOWN : STRIXDLX_REPORT_UP);
+			if (ms > 0)
+				sleep_ms(ms);
+		}
+	} else if (sscanf(line, "sleep %d", &ms) == 1)
+		sleep_ms(ms);
+	else if (strcmp(line, "stats") == 0) {
+		pthread_mutex_lock(&state_mutex);
+		cuse_log("stats events=%lu overwritten=%lu reads=%lu empty=%lu commands=%lu rejected=%lu",
+			 counters.events, counters.overwritten, counters.reads,
+			 counters.empty_reads, counters.commands, counters.rejected);
+		pthread_mutex_unlock(&state_mutex);
+	} else if (strcmp(line, "quit") == 0)
+		return 1;
+	else if (line[0] != '\0' && line[0] != '#')
+		cuse_log("error unknown command: %s", line);
+	return 0;
+}
+
+/**
+ * Thread serving the control socket
+ */
+static void *controlThread(void *vargs)
+{
+	int listen_fd = *(int *)vargs;
+	struct pollfd pfds[CUSE_MAX_CLIENTS + 1];
+	char buf[CUSE_MAX_CLIENTS][CUSE_LINE_SIZE];
+	size_t fill[CUSE_MAX_CLIENTS] = {0};
+	char *nl;
+	int i, fd;
+	ssize_t n;
+
+	while (1) {
+		pfds[0].fd = listen_fd;
+		pfds[0].events = POLLIN;
+		pthread_mutex_lock(&log_mutex);
+		for (i = 0; i < CUSE_MAX_CLIENTS; i++) {
+			pfds[i + 1].fd = clients[i];
+			pfds[i + 1].events = POLLIN;
+			pfds[i + 1].revents = 0;
+		}
+		pthread_mutex_unlock(&log_mutex);
+
+		if (poll(pfds, CUSE_MAX_CLIENTS + 1, -1) < 0)
+			continue;
+
+		if (pfds[0].revents & POLLIN) {
+			fd = accept(listen_fd, NULL, NULL);
+			pthread_mutex_lock(&log_mutex);
+			for (i = 0; fd >= 0 && i < CUSE_MAX_CLIENTS; i++) {
+				if (clients[i] < 0) {
+					clients[i] = fd;
+					fill[i] = 0;
+					fd = -1;
+				}
+			}
+			pthread_mutex_unlock(&log_mutex);
+			if (fd >= 0)
+				close(fd);
+		}
+
+		for (i = 0; i < CUSE_MAX_CLIENTS; i++) {
+			if (pfds[i + 1].fd < 0 || !(pfds[i + 1].revents & (POLLIN | POLLHUP)))
+				continue;
+			n = recv(pfds[i + 1].fd, buf[i] + fill[i], sizeof(buf[i]) - fill[i] - 1, 0);
+			if (n <= 0) {
+				pthread_mutex_lock(&log_mutex);
+				if (clients[i] == pfds[i + 1].fd) {
+					close(clients[i]);
+					clients[i] = -1;
+				}
+				pthread_mutex_unlock(&log_mutex);
+				continue;
+			}
+			fill[i] += n;
+			buf[i][fill[i]] = '\0';
+			while ((nl = strchr(buf[i], '\n')) != NULL) {
+				*nl = '\0';
+				if (command(buf[i]))
+					exit(EXIT_SUCCESS);
+				fill[i] -= nl + 1 - buf[i];
+				memmove(buf[i], nl + 1, fill[i] + 1);
+			}
+			//line too long
+			if (fill[i] == sizeof(buf[i]) - 1)
+				fill[i] = 0;
+		}
+	}
+	return NULL;
+}
+
+static int control_open(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, CUSE_MAX_CLIENTS) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void print_help(const char *name)
+{
+	printf("\n Usage: %s [OPTIONS]\n\n", name);
+	printf("  Options:\n");
+	printf("   -h --help                 Print this help\n");
+	printf("   -n --name name            Device name below /dev (default strixdlx)\n");
+	printf("   -c --control path         Accept commands on this unix socket\n");
+	printf("   -r --record file          Append the log to a file\n");
+	printf("   -v --volume speaker,headphone  Volumes at start (default 100,100)\n");
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static struct option long_options[] = {
+		{"name", required_argument, 0, 'n'},
+		{"control", required_argument, 0, 'c'},
+		{"record", required_argument, 0, 'r'},
+		{"volume", required_argument, 0, 'v'},
+		{"help", no_argument, 0, 'h'},
+		{NULL, 0, 0, 0}
+	};
+	const char *name = "strixdlx", *control = NULL;
+	char devname[CUSE_LINE_SIZE], line[CUSE_LINE_SIZE];
+	const char *dev_info_argv[] = { devname };
+	//foreground and single threaded, the callbacks lock the state anyway
+	char *fuse_argv[] = { argv[0], "-f", "-s", NULL };
+	struct cuse_info ci;
+	struct fuse_session *se;
+	pthread_t thread_cuse, thread_control;
+	int value, control_fd, multithreaded, i;
+
+	while ((value = getopt_long(argc, argv, "n:c:r:v:h", long_options, NULL)) != -1) {
+		switch (value) {
+		case 'n':
+			name = optarg;
+			break;
+		case 'c':
+			control = optarg;
+			break;
+		case 'r':
+			record = fopen(optarg, "a");
+			if (record == NULL) {
+				perror(optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'v':
+			if (sscanf(optarg, "%d,%d", &box.volume_speaker, &box.volume_headphone) != 2
+			    || box.volume_speaker < 0 || box.volume_speaker > 100
+			    || box.volume_headphone < 0 || box.volume_headphone > 100) {
+				fprintf(stderr, "volumes must be between 0 and 100\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'h':
+			print_help(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			print_help(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	for (i = 0; i < CUSE_MAX_CLIENTS; i++)
+		clients[i] = -1;
+
+	snprintf(devname, sizeof(devname), "DEVNAME=%s", name);
+	memset(&ci, 0, sizeof(ci));
+	ci.dev_info_argc = 1;
+	ci.dev_info_argv = dev_info_argv;
+
+	se = cuse_lowlevel_setup(3, fuse_argv, &ci, &cuse_ops, &multithreaded, NULL);
+	if (se == NULL) {
+		fprintf(stderr, "could not create /dev/%s, is the cuse module loaded?\n", name);
+		return EXIT_FAILURE;
+	}
+	pthread_create(&thread_cuse, NULL, cuseThread, se);
+
+	if (control != NULL) {
+		control_fd = control_open(control);
+		if (control_fd < 0) {
+			perror(control);
+			return EXIT_FAILURE;
+		}
+		pthread_create(&thread_control, NULL, controlThread, &control_fd);
+	}
+
+	//a probed device tells the volume first
+	pthread_mutex_lock(&state_mutex);
+	box_notify(STRIXDLX_EVENT_INIT);
+	pthread_mutex_unlock(&state_mutex);
+
+	while (fgets(line, sizeof(line), stdin) != NULL) {
+		if (command(line))
+			return EXIT_SUCCESS;
+	}
+
+	//stdin closed, keep serving the device until a signal ends the session
+	pthread_join(thread_cuse, NULL);
+	cuse_lowlevel_teardown(se);
+	return EXIT_SUCCESS;
+}
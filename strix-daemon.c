@@ -18,6 +18,8 @@
  * 
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -29,63 +31,255 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <errno.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/eventfd.h>
 
 #include <pthread.h>
 #include <poll.h>
-#include <alsa/asoundlib.h>
-#include <alsa/control.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "libstrixdlx.h"
+#include "strix-backend.h"
+#include "strix-backend-null.h"
+#include "strix-ramp.h"
+#include "strix-stats.h"
+#include "strix-server.h"
+#include "strix-status.h"
+#include "strix-systemd.h"
+#include "strix-trace.h"
+
+//events read from the device at once
+#define EVENT_BATCH		16
+
+//retry interval for opening a missing device
+#define REOPEN_INTERVAL_MS	1000
+#define UEVENT_BUFFER_SIZE	8192
+//netlink group of the events udev sends on after its rules ran
+#define UEVENT_GROUP_UDEV	2
+//udev events start with "libudev" and a header, properties_off is at this offset
+#define UEVENT_UDEV_PREFIX	"libudev"
+#define UEVENT_UDEV_PROPERTIES	16
 
-//device to talk with
-#define DEFAULT_DEVICE		"/dev/strixdlx"
+#define UEVENT_NONE		0
+#define UEVENT_ADD		1
+#define UEVENT_REMOVE		2
+
+//time for the last updates after a replay
+#define REPLAY_SETTLE_MS	200
+
+//stack of every thread with --mlock, the default 8MB would all be locked
+#define LOCKED_STACK_SIZE	(512 * 1024)
 
 pthread_t thread_id_read;
 pthread_t thread_id_write;
+pthread_t thread_id_stats;
+pthread_t thread_id_server;
+pthread_t thread_id_replay;
+pthread_t thread_id_discover;
 
 pthread_mutex_t lockWriteMutex;
-const char *card = "default";
-const char *selem_name = "Master";
-snd_mixer_t *handle;
-snd_mixer_selem_id_t *sid;
-snd_mixer_elem_t* elem;
 
-//min and max values for alsa
-long min, max;
-//volume
-long volume = 0;
+//control boxes one daemon serves at most
+#define STRIX_MAX_BOXES		8
+#define BOX_NODE_SIZE		32
+
+//audio backend of the boxes without a setting of their own (--box)
+static struct strix_backend backend_defaults;
+static const char *backend_name = NULL;
+
+//debounce state of one mixer element, used by the write thread only
+struct mixer_sync {
+	int pending;
+	long long deadline, pending_since, last_send;
+	uint64_t noticed;
+};
+
+/*
+ * One control box and the mixer it is mapped to
+ * Access is locked with lockWriteMutex, except for sync which belongs to the
+ * write thread. Boxes are only ever added: by main() and, for --discover,
+ * by the discover thread. It publishes box_count with lockWriteMutex held,
+ * threads reading it without the lock load it atomically.
+ */
+struct strix_box {
+	const char *path;		//device node or a link to it (/dev/strixdlx-by-path/...)
+	char *spec;			//copy of the --box argument, the strings point into it
+	char node[BOX_NODE_SIZE];	//name of the device node while it is open
+	const char *backend_name;
+	struct strix_backend backend;
+	//opened control box, -1 while it is not connected
+	int fd;
+	//both outputs on one mixer element (the default): a switch moves the mixer to
+	//the volume of the new output. With an element per output the switch is a
+	//relay action only and every element is kept in sync with its own output.
+	int shared_mixer;
+	//module takes STRIXDLX_CMD_VOLUME_*, cleared when an older one rejects it
+	int output_cmd_supported;
+	//mixer volume in percent per mixer element, see mixer_of()
+	int volume[STRIX_OUTPUTS];
+	//volume in percent the control box holds per output
+	int box_volume[STRIX_OUTPUTS];
+	//active output of the control box, -1 if not known yet
+	int box_output;
+	//volume ramp in progress per mixer element
+	struct strix_ramp ramp[STRIX_OUTPUTS];
+	//debounce of the mixer -> box updates per mixer element
+	struct mixer_sync sync[STRIX_OUTPUTS];
+	//counters of this box, the stats_* counters hold the sums
+	uint64_t count[CNT_COUNT];
+};
+
+static struct strix_box boxes[STRIX_MAX_BOXES];
+static int box_count = 0;
+//the first box is the one of the clients, the status and the trace
+#define primary_box	(&boxes[0])
+//serve every strixdlx device, not only the configured ones
+static int discover = 0;
+//incremented for every added box, wakes the write thread to poll its mixer
+static unsigned int box_generation = 0;
+static int box_added_fd = -1;
+//the read thread sends added device nodes to the discover thread on [0], it answers every box on [1]
+static int discover_fd[2] = { -1, -1 };
+
+static const char *device_path = STRIXDLX_DEFAULT_DEVICE;
+static const char *socket_path = NULL;
+static int socket_enabled = 1;
+//shared memory status for status bars, see strix-status.h
+static const char *status_name = STRIX_STATUS_NAME;
+static int status_enabled = 1;
 
+//trace recording and replay, see strix-trace.h
+static const char *trace_path = NULL;
+static const char *replay_path = NULL;
+static int replay_fast = 0;
+//mock device of a replay: the daemon uses replay_fd, the replay thread replay_peer
+static int replay_fd = -1;
+static int replay_peer = -1;
+
+//low latency mode of the read thread: SCHED_FIFO priority (0 = off), cpu (-1 = any)
+static int rt_prio = 0;
+static int rt_cpu = -1;
+static int lock_memory = 0;
+
+//debounce and rate limit for mixer -> box updates
+#define DEFAULT_DEBOUNCE_MS	20
+#define DEFAULT_MIN_INTERVAL_MS	40
+
+static long long debounce_ms = DEFAULT_DEBOUNCE_MS;
+static long long min_interval_ms = DEFAULT_MIN_INTERVAL_MS;
+
+//volume ramps for knob and sonic button, see strix-ramp.h
+#define DEFAULT_RAMP_MS		200
+#define DEFAULT_RAMP_STEPS	20
+
+static int ramp_ms = DEFAULT_RAMP_MS;
+static int ramp_steps = DEFAULT_RAMP_STEPS;
+static int ramp_curve = RAMP_SMOOTH;
+
+//classic double forking daemon instead of a service manager child
+static int daemon_mode = 0;
 static char *pid_file_name = NULL;
 static int pid_fd = -1;
 static char *app_name = NULL;
 static FILE *log_stream;
 
+//one-shot modes for scripts, run before anything of the daemon is set up
+#define CLI_NONE		0
+#define CLI_GET			1	/* print the active output and its volume */
+#define CLI_SET			2	/* switch the output and/or set the volume */
+#define CLI_WATCH		3	/* print every event until interrupted */
+
+static int cli_mode = CLI_NONE;
+static int cli_volume = -1;
+static int cli_output = -1;
+static const char *cli_output_names[STRIX_OUTPUTS] = { "speaker", "headphone" };
+static const char *cli_event_names[] = { "volume", "output", "sonic", "init" };
+
 /**
- * \brief Callback function for handling signals.
- * \param	sig	identifier of signal
+ * \brief Wait for the signals of the daemon
+ * SIGINT, SIGTERM and SIGHUP are blocked in every thread and taken here with
+ * sigwait(), so they are handled in normal thread context which may lock and
+ * use stdio. SIGTERM is what systemctl stop sends.
+ * \param	set	the blocked signals
+ * Returns on SIGINT and SIGTERM.
  */
-void handle_signal(int sig)
+static void wait_signals(const sigset_t *set)
 {
-	if (sig == SIGINT) {
-		fprintf(log_stream, "Debug: stopping daemon ...\n");
-        if (thread_id_read >=0) {
-            pthread_kill(thread_id_read, SIGINT);
-            pthread_kill(thread_id_write, SIGINT);
-        } 
-		/* Unlock and close lockfile */
-		if (pid_fd != -1) {
-			lockf(pid_fd, F_ULOCK, 0);
-			close(pid_fd);
-		}
-		/* Try to delete lockfile */
-		if (pid_file_name != NULL) {
-			unlink(pid_file_name);
+	int sig;
+
+	while (1) {
+		if (sigwait(set, &sig) != 0)
+			continue;
+		if (sig == SIGINT || sig == SIGTERM)
+			return;
+		if (sig == SIGHUP)
+			fprintf(log_stream, "Debug: reloading daemon config file ...\n");
+	}
+}
+
+/**
+ * \brief Remove what the daemon left in the file system and write out the trace
+ * The other threads touch the status and the clients only with lockWriteMutex
+ * held, it is kept until the process exits.
+ */
+static void daemon_stop(void)
+{
+	fprintf(log_stream, "Debug: stopping daemon ...\n");
+	systemd_notify("STOPPING=1");
+	pthread_mutex_lock(&lockWriteMutex);
+	/* Unlock and close lockfile */
+	if (pid_fd != -1) {
+		lockf(pid_fd, F_ULOCK, 0);
+		close(pid_fd);
+	}
+	/* Try to delete lockfile */
+	if (pid_file_name != NULL) {
+		unlink(pid_file_name);
+	}
+	/* Remove the client socket and the status */
+	server_close();
+	status_close();
+	/* Write out the trace */
+	trace_close();
+}
+
+/**
+ * \brief Close every open file descriptor
+ * close_range() does it with one system call. Older kernels get the open
+ * descriptors from /proc/self/fd, trying every number up to _SC_OPEN_MAX
+ * would be a million system calls in a container with a high limit.
+ */
+static void close_all_fds(void)
+{
+	DIR *dir;
+	struct dirent *de;
+	int fd;
+
+#ifdef SYS_close_range
+	if (syscall(SYS_close_range, 0, ~0U, 0) == 0)
+		return;
+#endif
+	dir = opendir("/proc/self/fd");
+	if (dir != NULL) {
+		while ((de = readdir(dir)) != NULL) {
+			if (de->d_name[0] == '.')
+				continue;
+			fd = atoi(de->d_name);
+			if (fd != dirfd(dir))
+				close(fd);
 		}
-		/* Reset signal handling to default behavior */
-		signal(SIGINT, SIG_DFL);
-	} else if (sig == SIGHUP) {
-		fprintf(log_stream, "Debug: reloading daemon config file ...\n");
-	} else if (sig == SIGCHLD) {
-		fprintf(log_stream, "Debug: received SIGCHLD signal\n");
+		closedir(dir);
+		return;
 	}
+	for (fd = sysconf(_SC_OPEN_MAX) - 1; fd >= 0; fd--)
+		close(fd);
 }
 
 /**
@@ -94,7 +288,6 @@ void handle_signal(int sig)
 static void daemonize()
 {
 	pid_t pid = 0;
-	int fd;
 
 	/* Fork off the parent process */
 	pid = fork();
@@ -138,9 +331,7 @@ static void daemonize()
 	chdir("/");
 
 	/* Close all open file descriptors */
-	for (fd = sysconf(_SC_OPEN_MAX); fd > 0; fd--) {
-		close(fd);
-	}
+	close_all_fds();
 
 	/* Reopen stdin (fd = 0), stdout (fd = 1), stderr (fd = 2) */
 	stdin = fopen("/dev/null", "r");
@@ -168,182 +359,1723 @@ static void daemonize()
 }
 
 /**
- * send a commant to the strixdlx kernel module
- * \param fd device to write to
- * \param cmd the volume to submit to the device
- * 
+ * \brief Open a netlink socket receiving the uevents udev has processed
+ * The kernel group announces a device before udev created its links and set
+ * its permissions, a configured /dev/strixdlx-by-path/... would not resolve yet.
+ * \return socket or -1 on error
  */
-void send_cmd(int fd, int cmd)
+static int uevent_open(void)
 {
-	int retval = 0;
+	struct sockaddr_nl addr;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+	if (fd < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_pid = 0;
+	addr.nl_groups = UEVENT_GROUP_UDEV;
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * \brief Check if a uevent belongs to a strixdlx device
+ * The usb build registers usbmisc devices, the HID build misc devices.
+ * \param buf	udev message, a header followed by KEY=VALUE strings, or a kernel
+ *		uevent, "action@devpath" followed by KEY=VALUE strings
+ * \param len	length of the message, the buffer holds a 0 after it
+ * \param node	gets the name of the device node, e.g. "strixdlx1"
+ * \return UEVENT_ADD, UEVENT_REMOVE or UEVENT_NONE
+ */
+static int uevent_parse(const char *buf, int len, char *node, size_t size)
+{
+	const char *p, *name, *end = buf + len;
+	int subsystem = 0, strixdlx = 0, action = UEVENT_NONE;
+	uint32_t off;
+
+	p = buf;
+	if (len > UEVENT_UDEV_PROPERTIES + (int)sizeof(off)
+	    && memcmp(buf, UEVENT_UDEV_PREFIX, sizeof(UEVENT_UDEV_PREFIX)) == 0) {
+		memcpy(&off, buf + UEVENT_UDEV_PROPERTIES, sizeof(off));
+		if (off >= (uint32_t)len)
+			return UEVENT_NONE;
+		p = buf + off;
+	}
+
+	for (; p < end; p += strlen(p) + 1) {
+		if (strcmp(p, "ACTION=add") == 0)
+			action = UEVENT_ADD;
+		else if (strcmp(p, "ACTION=remove") == 0)
+			action = UEVENT_REMOVE;
+		else if (strcmp(p, "SUBSYSTEM=usbmisc") == 0 || strcmp(p, "SUBSYSTEM=misc") == 0)
+			subsystem = 1;
+		else if (strncmp(p, "DEVNAME=", 8) == 0 && strstr(p + 8, "strixdlx") != NULL) {
+			strixdlx = 1;
+			name = strrchr(p + 8, '/');
+			snprintf(node, size, "%s", name ? name + 1 : p + 8);
+		}
+	}
+
+	if (!subsystem || !strixdlx)
+		return UEVENT_NONE;
+	return action;
+}
+
+/**
+ * \brief Count an action for the statistics of the daemon and of the box
+ */
+static void box_inc(struct strix_box *b, enum strix_counter counter)
+{
+	stats_inc(counter);
+	__atomic_add_fetch(&b->count[counter], 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * \brief Record into the trace, for the primary box only
+ * A replay has one mock device, the other boxes would garble the trace.
+ */
+static void box_trace(const struct strix_box *b, int type, int output, int value, int flags)
+{
+	if (b == primary_box)
+		trace_record(type, output, value, flags);
+}
+
+/**
+ * \brief Mixer element following an output of the box
+ */
+static int mixer_of(const struct strix_box *b, int output)
+{
+	return b->shared_mixer || output < 0 ? 0 : output;
+}
+
+/**
+ * \brief Number of mixer elements kept in sync with the box
+ */
+static int mixer_count(const struct strix_box *b)
+{
+	return b->shared_mixer ? 1 : STRIX_OUTPUTS;
+}
+
+/**
+ * \brief Output of the box a mixer element stands for, the active one if shared
+ */
+static int output_of(const struct strix_box *b, int m)
+{
+	if (b->shared_mixer)
+		return b->box_output < 0 ? 0 : b->box_output;
+	return m;
+}
 
-	retval = write(fd, &cmd, 1);
-	if (retval < 0)
-		fprintf(stderr, "could not send command to fd=%d\n", fd);
+/**
+ * \brief Send the volume of a mixer element to the box
+ * Called with lockWriteMutex held. With an element per output the volume goes
+ * to its output, active or not. A module without the per output command only
+ * takes the volume of the active output, the other one is sent when the relay
+ * switches to it (see device_event()).
+ * \return 1 if sent, 0 if there is no box or the update is deferred, -1 on error
+ */
+static int box_send_volume(struct strix_box *b, int m, int pct)
+{
+	int output = output_of(b, m);
+	int err = -1;
+
+	if (b->fd < 0)
+		return 0;
+
+	if (!b->shared_mixer && b->output_cmd_supported) {
+		err = strixdlx_set_output_volume(b->fd, output, pct);
+		if (err < 0 && errno == EINVAL) {
+			syslog(LOG_INFO, "module has no per output volume command, "
+			       "the inactive output is updated on a switch");
+			b->output_cmd_supported = 0;
+		}
+	}
+	if (b->shared_mixer || !b->output_cmd_supported) {
+		if (!b->shared_mixer && output != b->box_output)
+			return 0;
+		err = strixdlx_set_volume(b->fd, pct);
+	}
+
+	if (err < 0) {
+		fprintf(stderr, "could not send command to fd=%d\n", b->fd);
+		box_inc(b, CNT_ERRORS);
+		return -1;
+	}
+	b->box_volume[output] = pct;
+	box_inc(b, CNT_BOX_WRITES);
+	box_trace(b, TRACE_BOX_WRITE, output, pct, 0);
+	return 1;
+}
+
+/**
+ * \brief Publish the state of the primary box for status bars
+ * Called with lockWriteMutex held after every change, an unchanged state is
+ * not published again.
+ */
+static void status_update(const struct strix_box *b)
+{
+	struct strix_status_data data;
+	int o, pct;
+
+	if (b != primary_box)
+		return;
+
+	memset(&data, 0, sizeof(data));
+	data.flags = (b->fd >= 0 ? STRIX_STATUS_CONNECTED : 0) | (b->shared_mixer ? 0 : STRIX_STATUS_SEPARATE);
+	data.output = b->box_output < 0 ? 0 : b->box_output;
+	for (o = 0; o < STRIX_OUTPUTS; o++) {
+		//a shared element holds the volume of the active output only
+		if (b->shared_mixer && o != data.output)
+			pct = b->box_volume[o];
+		else
+			pct = b->volume[mixer_of(b, o)];
+		data.volume[o] = pct < 0 ? STRIX_STATUS_UNKNOWN : pct;
+		//the box has no mute switch, the sonic button mutes with volume 0
+		if (pct == 0)
+			data.mute |= 1 << o;
+	}
+	status_publish(&data);
+}
+
+/**
+ * \brief Open the control box and bring it in sync with the mixer
+ *
+ * The kernel module queues the volume of its own initial setting on probe.
+ * Only the active output is taken from it, the mixer is the master after a
+ * (re)connect and the volume of every element is pushed to the box.
+ * \return 0 on success, -1 if the device is not available
+ */
+static int box_open(struct strix_box *b)
+{
+	struct strixdlx_event events[EVENT_BATCH];
+	char real[PATH_MAX];
+	const char *name;
+	int fd, n, m, pct;
+
+	fd = b == primary_box && replay_fd >= 0 ? replay_fd : strixdlx_device_open(b->path);
+	if (fd == -1)
+		return -1;
+
+	//the probe tells the relay position, older events are stale
+	n = strixdlx_read_events(fd, events, EVENT_BATCH);
+	strixdlx_discard_events(fd);
+
+	pthread_mutex_lock(&lockWriteMutex);
+	b->fd = fd;
+	//uevents name the node, a configured path may be a link to it
+	name = realpath(b->path, real) ? strrchr(real, '/') : NULL;
+	snprintf(b->node, sizeof(b->node), "%s", name ? name + 1 : "");
+	b->box_volume[STRIX_OUTPUT_SPEAKER] = -1;
+	b->box_volume[STRIX_OUTPUT_HEADPHONE] = -1;
+	if (n > 0 && events[n - 1].output >= 0)
+		b->box_output = events[n - 1].output;
+	box_inc(b, CNT_RECONNECTS);
+	for (m = 0; m < mixer_count(b); m++) {
+		if (b->backend.ops->get_volume(&b->backend, m, &pct) < 0)
+			continue;
+		b->volume[m] = pct;
+		box_send_volume(b, m, pct);
+	}
+	status_update(b);
+	pthread_mutex_unlock(&lockWriteMutex);
+
+	syslog(LOG_INFO, "control box %s connected", b->path);
+	return 0;
+}
+
+/**
+ * \brief Close the control box after it was removed. ALSA state is kept.
+ */
+static void box_close(struct strix_box *b)
+{
+	pthread_mutex_lock(&lockWriteMutex);
+	if (b->fd >= 0) {
+		strixdlx_device_close(b->fd);
+		syslog(LOG_INFO, "control box %s disconnected", b->path);
+	}
+	b->fd = -1;
+	b->node[0] = '\0';
+	b->box_volume[STRIX_OUTPUT_SPEAKER] = -1;
+	b->box_volume[STRIX_OUTPUT_HEADPHONE] = -1;
+	status_update(b);
+	pthread_mutex_unlock(&lockWriteMutex);
+}
+
+/**
+ * \brief Set up a box and open its audio backend, the device is opened later
+ * Settings the --box argument left out come from the global options.
+ * \return 0 on success, -1 if the backend could not be opened
+ */
+static int box_setup(struct strix_box *b)
+{
+	const char **element = b->backend.element;
+	int m;
+
+	b->fd = -1;
+	b->box_output = -1;
+	b->output_cmd_supported = 1;
+	for (m = 0; m < STRIX_OUTPUTS; m++) {
+		b->volume[m] = -1;
+		b->box_volume[m] = -1;
+		if (element[m] == NULL)
+			element[m] = backend_defaults.element[m];
+	}
+	if (b->backend.card == NULL)
+		b->backend.card = backend_defaults.card;
+	if (b->backend_name == NULL)
+		b->backend_name = backend_name;
+
+	//the same element (or none) for both outputs is one mixer
+	if (element[STRIX_OUTPUT_SPEAKER] == NULL || element[STRIX_OUTPUT_HEADPHONE] == NULL)
+		b->shared_mixer = element[STRIX_OUTPUT_SPEAKER] == element[STRIX_OUTPUT_HEADPHONE];
+	else
+		b->shared_mixer = strcmp(element[STRIX_OUTPUT_SPEAKER], element[STRIX_OUTPUT_HEADPHONE]) == 0;
+	if (!b->shared_mixer)
+		syslog(LOG_INFO, "%s: speaker and headphone have their own mixer element", b->path);
+
+	for (m = 0; m < STRIX_OUTPUTS; m++) {
+		if (ramp_init(&b->ramp[m], ramp_ms, ramp_steps, ramp_curve) < 0) {
+			perror("timerfd");
+			goto error;
+		}
+	}
+
+	b->backend.ops = strix_backend_find(b->backend_name);
+	if (b->backend.ops == NULL) {
+		fprintf(stderr, "unknown backend %s\n", b->backend_name);
+		goto error;
+	}
+	if (b->backend.ops->open(&b->backend) < 0) {
+		fprintf(stderr, "could not open %s backend for %s\n", b->backend.ops->name, b->path);
+		b->backend.ops = NULL;
+		goto error;
+	}
+	return 0;
+
+error:
+	for (m = 0; m < STRIX_OUTPUTS; m++)
+		ramp_free(&b->ramp[m]);
+	return -1;
+}
+
+/**
+ * \brief Box of the command line: "path[,card=name][,element=name][,speaker=name]
+ * [,headphone=name][,backend=name]"
+ * \return 0 on success, -1 if the argument is wrong or there are too many boxes
+ */
+static int box_parse(const char *arg)
+{
+	struct strix_box *b;
+	char *key, *value, *next;
+
+	if (box_count >= STRIX_MAX_BOXES) {
+		fprintf(stderr, "at most %d boxes are possible\n", STRIX_MAX_BOXES);
+		return -1;
+	}
+	b = &boxes[box_count];
+	memset(b, 0, sizeof(*b));
+	b->spec = strdup(arg);
+	if (b->spec == NULL)
+		return -1;
+
+	next = strchr(b->spec, ',');
+	if (next != NULL)
+		*next++ = '\0';
+	b->path = b->spec;
+
+	for (key = next; key != NULL; key = next) {
+		next = strchr(key, ',');
+		if (next != NULL)
+			*next++ = '\0';
+		value = strchr(key, '=');
+		if (value == NULL)
+			goto error;
+		*value++ = '\0';
+		if (strcmp(key, "card") == 0) {
+			b->backend.card = value;
+		} else if (strcmp(key, "element") == 0) {
+			b->backend.element[STRIX_OUTPUT_SPEAKER] = value;
+			b->backend.element[STRIX_OUTPUT_HEADPHONE] = value;
+		} else if (strcmp(key, "speaker") == 0) {
+			b->backend.element[STRIX_OUTPUT_SPEAKER] = value;
+		} else if (strcmp(key, "headphone") == 0) {
+			b->backend.element[STRIX_OUTPUT_HEADPHONE] = value;
+		} else if (strcmp(key, "backend") == 0) {
+			b->backend_name = value;
+		} else {
+			goto error;
+		}
+	}
+	if (b->path[0] == '\0')
+		goto error;
+	box_count++;
+	return 0;
+
+error:
+	fprintf(stderr, "invalid box %s\n", arg);
+	free(b->spec);
+	b->spec = NULL;
+	return -1;
+}
+
+/**
+ * \brief Check if a box is the one of a device node
+ */
+static int box_serves(const struct strix_box *b, const char *node)
+{
+	char real[PATH_MAX];
+	const char *name;
+
+	if (b->fd >= 0)
+		return strcmp(b->node, node) == 0;
+	if (realpath(b->path, real) == NULL)
+		return 0;
+	name = strrchr(real, '/');
+	return strcmp(name ? name + 1 : real, node) == 0;
+}
+
+/**
+ * \brief Add a box for a device node no box serves yet, with --discover
+ * Runs in the discover thread, the only one adding boxes after start. The box
+ * is set up and opened before it is counted, then the write thread is woken
+ * to poll the new mixer and the read thread to poll the device.
+ */
+static void box_discover(const char *node)
+{
+	struct strix_box *b;
+	uint64_t one = 1;
+	char added = 1;
+	int i, served = 0;
+
+	pthread_mutex_lock(&lockWriteMutex);
+	for (i = 0; i < box_count && !served; i++)
+		served = box_serves(&boxes[i], node);
+	pthread_mutex_unlock(&lockWriteMutex);
+	if (served)
+		return;
+	if (box_count >= STRIX_MAX_BOXES) {
+		syslog(LOG_WARNING, "no room for control box %s", node);
+		return;
+	}
+
+	b = &boxes[box_count];
+	memset(b, 0, sizeof(*b));
+	b->spec = malloc(strlen(node) + 6);
+	if (b->spec == NULL)
+		return;
+	sprintf(b->spec, "/dev/%s", node);
+	b->path = b->spec;
+	if (box_setup(b) < 0) {
+		free(b->spec);
+		b->spec = NULL;
+		return;
+	}
+	//the read thread probes it again while it is missing
+	box_open(b);
+
+	pthread_mutex_lock(&lockWriteMutex);
+	__atomic_store_n(&box_count, box_count + 1, __ATOMIC_RELEASE);
+	box_generation++;
+	pthread_mutex_unlock(&lockWriteMutex);
+	if (write(box_added_fd, &one, sizeof(one)) < 0)
+		perror("eventfd");
+	if (send(discover_fd[1], &added, sizeof(added), MSG_NOSIGNAL) < 0)
+		perror("discover");
+	syslog(LOG_INFO, "discovered control box %s", b->path);
+}
+
+/**
+ * \brief Add a box for every strixdlx device node present, with --discover
+ */
+static void box_discover_all(void)
+{
+	DIR *dir;
+	struct dirent *de;
+	const char *p;
+
+	dir = opendir("/dev");
+	if (dir == NULL)
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		if (strncmp(de->d_name, "strixdlx", 8) != 0 || de->d_name[8] == '\0')
+			continue;
+		for (p = de->d_name + 8; *p >= '0' && *p <= '9'; p++)
+			;
+		if (*p == '\0')
+			box_discover(de->d_name);
+	}
+	closedir(dir);
+}
+
+/**
+ * \brief Write a volume of the box (or a step of a ramp towards it) to a mixer element
+ * Called with lockWriteMutex held. The write thread sees the change as our
+ * own, volume always is what we wrote last.
+ * \param m		mixer element
+ * \param received	time the device event was read, 0 for later steps of a ramp
+ */
+static void mixer_write(struct strix_box *b, int m, int pct, uint64_t received)
+{
+	uint64_t written;
+
+	written = stats_now();
+	if (b->backend.ops->set_volume(&b->backend, m, pct) < 0) {
+		box_inc(b, CNT_ERRORS);
+	} else {
+		box_inc(b, CNT_MIXER_WRITES);
+		box_trace(b, TRACE_MIXER_WRITE, m, pct, 0);
+		written = stats_now() - written;
+		stats_record(HIST_MIXER_WRITE, written);
+		if (received)
+			stats_record(HIST_KNOB_TO_MIXER, stats_now() - received);
+	}
+	//save volume to internal
+	b->volume[m] = pct;
+}
+
+/**
+ * \brief Next step of the running volume ramp of a mixer element
+ */
+static void ramp_tick(struct strix_box *b, int m)
+{
+	int pct;
+
+	pthread_mutex_lock(&lockWriteMutex);
+	pct = ramp_step(&b->ramp[m]);
+	if (pct >= 0) {
+		mixer_write(b, m, pct, 0);
+		status_update(b);
+	}
+	pthread_mutex_unlock(&lockWriteMutex);
+}
+
+/**
+ * \brief Forward one event of the control box to the mixer and the clients
+ * The mixer follows with a ramp, the clients get the target volume at once.
+ * With an element per output a switch does not touch the mixer, the box is
+ * told the volume of the new element instead if it holds another one.
+ * \param ev		event read from the device
+ * \param received	time the event was read
+ */
+static void device_event(struct strix_box *b, const struct strixdlx_event *ev, uint64_t received)
+{
+	struct strix_msg msg;
+	int m, pct, value = ev->volume;
+
+	box_inc(b, CNT_DEVICE_EVENTS);
+	box_trace(b, TRACE_DEVICE_EVENT, ev->output, ev->volume, ev->event);
+
+	//lock access so write thread does not override
+	pthread_mutex_lock(&lockWriteMutex);
+	if (ev->output >= 0)
+		b->box_output = ev->output;
+	m = mixer_of(b, b->box_output);
+	b->box_volume[output_of(b, m)] = ev->volume;
+	if (!b->shared_mixer && ev->event == STRIXDLX_EVENT_OUTPUT) {
+		//relay switch only
+		if (b->volume[m] >= 0 && b->volume[m] != ev->volume && box_send_volume(b, m, b->volume[m]) > 0)
+			value = b->volume[m];
+	} else {
+		//set new volume value, or the first step towards it
+		pct = ramp_to(&b->ramp[m], b->volume[m], ev->volume);
+		if (pct >= 0)
+			mixer_write(b, m, pct, received);
+	}
+	status_update(b);
+	//unlock
+	pthread_mutex_unlock(&lockWriteMutex);
+
+	//the clients know one box
+	if (b != primary_box)
+		return;
+
+	//tell the clients
+	memset(&msg, 0, sizeof(msg));
+	msg.output = ev->output < 0 ? 0 : ev->output;
+	msg.value = value;
+	if (ev->event == STRIXDLX_EVENT_OUTPUT) {
+		msg.type = STRIX_MSG_OUTPUT;
+	} else if (ev->event == STRIXDLX_EVENT_SONIC) {
+		msg.type = STRIX_MSG_BUTTON;
+		msg.flags = STRIX_BUTTON_SONIC;
+		server_publish(&msg);
+		msg.type = STRIX_MSG_VOLUME;
+		msg.flags = 0;
+	} else {
+		msg.type = STRIX_MSG_VOLUME;
+	}
+	server_publish(&msg);
+}
+
+/**
+ * \brief Read the pending events of a box and forward them
+ */
+static void box_read(struct strix_box *b)
+{
+	struct strixdlx_event events[EVENT_BATCH];
+	uint64_t received;
+	int i, n;
+
+	received = stats_now();
+	n = strixdlx_read_events(b->fd, events, EVENT_BATCH);
+	if (n < 0) {
+		box_inc(b, CNT_ERRORS);
+		box_close(b);
+		return;
+	}
+	for (i = 0; i < n; i++)
+		device_event(b, &events[i], received);
+}
+
+/**
+ * \brief Move the calling thread to the real-time class and a cpu if requested
+ * The knob -> mixer path then does not wait behind compilers or games. A
+ * failure (no CAP_SYS_NICE, RLIMIT_RTPRIO too low, cpu not available) is
+ * reported and the thread keeps running with its normal priority.
+ */
+static void realtime_setup(void)
+{
+	struct sched_param param;
+	cpu_set_t cpus;
+	int err;
+
+	if (rt_cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(rt_cpu, &cpus);
+		err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		if (err)
+			fprintf(stderr, "could not bind read thread to cpu %d: %s\n", rt_cpu, strerror(err));
+	}
+
+	if (rt_prio > 0) {
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = rt_prio;
+		err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (err)
+			fprintf(stderr, "could not set SCHED_FIFO priority %d: %s\n", rt_prio, strerror(err));
+		else
+			syslog(LOG_INFO, "read thread runs with SCHED_FIFO priority %d", rt_prio);
+	}
 }
 
+//poll slots of one box in the read thread: device and a ramp timer per element
+#define BOX_POLL_FDS	(1 + STRIX_OUTPUTS)
+
 /**
  * Thread to read the volume from the kernel module.
- * It polls the device and gets only a value when something changed
- * 
- * 
+ * It polls the devices of all boxes and gets only a value when something changed
+ *
+ * Beside the devices it listens to the uevents of udev, so a box can be
+ * unplugged, suspended or the module reloaded without restarting the daemon.
+ * While a box is missing it is also probed every REOPEN_INTERVAL_MS, in case
+ * an add event was lost. Nodes no box serves go to the discover thread, it
+ * answers when the box is set up.
  */
 void *readThread(void *vargp) {
 
-	char c;
-	int fd, i, n, value;
-	
-	char *dev = DEFAULT_DEVICE;
-	short revents;
-	struct pollfd pfd;
-	char buf[3];
+	int i, j, m, n, nfds, timeout, missing, count;
+	int ufd;
+	struct strix_box *b;
+	struct pollfd pfd[2 + STRIX_MAX_BOXES * BOX_POLL_FDS];
+	char ubuf[UEVENT_BUFFER_SIZE];
+	char node[BOX_NODE_SIZE];
+	char added;
 
-	//try to open device, if not possible exit thread
-	fd = open(dev, O_RDWR);
-	if (fd == -1) {
-		perror("open");
-		exit(1);
-	}
+	realtime_setup();
+
+	ufd = uevent_open();
+	if (ufd < 0)
+		perror("uevent socket");
 
-	pfd.fd = fd;
-	pfd.events = POLLIN;
+	//boxes of the discover thread are opened by it
+	count = __atomic_load_n(&box_count, __ATOMIC_ACQUIRE);
+	for (j = 0; j < count; j++)
+		if (boxes[j].fd < 0 && box_open(&boxes[j]) < 0)
+			fprintf(stderr, "%s not available, waiting for device\n", boxes[j].path);
 
 	//loop
 	while (1) {
 
-        i = poll(&pfd, 1, -1);
-        if (i == -1) {
-            perror("poll");
-            exit(EXIT_FAILURE);
-        }
-        revents = pfd.revents;
-
-		//wait for wakeup from kernel module
-        if (revents & POLLIN) {
-            n = read(pfd.fd, buf, sizeof(buf));
-			//lock access so write thread does not override
-			pthread_mutex_lock(&lockWriteMutex);
-            sscanf(buf, "%d", &value);
-			//set new volume value
-			snd_mixer_selem_set_playback_volume_all(elem, value * max / 100);
-			//reset buffer
-			memset(buf, 0, sizeof(buf));
-			//save volume to internal
-			volume = value*max /100;
-			//unlock
-			pthread_mutex_unlock(&lockWriteMutex);
-			
-        }
-    }
-	close(fd);
+		//the boxes of this round, later ones get slots in the next
+		count = __atomic_load_n(&box_count, __ATOMIC_ACQUIRE);
+		pfd[0].fd = ufd;
+		pfd[0].events = POLLIN;
+		pfd[0].revents = 0;
+		missing = 0;
+		for (j = 0; j < count; j++) {
+			b = &boxes[j];
+			//ignored by poll while the device is missing
+			pfd[1 + j * BOX_POLL_FDS].fd = b->fd;
+			for (m = 0; m < STRIX_OUTPUTS; m++)
+				pfd[2 + j * BOX_POLL_FDS + m].fd = b->ramp[m].fd;
+			for (i = 1 + j * BOX_POLL_FDS; i < 1 + (j + 1) * BOX_POLL_FDS; i++) {
+				pfd[i].events = POLLIN;
+				pfd[i].revents = 0;
+			}
+			if (b->fd < 0)
+				missing = 1;
+		}
+		nfds = 1 + count * BOX_POLL_FDS;
+		//answers of the discover thread, -1 without --discover
+		pfd[nfds].fd = discover_fd[0];
+		pfd[nfds].events = POLLIN;
+		pfd[nfds].revents = 0;
+		timeout = missing ? REOPEN_INTERVAL_MS : -1;
+
+		i = poll(pfd, nfds + 1, timeout);
+		if (i == -1) {
+			if (errno != EINTR)
+				perror("poll");
+			continue;
+		}
+
+		//a discovered box, it is polled from the next round on
+		if (pfd[nfds].revents & POLLIN)
+			while (recv(discover_fd[0], &added, sizeof(added), MSG_DONTWAIT) > 0)
+				;
+
+		//device added or removed
+		if (pfd[0].revents & POLLIN) {
+			n = recv(ufd, ubuf, sizeof(ubuf) - 1, MSG_DONTWAIT);
+			if (n > 0) {
+				ubuf[n] = '\0';
+				switch (uevent_parse(ubuf, n, node, sizeof(node))) {
+				case UEVENT_REMOVE:
+					for (j = 0; j < count; j++)
+						if (boxes[j].fd >= 0 && strcmp(boxes[j].node, node) == 0)
+							box_close(&boxes[j]);
+					break;
+				case UEVENT_ADD:
+					if (discover && send(discover_fd[0], node, strlen(node), MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+						perror("discover");
+					for (j = 0; j < count; j++)
+						if (boxes[j].fd < 0)
+							box_open(&boxes[j]);
+					break;
+				}
+			}
+		}
+
+		for (j = 0; j < count; j++) {
+			b = &boxes[j];
+
+			//next step of a volume ramp
+			for (m = 0; m < STRIX_OUTPUTS; m++)
+				if (pfd[2 + j * BOX_POLL_FDS + m].revents & POLLIN)
+					ramp_tick(b, m);
+
+			if (b->fd < 0) {
+				if (i == 0)
+					box_open(b);
+				continue;
+			}
+
+			n = pfd[1 + j * BOX_POLL_FDS].revents;
+			if (n & (POLLERR | POLLHUP | POLLNVAL))
+				box_close(b);
+			//wait for wakeup from kernel module
+			else if (n & POLLIN)
+				box_read(b);
+		}
+	}
+	if (ufd >= 0)
+		close(ufd);
+	for (j = 0; j < count; j++)
+		box_close(&boxes[j]);
+	return NULL;
 }
 
 /**
- * If volume changed externally by using other controls (keyboard, desktop UI, etc.)
- * we can send the new volume to the control box so the leds will be set correctly * 
- * 
+ * Thread adding the boxes of --discover
+ * Setting up a box opens its audio backend, which allocates and may load a
+ * whole mixer. That stays out of the real-time read thread: it sends the
+ * device nodes of add events here and is told about every finished box.
  */
-void *writeThread(void *vargs) {
+void *discoverThread(void *vargs) {
 
-	int i = 100;
-	long value = 0;
-	int retval = 0;
-	int send_buf;
+	char node[BOX_NODE_SIZE];
+	ssize_t n;
 
-	int fd;
-	char *dev = DEFAULT_DEVICE;
+	box_discover_all();
+	while (1) {
+		n = recv(discover_fd[1], node, sizeof(node) - 1, 0);
+		if (n < 0) {
+			if (errno != EINTR)
+				perror("discover");
+			continue;
+		}
+		node[n] = '\0';
+		box_discover(node);
+	}
+	return NULL;
+}
+
+/**
+ * \brief Tell the clients a new volume of the active output of the primary box
+ */
+static void publish_volume(int pct)
+{
+	struct strix_msg msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.type = STRIX_MSG_VOLUME;
+	msg.output = primary_box->box_output < 0 ? 0 : primary_box->box_output;
+	msg.value = pct;
+	server_publish(&msg);
+}
+
+/**
+ * \brief Current state of the primary box for a client of the socket service
+ */
+static void client_state(struct strix_msg *msg)
+{
+	struct strix_box *b = primary_box;
+	int m;
+
+	pthread_mutex_lock(&lockWriteMutex);
+	m = mixer_of(b, b->box_output);
+	msg->output = b->box_output < 0 ? 0 : b->box_output;
+	msg->value = b->volume[m] < 0 ? 0 : b->volume[m];
+	msg->flags = b->fd >= 0 ? STRIX_STATE_CONNECTED : 0;
+	pthread_mutex_unlock(&lockWriteMutex);
+}
+
+/**
+ * \brief Command of a client of the socket service, for the primary box
+ * A new volume goes to the mixer and the box, an output switch only to the
+ * box, the kernel module answers it with an output event like for the button.
+ */
+static void client_command(const struct strix_msg *msg)
+{
+	struct strix_box *b = primary_box;
+	__u8 cmd;
+	int m;
+
+	pthread_mutex_lock(&lockWriteMutex);
+	if (msg->type == STRIX_MSG_SET_VOLUME) {
+		m = mixer_of(b, b->box_output);
+		box_trace(b, TRACE_CLIENT_VOLUME, output_of(b, m), msg->value, 0);
+		ramp_stop(&b->ramp[m]);
+		if (b->backend.ops->set_volume(&b->backend, m, msg->value) < 0) {
+			box_inc(b, CNT_ERRORS);
+		} else {
+			box_inc(b, CNT_MIXER_WRITES);
+			box_trace(b, TRACE_MIXER_WRITE, m, msg->value, 0);
+			b->volume[m] = msg->value;
+		}
+		box_send_volume(b, m, msg->value);
+	} else {
+		box_trace(b, TRACE_CLIENT_OUTPUT, msg->output, 0, 0);
+		cmd = strixdlx_output_cmd(msg->output);
+		if (b->fd >= 0) {
+			if (strixdlx_send(b->fd, &cmd, 1) == 1) {
+				box_inc(b, CNT_BOX_WRITES);
+				box_trace(b, TRACE_BOX_WRITE, msg->output, cmd, 0);
+			} else {
+				box_inc(b, CNT_ERRORS);
+			}
+		}
+	}
+	status_update(b);
+	pthread_mutex_unlock(&lockWriteMutex);
+
+	if (msg->type == STRIX_MSG_SET_VOLUME)
+		publish_volume(msg->value);
+}
+
+static const struct strix_server_ops server_ops = {
+	.state = client_state,
+	.command = client_command,
+};
+
+/**
+ * \brief Current value of the monotonic clock in milliseconds
+ */
+static long long monotonic_ms(void)
+{
+	struct timespec ts;
 
-	//if device can not be opened we quit
-	printf("Open device %s\n", dev);
-	fd = open(dev, O_RDWR);
-	if (fd == -1) {
-		perror("open");
-		exit(1);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * \brief Look at a mixer element after a wakeup, send its volume when due
+ * Called with lockWriteMutex held.
+ * \param b		box the element belongs to
+ * \param m		mixer element
+ * \param notified	the backend reported a change
+ * \param now		monotonic_ms() of the wakeup
+ */
+static void mixer_sync(struct strix_box *b, int m, int notified, long long now)
+{
+	struct mixer_sync *s = &b->sync[m];
+	int value, send_buf;
+	uint64_t written;
+
+	if (b->backend.ops->get_volume(&b->backend, m, &value) < 0)
+		return;
+	//a notification does not tell the element, record the one it is for
+	if (notified && (value != b->volume[m] || m == mixer_of(b, b->box_output)))
+		box_trace(b, TRACE_MIXER_NOTIFY, m, value, 0);
+
+	if (value != b->volume[m]) {
+		//volume has changed, (re)arm the debounce, it wins over a ramp
+		ramp_stop(&b->ramp[m]);
+		b->volume[m] = value;
+		if (!s->pending) {
+			s->pending = 1;
+			s->pending_since = now;
+			s->noticed = stats_now();
+		} else {
+			box_inc(b, CNT_COALESCED);
+			box_trace(b, TRACE_COALESCED, m, value, 0);
+		}
+		s->deadline = now + debounce_ms;
+		if (min_interval_ms && s->deadline > s->pending_since + min_interval_ms)
+			s->deadline = s->pending_since + min_interval_ms;
+		if (s->deadline < s->last_send + min_interval_ms)
+			s->deadline = s->last_send + min_interval_ms;
+	} else if (notified && m == mixer_of(b, b->box_output)) {
+		//our own write of a knob turn
+		box_inc(b, CNT_ECHOES);
+		box_trace(b, TRACE_ECHO, m, value, 0);
 	}
 
+	if (s->pending && now >= s->deadline) {
+		s->pending = 0;
+		s->last_send = now;
+		send_buf = b->volume[m];
+		//the box may already show it (echo of a knob turn),
+		//a missing box gets the volume when it comes back
+		if (send_buf == b->box_volume[output_of(b, m)]) {
+			box_inc(b, CNT_ECHOES);
+			box_trace(b, TRACE_ECHO, m, send_buf, 0);
+		} else {
+			//send new volume to kernel module
+			written = stats_now();
+			if (box_send_volume(b, m, send_buf) > 0) {
+				stats_record(HIST_BOX_WRITE, stats_now() - written);
+				stats_record(HIST_MIXER_TO_BOX, stats_now() - s->noticed);
+				if (b == primary_box && m == mixer_of(b, b->box_output))
+					publish_volume(send_buf);
+			}
+		}
+	}
+}
+
+/**
+ * If volume changed externally by using other controls (keyboard, desktop UI, etc.)
+ * we can send the new volume to the control box so the leds will be set correctly
+ *
+ * The thread sleeps on the poll descriptors of the mixers of all boxes. A fading
+ * media player or a dragged slider can change the mixer hundreds of times per
+ * second, so the changes are not forwarded one by one: every change (re)arms a
+ * trailing-edge debounce of debounce_ms, and while the mixer keeps moving an
+ * update is still sent at least every min_interval_ms. Two updates are never
+ * closer than min_interval_ms. Intermediate values are dropped, the last one is
+ * always sent. Every mixer element of every box has its own debounce.
+ *
+ * A backend whose events fail, or whose descriptors report an error or hangup,
+ * would wake poll() again right away. Its descriptors are left out of the poll
+ * set for REOPEN_INTERVAL_MS and fetched anew afterwards.
+ */
+void *writeThread(void *vargs) {
+
+	int retval = 0;
+	int i, j, m, nfds = 0, timeout;
+	//slot 0 tells about added boxes, then the descriptors of every backend
+	struct pollfd pfds[1 + STRIX_MAX_BOXES * STRIX_BACKEND_MAX_FDS];
+	int first[STRIX_MAX_BOXES], count[STRIX_MAX_BOXES];
+	//while set, the descriptors of the box are not polled until this time
+	long long muted[STRIX_MAX_BOXES] = { 0 };
+	unsigned int generation = ~0u;
+	int polled = 0, failed;
+	struct strix_box *b;
+	long long now;
+	uint64_t added;
+
 	//loop
 	while(1) {
-		//block volume access
+		//a new box brings the poll descriptors of its mixer
 		pthread_mutex_lock(&lockWriteMutex);
-		if (snd_mixer_handle_events(handle) <0) {
-			goto next;
+		now = monotonic_ms();
+		for (j = 0; j < polled; j++) {
+			if (muted[j] && muted[j] <= now) {
+				muted[j] = 0;
+				generation = ~0u;
+			}
 		}
-		if (snd_mixer_selem_get_playback_volume(elem, 0, &value ) <0) {
-			goto next;
+		if (generation != box_generation) {
+			generation = box_generation;
+			pfds[0].fd = box_added_fd;
+			pfds[0].events = POLLIN;
+			nfds = 1;
+			for (j = 0; j < box_count; j++) {
+				b = &boxes[j];
+				first[j] = nfds;
+				count[j] = b->backend.ops->poll_descriptors(&b->backend, &pfds[nfds],
+									    STRIX_BACKEND_MAX_FDS);
+				if (count[j] < 0) {
+					fprintf(stderr, "could not get mixer poll descriptors of %s\n", b->path);
+					exit(EXIT_FAILURE);
+				}
+				if (muted[j])
+					for (m = first[j]; m < first[j] + count[j]; m++)
+						pfds[m].fd = -1;
+				nfds += count[j];
+			}
+			polled = box_count;
 		}
 
-		if (value != volume) {
-			//volume has changed so we set it			
-			volume = value;
-			value = value *100 / max;
-			send_buf = (int)value;
-			//send new volume to kernel module
-			retval = write(fd, &send_buf, 1);
-		if (retval < 0)
-			fprintf(stderr, "could not send command to fd=%d\n", fd);
+		//sleep until a mixer changes or a pending update is due
+		timeout = -1;
+		for (j = 0; j < polled; j++) {
+			b = &boxes[j];
+			if (muted[j]) {
+				i = muted[j] > now ? (int)(muted[j] - now) : 0;
+				if (timeout < 0 || i < timeout)
+					timeout = i;
+			}
+			for (m = 0; m < mixer_count(b); m++) {
+				if (!b->sync[m].pending)
+					continue;
+				i = b->sync[m].deadline > now ? (int)(b->sync[m].deadline - now) : 0;
+				if (timeout < 0 || i < timeout)
+					timeout = i;
+			}
+		}
+		pthread_mutex_unlock(&lockWriteMutex);
+
+		i = poll(pfds, nfds, timeout);
+		if (i < 0 && errno != EINTR) {
+			perror("poll");
+			exit(EXIT_FAILURE);
 		}
-next:
-		//unlock and sleep
+		if (i > 0 && (pfds[0].revents & POLLIN)
+		    && read(box_added_fd, &added, sizeof(added)) < 0)
+			perror("eventfd");
+
+		//block volume access
+		pthread_mutex_lock(&lockWriteMutex);
+		now = monotonic_ms();
+		for (j = 0; j < polled; j++) {
+			b = &boxes[j];
+			retval = 0;
+			failed = 0;
+			for (m = first[j]; i > 0 && m < first[j] + count[j]; m++) {
+				if (pfds[m].revents)
+					retval = 1;
+				if (pfds[m].revents & (POLLERR | POLLHUP | POLLNVAL))
+					failed = 1;
+			}
+			if (retval) {
+				retval = b->backend.ops->handle_events(&b->backend, &pfds[first[j]], count[j]);
+				if (retval < 0 || failed) {
+					box_inc(b, CNT_ERRORS);
+					fprintf(stderr, "%s backend of %s failed, not polled for %d ms\n",
+						b->backend.ops->name, b->path, REOPEN_INTERVAL_MS);
+					muted[j] = now + REOPEN_INTERVAL_MS;
+					for (m = first[j]; m < first[j] + count[j]; m++)
+						pfds[m].fd = -1;
+					continue;
+				}
+				if (retval > 0)
+					box_inc(b, CNT_MIXER_EVENTS);
+			}
+
+			for (m = 0; m < mixer_count(b); m++)
+				mixer_sync(b, m, retval > 0, now);
+			status_update(b);
+		}
+		//unlock
 		pthread_mutex_unlock(&lockWriteMutex);
-		sleep(1);
-		
 	}
-	close(fd);
+	return NULL;
+}
+
+/**
+ * \brief Print the counters of every box, the sums are in stats_dump()
+ */
+static void boxes_dump(FILE *out)
+{
+	struct strix_box *b;
+	int j, n;
+
+	n = __atomic_load_n(&box_count, __ATOMIC_ACQUIRE);
+	for (j = 0; j < n; j++) {
+		b = &boxes[j];
+		fprintf(out, "box %d %s (%s): events %llu, mixer writes %llu, box writes %llu, "
+			"coalesced %llu, echoes %llu, reconnects %llu, errors %llu\n",
+			j, b->path, b->fd >= 0 ? "connected" : "missing",
+			(unsigned long long)b->count[CNT_DEVICE_EVENTS],
+			(unsigned long long)b->count[CNT_MIXER_WRITES],
+			(unsigned long long)b->count[CNT_BOX_WRITES],
+			(unsigned long long)b->count[CNT_COALESCED],
+			(unsigned long long)b->count[CNT_ECHOES],
+			(unsigned long long)b->count[CNT_RECONNECTS],
+			(unsigned long long)b->count[CNT_ERRORS]);
+	}
+	fflush(out);
+}
+
+/**
+ * Thread printing the statistics on SIGUSR1
+ * SIGUSR1 is blocked in all threads, this one picks it up with sigwait().
+ */
+void *statsThread(void *vargs) {
+
+	sigset_t set;
+	int sig;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+
+	while (1) {
+		if (sigwait(&set, &sig) != 0 || sig != SIGUSR1)
+			continue;
+		stats_dump(log_stream);
+		boxes_dump(log_stream);
+	}
+	return NULL;
+}
+
+/**
+ * \brief Sleep until a time of the monotonic clock in nanoseconds
+ */
+static void sleep_until_ns(uint64_t ns)
+{
+	struct timespec ts = { ns / 1000000000ull, ns % 1000000000ull };
 
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+/**
+ * \brief Throw away the commands the daemon sent to the mock device
+ */
+static void replay_drain(void)
+{
+	char cmd;
+
+	while (recv(replay_peer, &cmd, sizeof(cmd), MSG_DONTWAIT) > 0)
+		;
+}
+
+/**
+ * \brief CPU time of a thread in nanoseconds
+ */
+static uint64_t thread_cpu_ns(pthread_t thread)
+{
+	struct timespec ts;
+	clockid_t clock;
+
+	if (pthread_getcpuclockid(thread, &clock) != 0 || clock_gettime(clock, &ts) != 0)
+		return 0;
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Thread feeding a recorded trace into the daemon
+ *
+ * Device events go through the mock device, mixer notifications into the
+ * null backend and client commands straight to client_command(). The inputs
+ * follow each other with the gaps of the recording, with replay_fast without
+ * any pause. At the end the pending updates are given time to go out, the
+ * actions of the recording and of the replay and the CPU time of the read and
+ * write thread per input are printed and the daemon exits.
+ */
+void *replayThread(void *vargs) {
+
+	FILE *f = vargs;
+	struct strix_trace_record rec;
+	struct strixdlx_event ev;
+	struct strix_msg msg;
+	char line[STRIXDLX_EVENT_LINE_SIZE];
+	uint64_t recorded[TRACE_TYPES] = {0};
+	uint64_t first = 0, start, duration, cpu_read, cpu_write, inputs = 0;
+	int n;
+
+	//events sent before the device is open would be discarded
+	while (__atomic_load_n(&primary_box->fd, __ATOMIC_RELAXED) < 0)
+		sleep_until_ns(stats_now() + 1000000);
+
+	cpu_read = thread_cpu_ns(thread_id_read);
+	cpu_write = thread_cpu_ns(thread_id_write);
+	start = stats_now();
+
+	while (trace_read(f, &rec) == 0) {
+		recorded[rec.type]++;
+		if (rec.type >= TRACE_INPUTS)
+			continue;
+
+		if (first == 0)
+			first = rec.ns;
+		if (!replay_fast)
+			sleep_until_ns(start + (rec.ns - first));
+		replay_drain();
+		inputs++;
+
+		switch (rec.type) {
+		case TRACE_DEVICE_EVENT:
+			ev.volume = rec.value;
+			ev.output = rec.output;
+			ev.event = rec.flags;
+			ev.seq = 0;
+			n = strixdlx_format_event(line, sizeof(line), &ev);
+			if (send(replay_peer, line, n, MSG_NOSIGNAL) < 0)
+				perror("replay");
+			break;
+		case TRACE_MIXER_NOTIFY:
+			strix_backend_null_inject(&primary_box->backend, rec.output, rec.value);
+			break;
+		case TRACE_CLIENT_VOLUME:
+		case TRACE_CLIENT_OUTPUT:
+			memset(&msg, 0, sizeof(msg));
+			msg.type = rec.type == TRACE_CLIENT_VOLUME ? STRIX_MSG_SET_VOLUME : STRIX_MSG_SET_OUTPUT;
+			msg.output = rec.output;
+			msg.value = rec.value;
+			client_command(&msg);
+			break;
+		}
+	}
+	fclose(f);
+	duration = stats_now() - start;
+
+	//the last mixer change may still wait for the debounce
+	sleep_until_ns(stats_now() + (debounce_ms + min_interval_ms + REPLAY_SETTLE_MS) * 1000000ull);
+	replay_drain();
+	cpu_read = thread_cpu_ns(thread_id_read) - cpu_read;
+	cpu_write = thread_cpu_ns(thread_id_write) - cpu_write;
+
+	fprintf(log_stream, "replay of %s: %llu inputs in %.1f ms (%s)\n", replay_path,
+		(unsigned long long)inputs, duration / 1e6, replay_fast ? "fast" : "recorded timing");
+	fprintf(log_stream, "  %-18s %10s %10s\n", "", "recorded", "replayed");
+	fprintf(log_stream, "  %-18s %10llu %10llu\n", "device events",
+		(unsigned long long)recorded[TRACE_DEVICE_EVENT],
+		(unsigned long long)stats_counter(CNT_DEVICE_EVENTS));
+	fprintf(log_stream, "  %-18s %10llu %10llu\n", "mixer notify",
+		(unsigned long long)recorded[TRACE_MIXER_NOTIFY],
+		(unsigned long long)stats_counter(CNT_MIXER_EVENTS));
+	fprintf(log_stream, "  %-18s %10llu %10llu\n", "mixer writes",
+		(unsigned long long)recorded[TRACE_MIXER_WRITE],
+		(unsigned long long)stats_counter(CNT_MIXER_WRITES));
+	fprintf(log_stream, "  %-18s %10llu %10llu\n", "box writes",
+		(unsigned long long)recorded[TRACE_BOX_WRITE],
+		(unsigned long long)stats_counter(CNT_BOX_WRITES));
+	fprintf(log_stream, "  %-18s %10llu %10llu\n", "coalesced",
+		(unsigned long long)recorded[TRACE_COALESCED],
+		(unsigned long long)stats_counter(CNT_COALESCED));
+	fprintf(log_stream, "  %-18s %10llu %10llu\n", "echoes",
+		(unsigned long long)recorded[TRACE_ECHO],
+		(unsigned long long)stats_counter(CNT_ECHOES));
+	if (inputs)
+		fprintf(log_stream, "  cpu per input: read thread %.2f us, write thread %.2f us\n",
+			cpu_read / 1e3 / inputs, cpu_write / 1e3 / inputs);
+	stats_dump(log_stream);
+
+	trace_close();
+	exit(EXIT_SUCCESS);
+	return NULL;
+}
+
+/**
+ * \brief Output of the command line, a name or 0/1
+ * \return 0 = speaker, 1 = headphone, -1 if unknown
+ */
+static int cli_parse_output(const char *arg)
+{
+	int i;
+
+	for (i = 0; i < STRIX_OUTPUTS; i++)
+		if (strcmp(arg, cli_output_names[i]) == 0)
+			return i;
+	if (strcmp(arg, "0") == 0 || strcmp(arg, "1") == 0)
+		return arg[0] - '0';
+	return -1;
+}
+
+static void cli_print_event(const struct strixdlx_event *ev, int with_event)
+{
+	const char *output = ev->output >= 0 && ev->output < STRIX_OUTPUTS
+			     ? cli_output_names[ev->output] : "unknown";
+
+	if (with_event && ev->event >= 0 && ev->event < (int)(sizeof(cli_event_names) / sizeof(cli_event_names[0])))
+		printf("%s %d %s\n", output, ev->volume, cli_event_names[ev->event]);
+	else
+		printf("%s %d\n", output, ev->volume);
+	fflush(stdout);
+}
+
+/**
+ * \brief --get: print the active output and its volume
+ * A file opened now gets the last event of the module with its first read,
+ * that is the current state.
+ */
+static int cli_get(int fd)
+{
+	struct strixdlx_event events[EVENT_BATCH];
+	int n;
+
+	n = strixdlx_read_events(fd, events, EVENT_BATCH);
+	if (n < 0) {
+		fprintf(stderr, "could not read %s: %s\n", device_path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	if (n == 0) {
+		fprintf(stderr, "state of the control box not known yet\n");
+		return EXIT_FAILURE;
+	}
+	cli_print_event(&events[n - 1], 0);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * \brief --set/--output: switch the relay and/or set the volume
+ * The switch goes first, so the volume is the one of the new output. Both
+ * are sent with one strixdlx_send().
+ */
+static int cli_set(int fd)
+{
+	__u8 cmds[2];
+	int count = 0;
+
+	if (cli_output >= 0)
+		cmds[count++] = strixdlx_output_cmd(cli_output);
+	if (cli_volume >= 0)
+		cmds[count++] = strixdlx_volume_cmd(cli_volume);
+	if (strixdlx_send(fd, cmds, count) != count) {
+		fprintf(stderr, "could not write %s: %s\n", device_path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+ * \brief --watch: print the current state and then every event
+ * Runs until it is interrupted or the control box goes away.
+ */
+static int cli_watch(int fd)
+{
+	struct strixdlx_event events[EVENT_BATCH];
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	int i, n;
+
+	while (1) {
+		n = strixdlx_read_events(fd, events, EVENT_BATCH);
+		if (n < 0) {
+			fprintf(stderr, "could not read %s: %s\n", device_path, strerror(errno));
+			return EXIT_FAILURE;
+		}
+		for (i = 0; i < n; i++)
+			cli_print_event(&events[i], 1);
+
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+			return EXIT_FAILURE;
+		if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+			fprintf(stderr, "%s has gone\n", device_path);
+			return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+ * \brief Run a one-shot mode: one open of the device, one read or write
+ * No daemon, no threads, no audio backend; a script pays for the open only.
+ */
+static int cli_run(void)
+{
+	int fd, ret = EXIT_FAILURE;
+
+	fd = strixdlx_device_open(device_path);
+	if (fd < 0) {
+		fprintf(stderr, "could not open %s: %s\n", device_path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	switch (cli_mode) {
+	case CLI_GET:
+		ret = cli_get(fd);
+		break;
+	case CLI_SET:
+		ret = cli_set(fd);
+		break;
+	case CLI_WATCH:
+		ret = cli_watch(fd);
+		break;
+	}
+
+	strixdlx_device_close(fd);
+	return ret;
+}
+
+/**
+ * \brief Print help for this application
+ */
+static void print_help(void)
+{
+	printf("\n Usage: %s [OPTIONS]\n\n", app_name);
+	printf("  Options:\n");
+	printf("   -h --help                 Print this help\n");
+	printf("   -d --daemon               Fork into the background (not needed under systemd)\n");
+	printf("   -i --pid-file file        Write the pid of the daemon to file, with --daemon\n");
+	printf("   -D --device path          Control box device (default %s)\n", STRIXDLX_DEFAULT_DEVICE);
+	printf("   -B --backend name         Audio backend: %s (default %s)\n",
+	       strix_backend_names(), strix_backend_find(NULL)->name);
+	printf("   -c --card name            Card (alsa) or remote (pipewire) to use\n");
+	printf("   -e --element name         Mixer element (alsa) or sink node.name (pipewire)\n");
+	printf("   -s --speaker name         Element or sink of the speaker output only\n");
+	printf("   -H --headphone name       Element or sink of the headphone output only\n");
+	printf("   -X --box spec             Serve a box: path[,card=][,element=][,speaker=][,headphone=][,backend=],\n");
+	printf("                             repeat for every box, unset parts come from the options above\n");
+	printf("   -A --discover             Also serve every other /dev/strixdlxN with the options above\n");
+	printf("   -S --socket path          Client socket (default %s)\n", server_default_path());
+	printf("   -n --no-socket            Do not offer the client socket\n");
+	printf("   -U --status name          Shared memory object with the status (default %s)\n", STRIX_STATUS_NAME);
+	printf("   -u --no-status            Do not publish the status\n");
+	printf("   -b --debounce ms          Quiet time before a mixer change is sent to the box (default %d)\n",
+	       DEFAULT_DEBOUNCE_MS);
+	printf("   -r --max-rate hz          Maximum led updates per second sent to the box (default %d)\n",
+	       1000 / DEFAULT_MIN_INTERVAL_MS);
+	printf("   -R --ramp ms              Duration of a volume ramp over the full range, 0 = jump (default %d)\n",
+	       DEFAULT_RAMP_MS);
+	printf("   -K --ramp-curve name      Ramp curve: linear|smooth (default smooth)\n");
+	printf("   -W --ramp-steps count     Mixer writes per ramp at most (default %d)\n", DEFAULT_RAMP_STEPS);
+	printf("   -p --rt-prio priority     Run the read thread with SCHED_FIFO at this priority (1-99)\n");
+	printf("   -C --cpu number           Bind the read thread to a cpu\n");
+	printf("   -L --mlock                Lock all memory, no page faults on the event path\n");
+	printf("   -T --trace file           Record events and actions into a binary trace\n");
+	printf("   -P --replay file          Replay a trace with a mock device and the null backend, then exit\n");
+	printf("   -F --fast                 Replay without the pauses of the recording\n");
+	printf("\n  One-shot modes, without starting the daemon:\n");
+	printf("   -g --get                  Print the active output and its volume\n");
+	printf("   -V --set percent          Set the volume of the active output\n");
+	printf("   -o --output name          Switch to speaker|headphone, before --set\n");
+	printf("   -w --watch                Print every event of the control box\n");
+	printf("\n");
 }
 
 /* Main function */
 int main(int argc, char *argv[])
 {
-	int err = 0;
+	static struct option long_options[] = {
+		{"daemon", no_argument, 0, 'd'},
+		{"pid-file", required_argument, 0, 'i'},
+		{"device", required_argument, 0, 'D'},
+		{"backend", required_argument, 0, 'B'},
+		{"card", required_argument, 0, 'c'},
+		{"element", required_argument, 0, 'e'},
+		{"speaker", required_argument, 0, 's'},
+		{"headphone", required_argument, 0, 'H'},
+		{"socket", required_argument, 0, 'S'},
+		{"no-socket", no_argument, 0, 'n'},
+		{"status", required_argument, 0, 'U'},
+		{"no-status", no_argument, 0, 'u'},
+		{"debounce", required_argument, 0, 'b'},
+		{"max-rate", required_argument, 0, 'r'},
+		{"ramp", required_argument, 0, 'R'},
+		{"ramp-curve", required_argument, 0, 'K'},
+		{"ramp-steps", required_argument, 0, 'W'},
+		{"rt-prio", required_argument, 0, 'p'},
+		{"cpu", required_argument, 0, 'C'},
+		{"mlock", no_argument, 0, 'L'},
+		{"trace", required_argument, 0, 'T'},
+		{"replay", required_argument, 0, 'P'},
+		{"fast", no_argument, 0, 'F'},
+		{"box", required_argument, 0, 'X'},
+		{"discover", no_argument, 0, 'A'},
+		{"get", no_argument, 0, 'g'},
+		{"set", required_argument, 0, 'V'},
+		{"output", required_argument, 0, 'o'},
+		{"watch", no_argument, 0, 'w'},
+		{"help", no_argument, 0, 'h'},
+		{NULL, 0, 0, 0}
+	};
+	int value, option_index = 0;
+	int sv[2];
+	FILE *replay_file = NULL;
+	pthread_mutexattr_t mutex_attr;
+	pthread_attr_t thread_attr;
+	sigset_t sigusr1, signals;
+	uint64_t start_ns = stats_now();
+	char ready[64], state[96];
+	int fd;
+
+	app_name = argv[0];
+
+	/* Try to process all command line arguments */
+	while ((value = getopt_long(argc, argv, "di:D:B:c:e:s:H:S:nU:ub:r:R:K:W:p:C:LT:P:FX:AgV:o:wh", long_options, &option_index)) != -1) {
+		switch (value) {
+			case 'd':
+				daemon_mode = 1;
+				break;
+			case 'i':
+				free(pid_file_name);
+				pid_file_name = strdup(optarg);
+				break;
+			case 'D':
+				device_path = optarg;
+				break;
+			case 'B':
+				backend_name = optarg;
+				break;
+			case 'c':
+				backend_defaults.card = optarg;
+				break;
+			case 'e':
+				backend_defaults.element[STRIX_OUTPUT_SPEAKER] = optarg;
+				backend_defaults.element[STRIX_OUTPUT_HEADPHONE] = optarg;
+				break;
+			case 's':
+				backend_defaults.element[STRIX_OUTPUT_SPEAKER] = optarg;
+				break;
+			case 'H':
+				backend_defaults.element[STRIX_OUTPUT_HEADPHONE] = optarg;
+				break;
+			case 'S':
+				socket_path = optarg;
+				break;
+			case 'n':
+				socket_enabled = 0;
+				break;
+			case 'U':
+				status_name = optarg;
+				break;
+			case 'u':
+				status_enabled = 0;
+				break;
+			case 'b':
+				debounce_ms = atoi(optarg);
+				if (debounce_ms < 0)
+					debounce_ms = 0;
+				break;
+			case 'r':
+				value = atoi(optarg);
+				min_interval_ms = value > 0 ? 1000 / value : 0;
+				break;
+			case 'R':
+				ramp_ms = atoi(optarg);
+				if (ramp_ms < 0)
+					ramp_ms = 0;
+				break;
+			case 'K':
+				ramp_curve = ramp_parse_curve(optarg);
+				if (ramp_curve < 0) {
+					fprintf(stderr, "unknown ramp curve %s\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'W':
+				ramp_steps = atoi(optarg);
+				if (ramp_steps < 1)
+					ramp_steps = 1;
+				break;
+			case 'p':
+				rt_prio = atoi(optarg);
+				if (rt_prio < 0 || rt_prio > sched_get_priority_max(SCHED_FIFO)) {
+					fprintf(stderr, "priority must be between 1 and %d\n",
+						sched_get_priority_max(SCHED_FIFO));
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'C':
+				rt_cpu = atoi(optarg);
+				if (rt_cpu < 0 || rt_cpu >= CPU_SETSIZE) {
+					fprintf(stderr, "invalid cpu %s\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'L':
+				lock_memory = 1;
+				break;
+			case 'T':
+				trace_path = optarg;
+				break;
+			case 'P':
+				replay_path = optarg;
+				break;
+			case 'F':
+				replay_fast = 1;
+				break;
+			case 'X':
+				if (box_parse(optarg) < 0)
+					return EXIT_FAILURE;
+				break;
+			case 'A':
+				discover = 1;
+				break;
+			case 'g':
+				cli_mode = CLI_GET;
+				break;
+			case 'V':
+				cli_volume = atoi(optarg);
+				if (cli_volume < 0 || cli_volume > 100) {
+					fprintf(stderr, "volume must be between 0 and 100\n");
+					return EXIT_FAILURE;
+				}
+				cli_mode = CLI_SET;
+				break;
+			case 'o':
+				cli_output = cli_parse_output(optarg);
+				if (cli_output < 0) {
+					fprintf(stderr, "unknown output %s\n", optarg);
+					return EXIT_FAILURE;
+				}
+				if (cli_mode == CLI_NONE)
+					cli_mode = CLI_SET;
+				break;
+			case 'w':
+				cli_mode = CLI_WATCH;
+				break;
+			case 'h':
+				print_help();
+				return EXIT_SUCCESS;
+			case '?':
+				print_help();
+				return EXIT_FAILURE;
+			default:
+				break;
+		}
+	}
+
+	if (cli_mode != CLI_NONE)
+		return cli_run();
+
+	if (daemon_mode)
+		daemonize();
 
     /* Open system log and write message to it */
 	openlog(argv[0], LOG_PID|LOG_CONS, LOG_DAEMON);
 	syslog(LOG_INFO, "Started %s", app_name);
 
-	/* Daemon will handle two signals */
-	signal(SIGINT, handle_signal);
-	signal(SIGHUP, handle_signal);
+	/* Daemon will handle three signals, the threads inherit them blocked */
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
 
     log_stream = stdout;
 
-	//initalize mutex
-    pthread_mutex_init(&lockWriteMutex,0);
+	//initalize mutex, priority inheritance so a real-time read thread
+	//is not held up by the write thread holding it
+	pthread_mutexattr_init(&mutex_attr);
+	pthread_mutexattr_setprotocol(&mutex_attr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(&lockWriteMutex, &mutex_attr);
+	pthread_mutexattr_destroy(&mutex_attr);
 
-	err = snd_mixer_open(&handle, 0);
-	if (err < 0) {
-		return err;
+	//a replay runs against a mock device and the null backend, without clients
+	if (replay_path != NULL) {
+		replay_file = trace_read_open(replay_path);
+		if (replay_file == NULL) {
+			perror(replay_path);
+			return EXIT_FAILURE;
+		}
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+			perror("socketpair");
+			return EXIT_FAILURE;
+		}
+		//the daemon side does not block, like the device
+		fcntl(sv[0], F_SETFL, O_NONBLOCK);
+		replay_fd = sv[0];
+		replay_peer = sv[1];
+		device_path = replay_path;
+		backend_name = "null";
+		socket_enabled = 0;
+		status_enabled = 0;
+		//the mock device stands for one box only
+		for (value = 0; value < box_count; value++)
+			free(boxes[value].spec);
+		box_count = 0;
+		discover = 0;
 	}
-    err = snd_mixer_attach(handle, card);
-    if (err < 0) {
-		return err;
+
+	//without --box the daemon serves the box of --device
+	if (box_count == 0) {
+		memset(primary_box, 0, sizeof(*primary_box));
+		primary_box->path = device_path;
+		box_count = 1;
 	}
-	err = snd_mixer_selem_register(handle, NULL, NULL);
-	if (err < 0) {
-		return err;
+	box_added_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (box_added_fd < 0) {
+		perror("eventfd");
+		return EXIT_FAILURE;
 	}
-	err = snd_mixer_load(handle);
-	if (err < 0) {
-		return err;
+	if (discover && socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, discover_fd) < 0) {
+		perror("socketpair");
+		return EXIT_FAILURE;
 	}
-    snd_mixer_selem_id_alloca(&sid);
-	snd_mixer_selem_id_set_index(sid, 0);
-	snd_mixer_selem_id_set_name(sid, selem_name);
+	for (value = 0; value < box_count; value++)
+		if (box_setup(&boxes[value]) < 0)
+			return EXIT_FAILURE;
 
-    elem = snd_mixer_find_selem(handle, sid);
-	err = snd_mixer_selem_get_playback_volume_range(elem, &min, &max);
-	if (err < 0) {
-		return err;
+	if (trace_path != NULL && trace_open(trace_path) < 0) {
+		perror(trace_path);
+		return EXIT_FAILURE;
+	}
+
+	//socket activation hands over the listening socket
+	fd = systemd_listen_fd();
+	if (socket_enabled && fd >= 0) {
+		if (server_adopt(fd, &server_ops) < 0) {
+			fprintf(stderr, "could not use the activated socket\n");
+			socket_enabled = 0;
+		}
+	} else if (socket_enabled) {
+		if (socket_path == NULL)
+			socket_path = server_default_path();
+		if (server_open(socket_path, &server_ops) < 0) {
+			fprintf(stderr, "could not create socket %s\n", socket_path);
+			socket_enabled = 0;
+		}
+	}
+
+	if (status_enabled && status_open(status_name) < 0) {
+		fprintf(stderr, "could not create status %s: %s\n", status_name, strerror(errno));
+		status_enabled = 0;
+	}
+
+	//statistics are printed on SIGUSR1, threads inherit the blocked signal
+	sigemptyset(&sigusr1);
+	sigaddset(&sigusr1, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &sigusr1, NULL);
+
+	//lock everything mapped now and later, the thread stacks are kept small
+	pthread_attr_init(&thread_attr);
+	if (lock_memory) {
+		pthread_attr_setstacksize(&thread_attr, LOCKED_STACK_SIZE);
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+			perror("mlockall");
 	}
 
 	// everything ok, create threads
-	pthread_create(&thread_id_read, NULL, readThread, NULL);
-	pthread_create(&thread_id_write, NULL, writeThread, NULL);
-	
-	pthread_join(thread_id_read, NULL);
-	pthread_join(thread_id_write, NULL);
-		
-	snd_mixer_close(handle);
+	pthread_create(&thread_id_read, &thread_attr, readThread, NULL);
+	pthread_create(&thread_id_write, &thread_attr, writeThread, NULL);
+	pthread_create(&thread_id_stats, &thread_attr, statsThread, NULL);
+	if (socket_enabled)
+		pthread_create(&thread_id_server, &thread_attr, serverThread, NULL);
+	if (replay_file != NULL)
+		pthread_create(&thread_id_replay, &thread_attr, replayThread, replay_file);
+	if (discover)
+		pthread_create(&thread_id_discover, &thread_attr, discoverThread, NULL);
+	pthread_attr_destroy(&thread_attr);
+
+	//mixer and socket are up, the read thread opens the box on its own
+	snprintf(ready, sizeof(ready), "ready after %.2f ms", (stats_now() - start_ns) / 1e6);
+	syslog(LOG_INFO, "%s", ready);
+	snprintf(state, sizeof(state), "READY=1\nSTATUS=%s", ready);
+	systemd_notify(state);
+
+	//the read and write thread run until the process exits
+	wait_signals(&signals);
+	daemon_stop();
 
    	syslog(LOG_INFO, "Stopped %s", app_name);
 	closelog();
@@ -0,0 +1,620 @@
+/*
+ * End-to-end latency benchmark for strixdlx.ko and the strix-daemon
+ *
+ * Drives the emulated control box (strix-emu) and the mixer of the snd-dummy
+ * card and measures both paths through driver and daemon:
+ *
+ *   knob -> mixer	knob report sent by the emulator until the mixer changed
+ *   button -> relay	switch report sent until the relay request arrived
+ *   mixer -> box	mixer written until the led request arrived
+ *
+ * The emulator logs every report and request with a CLOCK_MONOTONIC
+ * timestamp, the benchmark takes its own timestamps from the same clock, so
+ * all latencies are measured between two points on one machine.
+ *
+ * For every scenario the throughput, the latency percentiles, the USB
+ * transfers (reports and control requests) per gesture and the CPU time of
+ * the daemon per gesture are printed. strix-e2e.sh sets up the modules, the
+ * emulator and the daemon and runs the benchmark.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "strix-backend.h"
+#include "strix-stats.h"
+
+#define E2E_LINE_SIZE		256
+#define E2E_RING		256	/* timestamps of the last knob reports */
+#define E2E_TIMEOUT_MS		1000
+#define E2E_SETTLE_MS		300
+#define E2E_KNOB_STEP		3	/* volume change per knob step of the driver */
+
+/*
+ * what the emulator reported, updated by the log reader thread
+ */
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	uint64_t reports;		/* reports picked up by the host */
+	uint64_t actions;		/* of them 05 xx 00 01 action reports */
+	uint64_t relays;		/* relay requests */
+	uint64_t leds;			/* led requests */
+	uint64_t others;		/* other control requests */
+	uint64_t action_ns[E2E_RING];
+	uint64_t relay_ns;
+	uint64_t led_ns;
+} emu;
+
+static int emu_fd = -1;
+static struct strix_backend backend;
+static int mixer_volume = -1;
+static pid_t daemon_pid;
+
+struct result {
+	const char *name;
+	unsigned int gestures;
+	unsigned int timeouts;
+	uint64_t duration_ns;
+	uint64_t usb;
+	double cpu_us;
+	struct strix_histogram hist;
+};
+
+/*
+ * ******	emulator	******
+ */
+
+static int emu_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void emu_command(const char *cmd)
+{
+	char line[E2E_LINE_SIZE];
+	int n;
+
+	n = snprintf(line, sizeof(line), "%s\n", cmd);
+	if (send(emu_fd, line, n, MSG_NOSIGNAL) != n) {
+		perror("emulator");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * \brief Account one log line of the emulator
+ */
+static void emu_parse(const char *line)
+{
+	unsigned long long ts;
+	unsigned int b[4];
+	char what[16];
+	int n;
+
+	if (sscanf(line, "%llu %15s %n", &ts, what, &n) != 2)
+		return;
+	line += n;
+
+	pthread_mutex_lock(&emu.mutex);
+	if (strcmp(what, "tx") == 0) {
+		emu.reports++;
+		if (sscanf(line, "report %x %x %x %x", &b[0], &b[1], &b[2], &b[3]) == 4
+		    && b[0] == 0x05 && b[3] == 0x01)
+			emu.action_ns[emu.actions++ % E2E_RING] = ts;
+	} else if (strncmp(line, "relay", 5) == 0) {
+		emu.relays++;
+		emu.relay_ns = ts;
+	} else if (strncmp(line, "led", 3) == 0) {
+		emu.leds++;
+		emu.led_ns = ts;
+	} else if (strncmp(line, "ctrl", 4) == 0) {
+		emu.others++;
+	}
+	pthread_cond_broadcast(&emu.cond);
+	pthread_mutex_unlock(&emu.mutex);
+}
+
+/**
+ * Thread reading the log of the emulator
+ */
+static void *emuThread(void *vargs)
+{
+	char buf[E2E_LINE_SIZE * 4];
+	size_t fill = 0;
+	char *line, *nl;
+	ssize_t n;
+
+	while ((n = recv(emu_fd, buf + fill, sizeof(buf) - fill - 1, 0)) > 0) {
+		fill += n;
+		buf[fill] = '\0';
+		line = buf;
+		while ((nl = strchr(line, '\n')) != NULL) {
+			*nl = '\0';
+			emu_parse(line);
+			line = nl + 1;
+		}
+		fill -= line - buf;
+		memmove(buf, line, fill);
+		if (fill == sizeof(buf) - 1)
+			fill = 0;
+	}
+	fprintf(stderr, "emulator closed the control socket\n");
+	exit(EXIT_FAILURE);
+	return NULL;
+}
+
+static uint64_t emu_usb(void)
+{
+	uint64_t usb;
+
+	pthread_mutex_lock(&emu.mutex);
+	usb = emu.reports + emu.relays + emu.leds + emu.others;
+	pthread_mutex_unlock(&emu.mutex);
+	return usb;
+}
+
+/**
+ * \brief Wait until an emulator counter has passed a value
+ * \return 0 on success, -1 on timeout
+ */
+static int emu_wait(const uint64_t *counter, uint64_t old, int timeout_ms)
+{
+	struct timespec deadline;
+	int ret = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&emu.mutex);
+	while (*counter <= old && ret == 0)
+		ret = pthread_cond_timedwait(&emu.cond, &emu.mutex, &deadline);
+	pthread_mutex_unlock(&emu.mutex);
+	return *counter > old ? 0 : -1;
+}
+
+/**
+ * \brief Wait until the emulator saw no led request for settle_ms
+ */
+static void emu_settle(int settle_ms)
+{
+	uint64_t leds;
+
+	do {
+		leds = __atomic_load_n(&emu.leds, __ATOMIC_ACQUIRE);
+	} while (emu_wait(&emu.leds, leds, settle_ms) == 0);
+}
+
+/*
+ * ******	mixer	******
+ */
+
+/**
+ * \brief Wait for a change of the mixer volume
+ * \return 0 and the time the change was seen, -1 on timeout
+ */
+static int mixer_wait(int timeout_ms, uint64_t *ts)
+{
+	struct pollfd pfds[STRIX_BACKEND_MAX_FDS];
+	int nfds, pct;
+
+	while (1) {
+		nfds = backend.ops->poll_descriptors(&backend, pfds, STRIX_BACKEND_MAX_FDS);
+		if (poll(pfds, nfds, timeout_ms) <= 0)
+			return -1;
+		*ts = stats_now();
+		if (backend.ops->handle_events(&backend, pfds, nfds) <= 0)
+			continue;
+		if (backend.ops->get_volume(&backend, STRIX_OUTPUT_SPEAKER, &pct) < 0)
+			continue;
+		if (pct != mixer_volume) {
+			mixer_volume = pct;
+			return 0;
+		}
+	}
+}
+
+static void mixer_drain(void)
+{
+	uint64_t ts;
+
+	while (mixer_wait(0, &ts) == 0)
+		;
+}
+
+/**
+ * \brief Set the mixer and wait until driver and daemon are idle again
+ */
+static void mixer_preset(int pct)
+{
+	backend.ops->set_volume(&backend, STRIX_OUTPUT_SPEAKER, pct);
+	emu_settle(E2E_SETTLE_MS);
+	mixer_drain();
+	backend.ops->get_volume(&backend, STRIX_OUTPUT_SPEAKER, &mixer_volume);
+}
+
+/*
+ * ******	measurements	******
+ */
+
+/**
+ * \brief CPU time (user + system) of the daemon in microseconds
+ */
+static double daemon_cpu_us(void)
+{
+	char path[64], buf[1024], *p;
+	unsigned long utime, stime;
+	FILE *f;
+	size_t n;
+
+	if (daemon_pid <= 0)
+		return 0;
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)daemon_pid);
+	f = fopen(path, "r");
+	if (f == NULL)
+		return 0;
+	n = fread(buf, 1, sizeof(buf) - 1, f);
+	fclose(f);
+	buf[n] = '\0';
+
+	//the command may contain spaces, fields are counted after it
+	p = strrchr(buf, ')');
+	if (p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+				&utime, &stime) != 2)
+		return 0;
+	return (utime + stime) * 1e6 / sysconf(_SC_CLK_TCK);
+}
+
+static pid_t find_daemon(void)
+{
+	char path[300], comm[32];
+	struct dirent *d;
+	pid_t pid = 0;
+	DIR *dir;
+	FILE *f;
+
+	dir = opendir("/proc");
+	if (dir == NULL)
+		return 0;
+	while (pid == 0 && (d = readdir(dir)) != NULL) {
+		if (d->d_name[0] < '0' || d->d_name[0] > '9')
+			continue;
+		snprintf(path, sizeof(path), "/proc/%s/comm", d->d_name);
+		f = fopen(path, "r");
+		if (f == NULL)
+			continue;
+		if (fgets(comm, sizeof(comm), f) && strcmp(comm, "strix-daemon\n") == 0)
+			pid = atoi(d->d_name);
+		fclose(f);
+	}
+	closedir(dir);
+	return pid;
+}
+
+static void result_begin(struct result *r, const char *name, uint64_t *start)
+{
+	memset(r, 0, sizeof(*r));
+	r->name = name;
+	r->usb = emu_usb();
+	r->cpu_us = daemon_cpu_us();
+	*start = stats_now();
+}
+
+static void result_end(struct result *r, uint64_t start, uint64_t end)
+{
+	r->duration_ns = end > start ? end - start : 0;
+	r->usb = emu_usb() - r->usb;
+	r->cpu_us = daemon_cpu_us() - r->cpu_us;
+}
+
+static void sleep_ms(int ms)
+{
+	struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
+}
+
+/*
+ * ******	scenarios	******
+ */
+
+/**
+ * \brief Turn the knob step by step, one step after the mixer followed the last one
+ */
+static void knob_steps(struct result *r, const char *name, int steps, int gap_ms)
+{
+	uint64_t start, actions, ts = 0;
+	int i;
+
+	mixer_preset(50 - steps * E2E_KNOB_STEP / 2);
+	result_begin(r, name, &start);
+
+	for (i = 0; i < 2 * steps; i++) {
+		actions = emu.actions;
+		emu_command(i < steps ? "up" : "down");
+		r->gestures++;
+		if (mixer_wait(E2E_TIMEOUT_MS, &ts) < 0 || emu_wait(&emu.actions, actions, E2E_TIMEOUT_MS) < 0) {
+			r->timeouts++;
+			continue;
+		}
+		stats_hist_record(&r->hist, ts - emu.action_ns[actions % E2E_RING]);
+		if (gap_ms)
+			sleep_ms(gap_ms);
+	}
+	result_end(r, start, ts);
+}
+
+/**
+ * \brief Spin the knob as fast as the emulator can send
+ * Every mixer value belongs to one step, so the latency of all steps seen
+ * by the daemon is known even if it skipped some.
+ */
+static void knob_spin(struct result *r, int steps)
+{
+	char cmd[32];
+	uint64_t start, first, ts, last = 0;
+	int base = 5, step;
+
+	mixer_preset(base);
+	result_begin(r, "knob spin", &start);
+
+	first = emu.actions;
+	snprintf(cmd, sizeof(cmd), "spin %d up 0", steps);
+	emu_command(cmd);
+	r->gestures = steps;
+
+	while (mixer_wait(E2E_SETTLE_MS, &ts) == 0) {
+		last = ts;
+		step = (mixer_volume - base + E2E_KNOB_STEP / 2) / E2E_KNOB_STEP - 1;
+		if (step < 0 || step >= steps || emu_wait(&emu.actions, first + step, E2E_TIMEOUT_MS) < 0)
+			continue;
+		stats_hist_record(&r->hist, ts - emu.action_ns[(first + step) % E2E_RING]);
+	}
+	if (emu.actions < first + steps)
+		r->timeouts = first + steps - emu.actions;
+	result_end(r, start, last);
+}
+
+/**
+ * \brief Press the output button, next press after the relay switched
+ */
+static void button_toggle(struct result *r, int count, int gap_ms)
+{
+	uint64_t start, relays;
+	int i;
+
+	emu_settle(E2E_SETTLE_MS);
+	result_begin(r, "button toggle", &start);
+
+	for (i = 0; i < count; i++) {
+		relays = emu.relays;
+		emu_command("switch");
+		r->gestures++;
+		if (emu_wait(&emu.relays, relays, E2E_TIMEOUT_MS) < 0) {
+			r->timeouts++;
+			continue;
+		}
+		pthread_mutex_lock(&emu.mutex);
+		stats_hist_record(&r->hist, emu.relay_ns - emu.action_ns[(emu.actions - 1) % E2E_RING]);
+		pthread_mutex_unlock(&emu.mutex);
+		if (gap_ms)
+			sleep_ms(gap_ms);
+	}
+	emu_settle(E2E_SETTLE_MS);
+	mixer_drain();
+	result_end(r, start, emu.relay_ns);
+}
+
+/**
+ * \brief Change the mixer, next change after the box got the last one
+ */
+static void mixer_steps(struct result *r, int gap_ms)
+{
+	uint64_t start, leds, t0;
+	int pct;
+
+	mixer_preset(5);
+	result_begin(r, "mixer steps", &start);
+
+	for (pct = 10; pct <= 95; pct += 5) {
+		leds = emu.leds;
+		t0 = stats_now();
+		backend.ops->set_volume(&backend, STRIX_OUTPUT_SPEAKER, pct);
+		r->gestures++;
+		if (emu_wait(&emu.leds, leds, E2E_TIMEOUT_MS) < 0) {
+			r->timeouts++;
+			continue;
+		}
+		stats_hist_record(&r->hist, emu.led_ns - t0);
+		sleep_ms(gap_ms);
+	}
+	emu_settle(E2E_SETTLE_MS);
+	result_end(r, start, emu.led_ns);
+	mixer_drain();
+}
+
+/**
+ * \brief Change the mixer back to back, the daemon coalesces the changes
+ * The latency is the time from the last change until the box settled.
+ */
+static void mixer_burst(struct result *r, int count)
+{
+	uint64_t start, t_last = 0;
+	int i;
+
+	mixer_preset(5);
+	result_begin(r, "mixer burst", &start);
+
+	for (i = 0; i < count; i++) {
+		t_last = stats_now();
+		backend.ops->set_volume(&backend, STRIX_OUTPUT_SPEAKER, 10 + (i * 37) % 90);
+		r->gestures++;
+	}
+	emu_settle(E2E_SETTLE_MS);
+	if (emu.led_ns > t_last)
+		stats_hist_record(&r->hist, emu.led_ns - t_last);
+	result_end(r, start, emu.led_ns);
+	mixer_drain();
+}
+
+static void print_us(uint64_t ns)
+{
+	printf(" %9.1f", ns / 1000.0);
+}
+
+static void print_result(const struct result *r)
+{
+	printf("%-14s %5u %4u", r->name, r->gestures, r->timeouts);
+	printf(" %9.1f", r->duration_ns ? r->gestures * 1e9 / r->duration_ns : 0.0);
+	print_us(stats_percentile(&r->hist, 50.0));
+	print_us(stats_percentile(&r->hist, 99.0));
+	print_us(stats_percentile(&r->hist, 99.9));
+	print_us(r->hist.max);
+	printf(" %6.2f", r->gestures ? (double)r->usb / r->gestures : 0.0);
+	if (daemon_pid > 0)
+		printf(" %8.1f\n", r->gestures ? r->cpu_us / r->gestures : 0.0);
+	else
+		printf(" %8s\n", "n/a");
+}
+
+static void print_help(const char *name)
+{
+	printf("\n Usage: %s [OPTIONS]\n\n", name);
+	printf("  Options:\n");
+	printf("   -h --help                 Print this help\n");
+	printf("   -s --emu path             Control socket of strix-emu (default /tmp/strix-emu.sock)\n");
+	printf("   -c --card name            ALSA card the daemon controls (default hw:Dummy)\n");
+	printf("   -e --element name         ALSA mixer element (default Master)\n");
+	printf("   -p --pid pid              Daemon for the CPU time (default: search strix-daemon)\n");
+	printf("   -n --steps count          Knob steps per scenario (default 10)\n");
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static struct option long_options[] = {
+		{"emu", required_argument, 0, 's'},
+		{"card", required_argument, 0, 'c'},
+		{"element", required_argument, 0, 'e'},
+		{"pid", required_argument, 0, 'p'},
+		{"steps", required_argument, 0, 'n'},
+		{"help", no_argument, 0, 'h'},
+		{NULL, 0, 0, 0}
+	};
+	const char *emu_path = "/tmp/strix-emu.sock";
+	struct result results[6];
+	pthread_condattr_t attr;
+	pthread_t thread_emu;
+	int value, steps = 10, i;
+
+	backend.ops = &strix_backend_alsa;
+	backend.card = "hw:Dummy";
+	backend.element[STRIX_OUTPUT_SPEAKER] = "Master";
+	backend.element[STRIX_OUTPUT_HEADPHONE] = "Master";
+
+	while ((value = getopt_long(argc, argv, "s:c:e:p:n:h", long_options, NULL)) != -1) {
+		switch (value) {
+		case 's':
+			emu_path = optarg;
+			break;
+		case 'c':
+			backend.card = optarg;
+			break;
+		case 'e':
+			backend.element[STRIX_OUTPUT_SPEAKER] = optarg;
+			backend.element[STRIX_OUTPUT_HEADPHONE] = optarg;
+			break;
+		case 'p':
+			daemon_pid = atoi(optarg);
+			break;
+		case 'n':
+			steps = atoi(optarg);
+			if (steps < 1 || steps > 30) {
+				fprintf(stderr, "steps must be between 1 and 30\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'h':
+			print_help(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			print_help(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (daemon_pid == 0)
+		daemon_pid = find_daemon();
+
+	pthread_mutex_init(&emu.mutex, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&emu.cond, &attr);
+
+	emu_fd = emu_connect(emu_path);
+	if (emu_fd < 0) {
+		perror(emu_path);
+		return EXIT_FAILURE;
+	}
+	if (backend.ops->open(&backend) < 0) {
+		fprintf(stderr, "could not open mixer %s of %s\n",
+			backend.element[STRIX_OUTPUT_SPEAKER], backend.card);
+		return EXIT_FAILURE;
+	}
+	pthread_create(&thread_emu, NULL, emuThread, NULL);
+
+	//make sure the box is initialised, the driver ignores actions before the first hello
+	emu_command("hello");
+	emu_settle(E2E_SETTLE_MS);
+
+	knob_steps(&results[0], "knob slow", steps, 100);
+	knob_steps(&results[1], "knob closed", steps, 0);
+	knob_spin(&results[2], 30);
+	button_toggle(&results[3], 2 * steps, 20);
+	mixer_steps(&results[4], 50);
+	mixer_burst(&results[5], 10 * steps);
+
+	printf("%-14s %5s %4s %9s %9s %9s %9s %9s %6s %8s\n", "scenario", "n", "lost",
+	       "per sec", "p50 us", "p99 us", "p99.9 us", "max us", "usb", "cpu us");
+	for (i = 0; i < 6; i++)
+		print_result(&results[i]);
+
+	backend.ops->close(&backend);
+	close(emu_fd);
+	return EXIT_SUCCESS;
+}
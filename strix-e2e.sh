@@ -0,0 +1,52 @@
+#!/bin/bash
+#
+# End-to-end benchmark: emulated control box -> strixdlx.ko -> strix-daemon -> snd-dummy
+# Build first with "make all daemon bench".
+
+if [[ $EUID -ne 0 ]]; then
+  echo "You must run this with superuser priviliges.  Try \"sudo ./strix-e2e.sh\"" 2>&1
+  exit 1
+fi
+
+EMU_SOCKET=/tmp/strix-emu.sock
+DAEMON_SOCKET=/tmp/strix-e2e-daemon.sock
+CARD=hw:Dummy
+
+modprobe dummy_hcd || exit 1
+modprobe raw_gadget || exit 1
+modprobe snd-dummy || exit 1
+if ! lsmod | grep -q '^strixdlx '; then
+  insmod ./strixdlx.ko || exit 1
+fi
+
+./strix-emu --control ${EMU_SOCKET} --record strix-e2e-emu.log < /dev/null > /dev/null &
+EMU_PID=$!
+
+# wait for the driver to bind to the emulated box, the only one of a test machine
+DEVICE=
+for i in $(seq 50); do
+  DEVICE=$(ls -1 /dev/strixdlx[0-9]* 2> /dev/null | head -n 1)
+  [ -n "${DEVICE}" ] && break
+  sleep 0.1
+done
+if [ -z "${DEVICE}" ]; then
+  echo "strixdlx did not bind to the emulated box" 2>&1
+  kill ${EMU_PID}
+  exit 1
+fi
+
+./strix-daemon --device ${DEVICE} --ramp 0 --card ${CARD} --element Master --socket ${DAEMON_SOCKET} > strix-e2e-daemon.log &
+DAEMON_PID=$!
+sleep 1
+
+./strix-e2e --emu ${EMU_SOCKET} --card ${CARD} --pid ${DAEMON_PID} "$@"
+RESULT=$?
+
+# latency of the stages inside the daemon
+kill -USR1 ${DAEMON_PID}
+sleep 0.2
+kill ${DAEMON_PID} ${EMU_PID}
+wait
+cat strix-e2e-daemon.log
+
+exit $RESULT
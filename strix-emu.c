@@ -0,0 +1,790 @@
+/*
+ * Emulator for the control box of the ASUS Strix Raid DLX
+ *
+ * Presents a USB device with the ids of the soundcard (0b05:180c) and the
+ * interrupt endpoint on interface 4 through raw_gadget. Loaded together with
+ * dummy_hcd the strixdlx module binds to it like to the real card, so the
+ * driver and the daemon can be tested and benchmarked on any Linux machine:
+ *
+ *   modprobe dummy_hcd
+ *   modprobe raw_gadget
+ *   insmod strixdlx.ko
+ *   strix-emu --control /tmp/strix-emu.sock
+ *
+ * The emulator sends the reports of the box on demand ("hello" 01 c5 ...
+ * followed by the 05 xx action report) and accepts the relay and led control
+ * requests the driver sends. Every report sent and every request received is
+ * logged with a CLOCK_MONOTONIC timestamp in nanoseconds, the same clock the
+ * daemon uses for its statistics.
+ *
+ * Commands are read line by line from stdin and from clients of the control
+ * socket, the log is written to stdout and to every control client:
+ *
+ *   up | down | switch | sonic | uninit	one gesture (hello + action report)
+ *   hello				hello report only
+ *   raw <16 hex bytes>			any report
+ *   spin <count> up|down [ms]		several knob steps
+ *   sleep <ms>				pause the command stream
+ *   stats				print the counters
+ *   quit
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <linux/types.h>
+#include <linux/usb/ch9.h>
+#include <linux/usb/raw_gadget.h>
+
+#include "strixdlx-proto.h"
+
+#define EMU_INTERFACES		5	/* the box is on the last one */
+#define EMU_REPORT_SIZE		STRIXDLX_REPORT_SIZE
+#define EMU_EP0_MAX		256
+#define EMU_MAX_CLIENTS		8
+#define EMU_LINE_SIZE		256
+
+static const uint8_t REPORT_HELLO[EMU_REPORT_SIZE] = {0x01, 0xc5, 0x00, 0x00, 0x01, 0x01, 0x0e, 0x0e};
+static const uint8_t REPORT_SWITCH[EMU_REPORT_SIZE] = {0x05, 0x03, 0x00, 0x01, 0x01, 0x01, 0x0e, 0x0e};
+static const uint8_t REPORT_SONIC[EMU_REPORT_SIZE] = {0x05, 0x02, 0x00, 0x01, 0x01, 0x00, 0x0e, 0x0e};
+static const uint8_t REPORT_DOWN[EMU_REPORT_SIZE] = {0x05, 0x06, 0x00, 0x01, 0x01, 0x04, 0x0e, 0x0e};
+static const uint8_t REPORT_UP[EMU_REPORT_SIZE] = {0x05, 0x05, 0x00, 0x01, 0x01, 0x03, 0x01, 0x0e};
+static const uint8_t REPORT_UNINIT[EMU_REPORT_SIZE] = {0x05, 0x04, 0x00, 0x01, 0x01, 0x03, 0x01, 0x0e};
+static const uint8_t REPORT_ACK[EMU_REPORT_SIZE] = {0x05, 0x05, 0x00, 0x03, 0x01, 0x01, 0x01, 0x0e};
+
+struct usb_raw_control_event {
+	struct usb_raw_event inner;
+	struct usb_ctrlrequest ctrl;
+};
+
+struct usb_raw_control_io {
+	struct usb_raw_ep_io inner;
+	uint8_t data[EMU_EP0_MAX];
+};
+
+struct usb_raw_report_io {
+	struct usb_raw_ep_io inner;
+	uint8_t data[EMU_REPORT_SIZE];
+};
+
+/*
+ * descriptors
+ */
+static struct usb_device_descriptor device_descriptor = {
+	.bLength = USB_DT_DEVICE_SIZE,
+	.bDescriptorType = USB_DT_DEVICE,
+	.bcdUSB = __constant_cpu_to_le16(0x0200),
+	.bDeviceClass = 0,
+	.bDeviceSubClass = 0,
+	.bDeviceProtocol = 0,
+	.bMaxPacketSize0 = 64,
+	.idVendor = __constant_cpu_to_le16(STRIXDLX_VENDOR_ID),
+	.idProduct = __constant_cpu_to_le16(STRIXDLX_PRODUCT_ID),
+	.bcdDevice = __constant_cpu_to_le16(0x0100),
+	.iManufacturer = 1,
+	.iProduct = 2,
+	.iSerialNumber = 0,
+	.bNumConfigurations = 1,
+};
+
+static struct usb_endpoint_descriptor int_in_descriptor = {
+	.bLength = USB_DT_ENDPOINT_SIZE,
+	.bDescriptorType = USB_DT_ENDPOINT,
+	.bEndpointAddress = USB_DIR_IN | 1,	/* number fixed up from the udc */
+	.bmAttributes = USB_ENDPOINT_XFER_INT,
+	.wMaxPacketSize = __constant_cpu_to_le16(EMU_REPORT_SIZE),
+	.bInterval = 4,				/* 1ms at high speed */
+};
+
+static const char *strings[] = { NULL, "ASUSTeK", "Strix Raid DLX control box emulator" };
+
+/*
+ * state
+ */
+static int gadget_fd = -1;
+static int int_in_ep = -1;		/* raw_gadget handle of the interrupt endpoint */
+static int report_pipe[2];		/* reports waiting for the host */
+static int send_ack = 1;		/* answer led requests with hello + ack like the box */
+static FILE *record;
+
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int clients[EMU_MAX_CLIENTS];
+
+static struct {
+	unsigned long reports;
+	unsigned long relay_requests;
+	unsigned long led_requests;
+	unsigned long other_requests;
+} counters;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * \brief Log a line with timestamp to stdout, the record file and all control clients
+ */
+static void emu_log(const char *fmt, ...)
+{
+	char line[EMU_LINE_SIZE];
+	va_list args;
+	int n, i;
+
+	n = snprintf(line, sizeof(line), "%llu ", (unsigned long long)now_ns());
+	va_start(args, fmt);
+	n += vsnprintf(line + n, sizeof(line) - n - 1, fmt, args);
+	va_end(args);
+	if (n > (int)sizeof(line) - 2)
+		n = sizeof(line) - 2;
+	line[n++] = '\n';
+	line[n] = '\0';
+
+	pthread_mutex_lock(&log_mutex);
+	fputs(line, stdout);
+	fflush(stdout);
+	if (record) {
+		fputs(line, record);
+		fflush(record);
+	}
+	for (i = 0; i < EMU_MAX_CLIENTS; i++) {
+		if (clients[i] >= 0 && send(clients[i], line, n, MSG_DONTWAIT | MSG_NOSIGNAL) < 0
+		    && errno != EAGAIN) {
+			close(clients[i]);
+			clients[i] = -1;
+		}
+	}
+	pthread_mutex_unlock(&log_mutex);
+}
+
+static void hexdump(char *out, size_t size, const uint8_t *data, int len)
+{
+	int i, n = 0;
+
+	out[0] = '\0';
+	for (i = 0; i < len && n < (int)size - 3; i++)
+		n += snprintf(out + n, size - n, "%s%02x", i ? " " : "", data[i]);
+}
+
+/*
+ * ******	gadget	******
+ */
+
+static void gadget_init(const char *driver, const char *device)
+{
+	struct usb_raw_init arg;
+
+	memset(&arg, 0, sizeof(arg));
+	snprintf((char *)arg.driver_name, sizeof(arg.driver_name), "%s", driver);
+	snprintf((char *)arg.device_name, sizeof(arg.device_name), "%s", device);
+	arg.speed = USB_SPEED_HIGH;
+
+	if (ioctl(gadget_fd, USB_RAW_IOCTL_INIT, &arg) < 0) {
+		perror("USB_RAW_IOCTL_INIT");
+		exit(EXIT_FAILURE);
+	}
+	if (ioctl(gadget_fd, USB_RAW_IOCTL_RUN, 0) < 0) {
+		perror("USB_RAW_IOCTL_RUN");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * \brief Pick an interrupt in endpoint of the udc
+ */
+static void gadget_pick_endpoint(void)
+{
+	struct usb_raw_eps_info info;
+	int i, n;
+
+	memset(&info, 0, sizeof(info));
+	n = ioctl(gadget_fd, USB_RAW_IOCTL_EPS_INFO, &info);
+	if (n < 0) {
+		perror("USB_RAW_IOCTL_EPS_INFO");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < n; i++) {
+		if (info.eps[i].caps.type_int && info.eps[i].caps.dir_in) {
+			if (info.eps[i].addr != USB_RAW_EP_ADDR_ANY)
+				int_in_descriptor.bEndpointAddress = USB_DIR_IN | info.eps[i].addr;
+			return;
+		}
+	}
+	fprintf(stderr, "udc has no interrupt in endpoint\n");
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * \brief Build the configuration descriptor
+ * Interfaces 0-3 stand in for the audio functions of the card, the driver
+ * only binds to interface 4 with the interrupt endpoint.
+ */
+static int build_config(uint8_t *buf, int size)
+{
+	struct usb_config_descriptor *config = (struct usb_config_descriptor *)buf;
+	struct usb_interface_descriptor intf;
+	int len = USB_DT_CONFIG_SIZE, i;
+
+	memset(&intf, 0, sizeof(intf));
+	intf.bLength = USB_DT_INTERFACE_SIZE;
+	intf.bDescriptorType = USB_DT_INTERFACE;
+	intf.bInterfaceClass = USB_CLASS_VENDOR_SPEC;
+
+	for (i = 0; i < EMU_INTERFACES; i++) {
+		intf.bInterfaceNumber = i;
+		intf.bNumEndpoints = i == STRIXDLX_INTERFACE ? 1 : 0;
+		memcpy(buf + len, &intf, sizeof(intf));
+		len += sizeof(intf);
+		if (i == STRIXDLX_INTERFACE) {
+			memcpy(buf + len, &int_in_descriptor, USB_DT_ENDPOINT_SIZE);
+			len += USB_DT_ENDPOINT_SIZE;
+		}
+	}
+
+	config->bLength = USB_DT_CONFIG_SIZE;
+	config->bDescriptorType = USB_DT_CONFIG;
+	config->wTotalLength = __cpu_to_le16(len);
+	config->bNumInterfaces = EMU_INTERFACES;
+	config->bConfigurationValue = 1;
+	config->iConfiguration = 0;
+	config->bmAttributes = USB_CONFIG_ATT_ONE | USB_CONFIG_ATT_SELFPOWER;
+	config->bMaxPower = 50;
+	return len < size ? len : size;
+}
+
+static int build_string(uint8_t *buf, int index)
+{
+	const char *s;
+	int i, len;
+
+	if (index == 0) {
+		buf[0] = 4;
+		buf[1] = USB_DT_STRING;
+		buf[2] = 0x09;		/* en-US */
+		buf[3] = 0x04;
+		return 4;
+	}
+	if (index >= (int)(sizeof(strings) / sizeof(strings[0])))
+		return -1;
+
+	s = strings[index];
+	len = strlen(s);
+	buf[0] = 2 + 2 * len;
+	buf[1] = USB_DT_STRING;
+	for (i = 0; i < len; i++) {
+		buf[2 + 2 * i] = s[i];
+		buf[3 + 2 * i] = 0;
+	}
+	return buf[0];
+}
+
+static void queue_report(const uint8_t *report)
+{
+	if (write(report_pipe[1], report, EMU_REPORT_SIZE) != EMU_REPORT_SIZE)
+		perror("report queue");
+}
+
+/**
+ * \brief Log a class request of the driver
+ */
+static void handle_class_out(const struct usb_ctrlrequest *ctrl, const uint8_t *data, int len)
+{
+	char hex[EMU_REPORT_SIZE * 3 + 1];
+	uint16_t value = __le16_to_cpu(ctrl->wValue);
+	uint16_t index = __le16_to_cpu(ctrl->wIndex);
+	int leds;
+
+	hexdump(hex, sizeof(hex), data, len > EMU_REPORT_SIZE ? EMU_REPORT_SIZE : len);
+
+	if (ctrl->bRequest == STRIXDLX_CTRL_REQUEST && value == STRIXDLX_CTRL_VALUE
+	    && index == STRIXDLX_CTRL_INDEX && len >= 2) {
+		counters.relay_requests++;
+		emu_log("rx relay %s data=%s",
+			data[0] == 0x02 ? "headphone" : data[0] == 0x01 ? "speaker" : "unknown", hex);
+		return;
+	}
+
+	if (ctrl->bRequest == STRIXDLX_CTRL_VOLUME_REQUEST && value == STRIXDLX_CTRL_VOLUME_VALUE
+	    && index == STRIXDLX_CTRL_VOLUME_INDEX && len >= 9) {
+		counters.led_requests++;
+		leds = __builtin_popcount(data[7]) + __builtin_popcount(data[8] & 0x1f);
+		emu_log("rx led %s leds=%d data=%s",
+			data[6] == 0x02 ? "headphone" : data[6] == 0x08 ? "speaker" : "unknown",
+			leds, hex);
+		//the box confirms every led setting
+		if (send_ack) {
+			queue_report(REPORT_HELLO);
+			queue_report(REPORT_ACK);
+		}
+		return;
+	}
+
+	counters.other_requests++;
+	emu_log("rx ctrl type=%02x request=%02x value=%04x index=%04x data=%s",
+		ctrl->bRequestType, ctrl->bRequest, value, index, hex);
+}
+
+static void ep0_stall(void)
+{
+	if (ioctl(gadget_fd, USB_RAW_IOCTL_EP0_STALL, 0) < 0)
+		perror("USB_RAW_IOCTL_EP0_STALL");
+}
+
+static void ep0_write(const void *data, int len, int wlength)
+{
+	struct usb_raw_control_io io;
+
+	if (len > wlength)
+		len = wlength;
+	if (len > EMU_EP0_MAX)
+		len = EMU_EP0_MAX;
+	io.inner.ep = 0;
+	io.inner.flags = 0;
+	io.inner.length = len;
+	memcpy(io.data, data, len);
+	if (ioctl(gadget_fd, USB_RAW_IOCTL_EP0_WRITE, &io) < 0)
+		perror("USB_RAW_IOCTL_EP0_WRITE");
+}
+
+static int ep0_read(uint8_t *data, int len)
+{
+	struct usb_raw_control_io io;
+	int n;
+
+	io.inner.ep = 0;
+	io.inner.flags = 0;
+	io.inner.length = len > EMU_EP0_MAX ? EMU_EP0_MAX : len;
+	n = ioctl(gadget_fd, USB_RAW_IOCTL_EP0_READ, &io);
+	if (n < 0) {
+		perror("USB_RAW_IOCTL_EP0_READ");
+		return n;
+	}
+	memcpy(data, io.data, n);
+	return n;
+}
+
+static void handle_control(const struct usb_ctrlrequest *ctrl)
+{
+	uint8_t buf[EMU_EP0_MAX];
+	uint16_t value = __le16_to_cpu(ctrl->wValue);
+	uint16_t length = __le16_to_cpu(ctrl->wLength);
+	int len, ep;
+
+	//class requests of the driver (relay and leds)
+	if ((ctrl->bRequestType & USB_TYPE_MASK) == USB_TYPE_CLASS) {
+		if (ctrl->bRequestType & USB_DIR_IN) {
+			ep0_stall();
+			return;
+		}
+		len = ep0_read(buf, length);
+		if (len >= 0)
+			handle_class_out(ctrl, buf, len);
+		return;
+	}
+
+	if ((ctrl->bRequestType & USB_TYPE_MASK) != USB_TYPE_STANDARD) {
+		ep0_stall();
+		return;
+	}
+
+	switch (ctrl->bRequest) {
+	case USB_REQ_GET_DESCRIPTOR:
+		switch (value >> 8) {
+		case USB_DT_DEVICE:
+			ep0_write(&device_descriptor, sizeof(device_descriptor), length);
+			return;
+		case USB_DT_CONFIG:
+			len = build_config(buf, sizeof(buf));
+			ep0_write(buf, len, length);
+			return;
+		case USB_DT_STRING:
+			len = build_string(buf, value & 0xff);
+			if (len < 0)
+				break;
+			ep0_write(buf, len, length);
+			return;
+		}
+		break;
+
+	case USB_REQ_SET_CONFIGURATION:
+		if (int_in_ep < 0) {
+			ep = ioctl(gadget_fd, USB_RAW_IOCTL_EP_ENABLE, &int_in_descriptor);
+			if (ep < 0) {
+				perror("USB_RAW_IOCTL_EP_ENABLE");
+				break;
+			}
+			__atomic_store_n(&int_in_ep, ep, __ATOMIC_RELEASE);
+		}
+		if (ioctl(gadget_fd, USB_RAW_IOCTL_VBUS_DRAW, 100) < 0)
+			perror("USB_RAW_IOCTL_VBUS_DRAW");
+		if (ioctl(gadget_fd, USB_RAW_IOCTL_CONFIGURE, 0) < 0)
+			perror("USB_RAW_IOCTL_CONFIGURE");
+		ep0_read(buf, 0);
+		emu_log("configured");
+		return;
+
+	case USB_REQ_SET_INTERFACE:
+		ep0_read(buf, 0);
+		return;
+
+	case USB_REQ_GET_INTERFACE:
+	case USB_REQ_GET_CONFIGURATION:
+		buf[0] = ctrl->bRequest == USB_REQ_GET_CONFIGURATION ? 1 : 0;
+		ep0_write(buf, 1, length);
+		return;
+
+	case USB_REQ_GET_STATUS:
+		buf[0] = 0;
+		buf[1] = 0;
+		ep0_write(buf, 2, length);
+		return;
+	}
+
+	ep0_stall();
+}
+
+/**
+ * Thread handling endpoint 0
+ */
+static void *ep0Thread(void *vargs)
+{
+	struct usb_raw_control_event event;
+
+	while (1) {
+		event.inner.type = 0;
+		event.inner.length = sizeof(event.ctrl);
+		if (ioctl(gadget_fd, USB_RAW_IOCTL_EVENT_FETCH, &event) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("USB_RAW_IOCTL_EVENT_FETCH");
+			exit(EXIT_FAILURE);
+		}
+
+		switch (event.inner.type) {
+		case USB_RAW_EVENT_CONNECT:
+			emu_log("connected");
+			gadget_pick_endpoint();
+			break;
+		case USB_RAW_EVENT_CONTROL:
+			handle_control(&event.ctrl);
+			break;
+		default:
+			break;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Thread writing queued reports to the interrupt endpoint
+ * A write returns when the host has picked up the report.
+ */
+static void *reportThread(void *vargs)
+{
+	struct usb_raw_report_io io;
+	uint8_t report[EMU_REPORT_SIZE];
+	char hex[EMU_REPORT_SIZE * 3 + 1];
+
+	while (read(report_pipe[0], report, sizeof(report)) == sizeof(report)) {
+		while (__atomic_load_n(&int_in_ep, __ATOMIC_ACQUIRE) < 0)
+			usleep(10000);
+
+		io.inner.ep = int_in_ep;
+		io.inner.flags = 0;
+		io.inner.length = sizeof(report);
+		memcpy(io.data, report, sizeof(report));
+		if (ioctl(gadget_fd, USB_RAW_IOCTL_EP_WRITE, &io) < 0) {
+			perror("USB_RAW_IOCTL_EP_WRITE");
+			continue;
+		}
+		counters.reports++;
+		hexdump(hex, sizeof(hex), report, sizeof(report));
+		emu_log("tx report %s", hex);
+	}
+	return NULL;
+}
+
+/*
+ * ******	commands	******
+ */
+
+static void gesture(const char *name, const uint8_t *report)
+{
+	emu_log("gesture %s", name);
+	queue_report(REPORT_HELLO);
+	queue_report(report);
+}
+
+static void sleep_ms(long ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000;
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
+}
+
+/**
+ * \brief Execute one command line
+ * \return 1 if the emulator should stop
+ */
+static int command(char *line)
+{
+	uint8_t report[EMU_REPORT_SIZE];
+	char dir[16];
+	unsigned int byte;
+	int count, ms, i, n;
+	char *p;
+
+	line[strcspn(line, "\r\n")] = '\0';
+
+	if (strcmp(line, "up") == 0)
+		gesture("up", REPORT_UP);
+	else if (strcmp(line, "down") == 0)
+		gesture("down", REPORT_DOWN);
+	else if (strcmp(line, "switch") == 0)
+		gesture("switch", REPORT_SWITCH);
+	else if (strcmp(line, "sonic") == 0)
+		gesture("sonic", REPORT_SONIC);
+	else if (strcmp(line, "uninit") == 0)
+		gesture("uninit", REPORT_UNINIT);
+	else if (strcmp(line, "hello") == 0)
+		queue_report(REPORT_HELLO);
+	else if (strncmp(line, "raw ", 4) == 0) {
+		memset(report, 0, sizeof(report));
+		p = line + 4;
+		for (i = 0; i < EMU_REPORT_SIZE && sscanf(p, "%x%n", &byte, &n) == 1; i++, p += n)
+			report[i] = byte;
+		queue_report(report);
+	} else if (sscanf(line, "spin %d %15s %d", &count, dir, &ms) >= 2) {
+		if (sscanf(line, "spin %*d %*s %d", &ms) != 1)
+			ms = 0;
+		for (i = 0; i < count; i++) {
+			gesture(dir, strcmp(dir, "down") == 0 ? REPORT_DOWN : REPORT_UP);
+			if (ms > 0)
+				sleep_ms(ms);
+		}
+	} else if (sscanf(line, "sleep %d", &ms) == 1)
+		sleep_ms(ms);
+	else if (strcmp(line, "stats") == 0)
+		emu_log("stats reports=%lu relay=%lu led=%lu other=%lu",
+			counters.reports, counters.relay_requests,
+			counters.led_requests, counters.other_requests);
+	else if (strcmp(line, "quit") == 0)
+		return 1;
+	else if (line[0] != '\0' && line[0] != '#')
+		emu_log("error unknown command: %s", line);
+	return 0;
+}
+
+/**
+ * Thread serving the control socket
+ */
+static void *controlThread(void *vargs)
+{
+	int listen_fd = *(int *)vargs;
+	struct pollfd pfds[EMU_MAX_CLIENTS + 1];
+	char buf[EMU_MAX_CLIENTS][EMU_LINE_SIZE];
+	size_t fill[EMU_MAX_CLIENTS] = {0};
+	char *nl;
+	int i, fd;
+	ssize_t n;
+
+	while (1) {
+		pfds[0].fd = listen_fd;
+		pfds[0].events = POLLIN;
+		pthread_mutex_lock(&log_mutex);
+		for (i = 0; i < EMU_MAX_CLIENTS; i++) {
+			pfds[i + 1].fd = clients[i];
+			pfds[i + 1].events = POLLIN;
+			pfds[i + 1].revents = 0;
+		}
+		pthread_mutex_unlock(&log_mutex);
+
+		if (poll(pfds, EMU_MAX_CLIENTS + 1, -1) < 0)
+			continue;
+
+		if (pfds[0].revents & POLLIN) {
+			fd = accept(listen_fd, NULL, NULL);
+			pthread_mutex_lock(&log_mutex);
+			for (i = 0; fd >= 0 && i < EMU_MAX_CLIENTS; i++) {
+				if (clients[i] < 0) {
+					clients[i] = fd;
+					fill[i] = 0;
+					fd = -1;
+				}
+			}
+			pthread_mutex_unlock(&log_mutex);
+			if (fd >= 0)
+				close(fd);
+		}
+
+		for (i = 0; i < EMU_MAX_CLIENTS; i++) {
+			if (pfds[i + 1].fd < 0 || !(pfds[i + 1].revents & (POLLIN | POLLHUP)))
+				continue;
+			n = recv(pfds[i + 1].fd, buf[i] + fill[i], sizeof(buf[i]) - fill[i] - 1, 0);
+			if (n <= 0) {
+				pthread_mutex_lock(&log_mutex);
+				if (clients[i] == pfds[i + 1].fd) {
+					close(clients[i]);
+					clients[i] = -1;
+				}
+				pthread_mutex_unlock(&log_mutex);
+				continue;
+			}
+			fill[i] += n;
+			buf[i][fill[i]] = '\0';
+			while ((nl = strchr(buf[i], '\n')) != NULL) {
+				*nl = '\0';
+				if (command(buf[i]))
+					exit(EXIT_SUCCESS);
+				fill[i] -= nl + 1 - buf[i];
+				memmove(buf[i], nl + 1, fill[i] + 1);
+			}
+			//line too long
+			if (fill[i] == sizeof(buf[i]) - 1)
+				fill[i] = 0;
+		}
+	}
+	return NULL;
+}
+
+static int control_open(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, EMU_MAX_CLIENTS) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void print_help(const char *name)
+{
+	printf("\n Usage: %s [OPTIONS]\n\n", name);
+	printf("  Options:\n");
+	printf("   -h --help                 Print this help\n");
+	printf("   -d --driver name          UDC driver (default dummy_udc)\n");
+	printf("   -u --udc name             UDC device (default dummy_udc.0)\n");
+	printf("   -c --control path         Accept commands on this unix socket\n");
+	printf("   -r --record file          Append the log to a file\n");
+	printf("   -n --no-ack               Do not confirm led requests with hello + ack reports\n");
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static struct option long_options[] = {
+		{"driver", required_argument, 0, 'd'},
+		{"udc", required_argument, 0, 'u'},
+		{"control", required_argument, 0, 'c'},
+		{"record", required_argument, 0, 'r'},
+		{"no-ack", no_argument, 0, 'n'},
+		{"help", no_argument, 0, 'h'},
+		{NULL, 0, 0, 0}
+	};
+	const char *driver = "dummy_udc", *udc = "dummy_udc.0", *control = NULL;
+	char line[EMU_LINE_SIZE];
+	pthread_t thread_ep0, thread_report, thread_control;
+	int value, control_fd, i;
+
+	while ((value = getopt_long(argc, argv, "d:u:c:r:nh", long_options, NULL)) != -1) {
+		switch (value) {
+		case 'd':
+			driver = optarg;
+			break;
+		case 'u':
+			udc = optarg;
+			break;
+		case 'c':
+			control = optarg;
+			break;
+		case 'r':
+			record = fopen(optarg, "a");
+			if (record == NULL) {
+				perror(optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'n':
+			send_ack = 0;
+			break;
+		case 'h':
+			print_help(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			print_help(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	for (i = 0; i < EMU_MAX_CLIENTS; i++)
+		clients[i] = -1;
+
+	if (pipe(report_pipe) < 0) {
+		perror("pipe");
+		return EXIT_FAILURE;
+	}
+
+	gadget_fd = open("/dev/raw-gadget", O_RDWR);
+	if (gadget_fd < 0) {
+		perror("open /dev/raw-gadget");
+		return EXIT_FAILURE;
+	}
+	gadget_init(driver, udc);
+
+	pthread_create(&thread_ep0, NULL, ep0Thread, NULL);
+	pthread_create(&thread_report, NULL, reportThread, NULL);
+
+	if (control != NULL) {
+		control_fd = control_open(control);
+		if (control_fd < 0) {
+			perror(control);
+			return EXIT_FAILURE;
+		}
+		pthread_create(&thread_control, NULL, controlThread, &control_fd);
+	}
+
+	while (fgets(line, sizeof(line), stdin) != NULL) {
+		if (command(line))
+			return EXIT_SUCCESS;
+	}
+
+	//stdin closed, keep serving the control socket
+	if (control != NULL)
+		pthread_join(thread_control, NULL);
+	return EXIT_SUCCESS;
+}
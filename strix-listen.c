@@ -0,0 +1,251 @@
+/*
+ * Listener for the netlink multicast of the strixdlx module
+ *
+ * Prints every event of every control box, without opening the device and
+ * without the daemon: the module multicasts each event to the generic
+ * netlink group "events" of the family "strixdlx" (see strixdlx-proto.h).
+ * One line per event, for OSD popups, loggers and automation:
+ *
+ *   strix-listen		strixdlx0 headphone 40 volume 12 8123456789
+ *				(device, output, volume, event, seq, timestamp ns)
+ *   strix-listen --count 1	exit after the first event
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+
+#include "strixdlx-proto.h"
+
+#define LISTEN_BUFFER_SIZE	8192
+
+//request of the family lookup: header, generic header and the name
+struct family_request {
+	struct nlmsghdr nlh;
+	struct genlmsghdr genl;
+	char attrs[NLA_HDRLEN + NLA_ALIGN(sizeof(STRIXDLX_GENL_NAME))];
+};
+
+static const char *output_names[] = { "speaker", "headphone" };
+static const char *event_names[] = { "volume", "output", "sonic", "init" };
+
+/**
+ * \brief Walk the attributes of a message into a table indexed by type
+ */
+static void parse_attrs(struct nlattr **tb, int max, void *data, int len)
+{
+	struct nlattr *nla;
+	int type;
+
+	memset(tb, 0, (max + 1) * sizeof(*tb));
+	for (nla = data; len >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN && nla->nla_len <= len;
+	     len -= NLA_ALIGN(nla->nla_len), nla = (struct nlattr *)((char *)nla + NLA_ALIGN(nla->nla_len))) {
+		type = nla->nla_type & NLA_TYPE_MASK;
+		if (type <= max)
+			tb[type] = nla;
+	}
+}
+
+static void *nla_data(struct nlattr *nla)
+{
+	return (char *)nla + NLA_HDRLEN;
+}
+
+/**
+ * \brief Look up the family and the id of its multicast group
+ * \return group id, -1 with errno set (ENOENT: module not loaded)
+ */
+static int resolve_group(int fd)
+{
+	struct family_request req;
+	struct nlattr *nla, *tb[CTRL_ATTR_MAX + 1], *grp[CTRL_ATTR_MCAST_GRP_MAX + 1];
+	struct nlmsghdr *nlh;
+	struct nlmsgerr *err;
+	char buf[LISTEN_BUFFER_SIZE];
+	int len, rem;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = sizeof(req);
+	req.nlh.nlmsg_type = GENL_ID_CTRL;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST;
+	req.genl.cmd = CTRL_CMD_GETFAMILY;
+	req.genl.version = 1;
+	nla = (struct nlattr *)req.attrs;
+	nla->nla_type = CTRL_ATTR_FAMILY_NAME;
+	nla->nla_len = NLA_HDRLEN + sizeof(STRIXDLX_GENL_NAME);
+	memcpy(nla_data(nla), STRIXDLX_GENL_NAME, sizeof(STRIXDLX_GENL_NAME));
+
+	if (send(fd, &req, sizeof(req), 0) < 0)
+		return -1;
+	len = recv(fd, buf, sizeof(buf), 0);
+	if (len < 0)
+		return -1;
+
+	nlh = (struct nlmsghdr *)buf;
+	if (!NLMSG_OK(nlh, len))
+		goto invalid;
+	if (nlh->nlmsg_type == NLMSG_ERROR) {
+		err = NLMSG_DATA(nlh);
+		errno = -err->error;
+		return -1;
+	}
+
+	parse_attrs(tb, CTRL_ATTR_MAX, (char *)NLMSG_DATA(nlh) + GENL_HDRLEN,
+		    nlh->nlmsg_len - NLMSG_HDRLEN - GENL_HDRLEN);
+	if (tb[CTRL_ATTR_MCAST_GROUPS] == NULL)
+		goto invalid;
+
+	//nested list of groups, each with a name and an id
+	nla = nla_data(tb[CTRL_ATTR_MCAST_GROUPS]);
+	rem = tb[CTRL_ATTR_MCAST_GROUPS]->nla_len - NLA_HDRLEN;
+	while (rem >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN && nla->nla_len <= rem) {
+		parse_attrs(grp, CTRL_ATTR_MCAST_GRP_MAX, nla_data(nla), nla->nla_len - NLA_HDRLEN);
+		if (grp[CTRL_ATTR_MCAST_GRP_NAME] && grp[CTRL_ATTR_MCAST_GRP_ID]
+		    && strcmp(nla_data(grp[CTRL_ATTR_MCAST_GRP_NAME]), STRIXDLX_GENL_MCGRP) == 0)
+			return *(uint32_t *)nla_data(grp[CTRL_ATTR_MCAST_GRP_ID]);
+		rem -= NLA_ALIGN(nla->nla_len);
+		nla = (struct nlattr *)((char *)nla + NLA_ALIGN(nla->nla_len));
+	}
+
+invalid:
+	errno = EPROTO;
+	return -1;
+}
+
+/**
+ * \brief Print the events of one datagram
+ * \return number of events printed
+ */
+static int print_events(char *buf, int len)
+{
+	struct nlattr *tb[STRIXDLX_GENL_A_MAX + 1];
+	struct nlmsghdr *nlh;
+	struct genlmsghdr *genl;
+	unsigned int event, output;
+	uint64_t ts;
+	int count = 0;
+
+	for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+		genl = NLMSG_DATA(nlh);
+		if (nlh->nlmsg_len < NLMSG_HDRLEN + GENL_HDRLEN || genl->cmd != STRIXDLX_GENL_CMD_EVENT)
+			continue;
+		parse_attrs(tb, STRIXDLX_GENL_A_MAX, (char *)genl + GENL_HDRLEN,
+			    nlh->nlmsg_len - NLMSG_HDRLEN - GENL_HDRLEN);
+		if (!tb[STRIXDLX_GENL_A_DEVICE] || !tb[STRIXDLX_GENL_A_EVENT] || !tb[STRIXDLX_GENL_A_OUTPUT]
+		    || !tb[STRIXDLX_GENL_A_VOLUME] || !tb[STRIXDLX_GENL_A_SEQ] || !tb[STRIXDLX_GENL_A_TIMESTAMP])
+			continue;
+
+		event = *(uint8_t *)nla_data(tb[STRIXDLX_GENL_A_EVENT]);
+		output = *(uint8_t *)nla_data(tb[STRIXDLX_GENL_A_OUTPUT]);
+		memcpy(&ts, nla_data(tb[STRIXDLX_GENL_A_TIMESTAMP]), sizeof(ts));
+		printf("strixdlx%u %s %u %s %u %llu\n",
+		       *(uint32_t *)nla_data(tb[STRIXDLX_GENL_A_DEVICE]),
+		       output < 2 ? output_names[output] : "unknown",
+		       *(uint8_t *)nla_data(tb[STRIXDLX_GENL_A_VOLUME]),
+		       event < 4 ? event_names[event] : "unknown",
+		       *(uint32_t *)nla_data(tb[STRIXDLX_GENL_A_SEQ]),
+		       (unsigned long long)ts);
+		count++;
+	}
+	fflush(stdout);
+	return count;
+}
+
+static void print_help(const char *app_name)
+{
+	printf("\n Usage: %s [OPTIONS]\n\n", app_name);
+	printf("  Options:\n");
+	printf("   -h --help                 Print this help\n");
+	printf("   -n --count number         Exit after this many events\n");
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static struct option long_options[] = {
+		{"count", required_argument, 0, 'n'},
+		{"help", no_argument, 0, 'h'},
+		{NULL, 0, 0, 0}
+	};
+	struct sockaddr_nl addr;
+	char buf[LISTEN_BUFFER_SIZE];
+	int value, fd, group, len;
+	long count = -1;
+
+	while ((value = getopt_long(argc, argv, "n:h", long_options, NULL)) != -1) {
+		switch (value) {
+		case 'n':
+			count = atol(optarg);
+			break;
+		case 'h':
+			print_help(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			print_help(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+	if (fd < 0) {
+		perror("netlink socket");
+		return EXIT_FAILURE;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		goto error;
+	}
+
+	group = resolve_group(fd);
+	if (group < 0) {
+		if (errno == ENOENT)
+			fprintf(stderr, "netlink family %s not found, is the strixdlx module loaded?\n",
+				STRIXDLX_GENL_NAME);
+		else
+			perror("netlink family");
+		goto error;
+	}
+	if (setsockopt(fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group, sizeof(group)) < 0) {
+		perror("join group");
+		goto error;
+	}
+
+	while (count != 0) {
+		len = recv(fd, buf, sizeof(buf), 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			//the socket overflowed, the next events are fine again
+			if (errno == ENOBUFS) {
+				fprintf(stderr, "events lost\n");
+				continue;
+			}
+			perror("recv");
+			goto error;
+		}
+		len = print_events(buf, len);
+		if (count > 0)
+			count = count > len ? count - len : 0;
+	}
+
+	close(fd);
+	return EXIT_SUCCESS;
+
+error:
+	close(fd);
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,128 @@
+/*
+ * Volume ramps for the strix-daemon
+ *
+ * The steps of a ramp are equally spaced in time, the curve decides the
+ * volume of each step. A late timer skips the missed steps, so a busy
+ * daemon writes fewer intermediate volumes but still arrives in time.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "strix-ramp.h"
+
+static void timer_set(struct strix_ramp *r, uint64_t interval_ns)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = interval_ns / 1000000000ull;
+	its.it_value.tv_nsec = interval_ns % 1000000000ull;
+	its.it_interval = its.it_value;
+	timerfd_settime(r->fd, 0, &its, NULL);
+}
+
+/**
+ * \brief Volume after step of the ramp
+ */
+static int ramp_value(const struct strix_ramp *r)
+{
+	double x = (double)r->step / r->steps;
+
+	if (r->curve == RAMP_SMOOTH)
+		x = x * x * (3.0 - 2.0 * x);
+	return r->from + (int)((r->to - r->from) * x + (r->to > r->from ? 0.5 : -0.5));
+}
+
+int ramp_init(struct strix_ramp *r, int full_ms, int max_steps, enum strix_ramp_curve curve)
+{
+	memset(r, 0, sizeof(*r));
+	r->full_ms = full_ms;
+	r->max_steps = max_steps > 0 ? max_steps : 1;
+	r->curve = curve;
+	r->last = -1;
+	r->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	return r->fd < 0 ? -1 : 0;
+}
+
+void ramp_free(struct strix_ramp *r)
+{
+	if (r->fd >= 0)
+		close(r->fd);
+	r->fd = -1;
+}
+
+int ramp_to(struct strix_ramp *r, int current, int target)
+{
+	int distance = abs(target - current);
+	uint64_t duration_ns;
+
+	//nothing known to start from or no ramps wanted: jump
+	if (current < 0 || r->full_ms <= 0 || r->fd < 0 || distance == 0) {
+		ramp_stop(r);
+		r->last = target;
+		return target;
+	}
+
+	r->active = 1;
+	r->from = current;
+	r->to = target;
+	r->steps = distance < r->max_steps ? distance : r->max_steps;
+	duration_ns = (uint64_t)r->full_ms * 1000000ull * distance / 100;
+
+	//first step now, the others spread over the duration
+	r->step = 1;
+	if (r->step < r->steps)
+		timer_set(r, duration_ns / (r->steps - 1) > 0 ? duration_ns / (r->steps - 1) : 1);
+	else
+		ramp_stop(r);
+	r->last = ramp_value(r);
+	//the mixer moves at once, whatever the curve
+	if (r->last == current)
+		r->last += target > current ? 1 : -1;
+	return r->last;
+}
+
+int ramp_step(struct strix_ramp *r)
+{
+	uint64_t expired = 0;
+	int value;
+
+	if (read(r->fd, &expired, sizeof(expired)) != sizeof(expired) || !r->active)
+		return -1;
+
+	r->step += expired;
+	if (r->step >= r->steps) {
+		r->step = r->steps;
+		ramp_stop(r);
+	}
+	value = ramp_value(r);
+	//never back, the first step may have been ahead of the curve
+	if (r->to > r->from ? value <= r->last : value >= r->last)
+		return -1;
+	r->last = value;
+	return value;
+}
+
+void ramp_stop(struct strix_ramp *r)
+{
+	if (r->active && r->fd >= 0)
+		timer_set(r, 0);
+	r->active = 0;
+}
+
+int ramp_parse_curve(const char *name)
+{
+	if (strcmp(name, "linear") == 0)
+		return RAMP_LINEAR;
+	if (strcmp(name, "smooth") == 0)
+		return RAMP_SMOOTH;
+	return -1;
+}
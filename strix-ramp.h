@@ -0,0 +1,67 @@
+/*
+ * Volume ramps for the strix-daemon
+ *
+ * A knob step or the sonic button (0 <-> 100) does not jump the mixer, the
+ * volume is moved to the target in a few steps driven by a timerfd. The
+ * duration is given for a ramp over the full range and scales with the
+ * distance, so a knob step is over after a few milliseconds while a jump
+ * to 100% on headphones takes the full time. A new target while a ramp runs
+ * continues from the volume reached so far.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#ifndef STRIX_RAMP_H
+#define STRIX_RAMP_H
+
+#include <stdint.h>
+
+enum strix_ramp_curve {
+	RAMP_LINEAR,		/* same change per step */
+	RAMP_SMOOTH,		/* slow start and end (smoothstep) */
+};
+
+struct strix_ramp {
+	int fd;			/* timerfd, readable when the next step is due */
+	int full_ms;		/* duration of a 0 -> 100 ramp, 0 = jump */
+	int max_steps;		/* mixer writes per ramp at most */
+	enum strix_ramp_curve curve;
+
+	int active;
+	int from, to;		/* volumes 0-100 */
+	int step, steps;	/* steps done and steps of the ramp */
+	int last;		/* last volume handed out */
+};
+
+/*
+ * create the timer, returns 0 on success
+ */
+int ramp_init(struct strix_ramp *r, int full_ms, int max_steps, enum strix_ramp_curve curve);
+
+void ramp_free(struct strix_ramp *r);
+
+/*
+ * start a ramp from the current volume to a target, a running ramp is
+ * retargeted; returns the volume to write now, -1 if there is none
+ */
+int ramp_to(struct strix_ramp *r, int current, int target);
+
+/*
+ * call when the timer is readable, returns the volume to write or -1
+ */
+int ramp_step(struct strix_ramp *r);
+
+/*
+ * abort a running ramp, e.g. because somebody else set the volume
+ */
+void ramp_stop(struct strix_ramp *r);
+
+/*
+ * curve by name ("linear" or "smooth"), -1 if unknown
+ */
+int ramp_parse_curve(const char *name);
+
+#endif
@@ -0,0 +1,283 @@
+/*
+ * Unix socket service of the strix-daemon
+ *
+ * The daemon is the only reader of the device, clients get the events
+ * fanned out from here. Events are sent non-blocking: a client which does
+ * not read its socket loses events, it never slows down the daemon.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "strix-server.h"
+
+struct client {
+	int fd;			/* -1 if unused */
+	uint8_t mask;		/* STRIX_SUB_* */
+};
+
+static int listen_fd = -1;
+static char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static const struct strix_server_ops *server_ops;
+
+//clients, modified by the server thread, read by server_publish()
+static pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct client clients[SERVER_MAX_CLIENTS];
+static int subscribers;
+
+const char *server_default_path(void)
+{
+	static char path[sizeof(socket_path)];
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+
+	snprintf(path, sizeof(path), "%s/%s", dir ? dir : "/tmp", STRIX_SOCKET_NAME);
+	return path;
+}
+
+int server_open(const char *path, const struct strix_server_ops *ops)
+{
+	struct sockaddr_un addr;
+	int i;
+
+	for (i = 0; i < SERVER_MAX_CLIENTS; i++)
+		clients[i].fd = -1;
+	server_ops = ops;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -1;
+
+	listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listen_fd < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	//remove the socket of a daemon which did not clean up
+	unlink(path);
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+	    || chmod(path, 0600) < 0
+	    || listen(listen_fd, SERVER_MAX_CLIENTS) < 0) {
+		close(listen_fd);
+		listen_fd = -1;
+		return -1;
+	}
+	strcpy(socket_path, path);
+	return 0;
+}
+
+int server_adopt(int fd, const struct strix_server_ops *ops)
+{
+	int i, flags;
+
+	for (i = 0; i < SERVER_MAX_CLIENTS; i++)
+		clients[i].fd = -1;
+	server_ops = ops;
+
+	//accept() must not block the server thread
+	flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		return -1;
+	listen_fd = fd;
+	//the socket belongs to the service manager, it is not removed
+	socket_path[0] = '\0';
+	return 0;
+}
+
+void server_close(void)
+{
+	if (listen_fd < 0)
+		return;
+	close(listen_fd);
+	listen_fd = -1;
+	if (socket_path[0] != '\0')
+		unlink(socket_path);
+}
+
+/**
+ * \brief Send a message to one client, drop it if the client is too slow
+ * Called with clients_mutex held.
+ */
+static void client_send(struct client *c, const struct strix_msg *msg)
+{
+	if (send(c->fd, msg, sizeof(*msg), MSG_DONTWAIT | MSG_NOSIGNAL) < 0
+	    && errno != EAGAIN && errno != EWOULDBLOCK) {
+		//the server thread sees the hangup and closes the client
+		shutdown(c->fd, SHUT_RDWR);
+		if (c->mask)
+			__atomic_fetch_sub(&subscribers, 1, __ATOMIC_RELAXED);
+		c->mask = 0;
+	}
+}
+
+void server_publish(const struct strix_msg *msg)
+{
+	uint8_t wanted;
+	int i;
+
+	//nobody listens, the usual case
+	if (__atomic_load_n(&subscribers, __ATOMIC_RELAXED) == 0)
+		return;
+
+	switch (msg->type) {
+	case STRIX_MSG_VOLUME:
+		wanted = STRIX_SUB_VOLUME;
+		break;
+	case STRIX_MSG_OUTPUT:
+		wanted = STRIX_SUB_OUTPUT;
+		break;
+	case STRIX_MSG_BUTTON:
+		wanted = STRIX_SUB_BUTTON;
+		break;
+	default:
+		return;
+	}
+
+	pthread_mutex_lock(&clients_mutex);
+	for (i = 0; i < SERVER_MAX_CLIENTS; i++) {
+		if (clients[i].fd >= 0 && (clients[i].mask & wanted))
+			client_send(&clients[i], msg);
+	}
+	pthread_mutex_unlock(&clients_mutex);
+}
+
+static void client_accept(void)
+{
+	int fd, i;
+
+	fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	pthread_mutex_lock(&clients_mutex);
+	for (i = 0; i < SERVER_MAX_CLIENTS; i++) {
+		if (clients[i].fd < 0) {
+			clients[i].fd = fd;
+			clients[i].mask = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&clients_mutex);
+
+	if (i == SERVER_MAX_CLIENTS)
+		close(fd);
+}
+
+static void client_close(struct client *c)
+{
+	pthread_mutex_lock(&clients_mutex);
+	if (c->mask)
+		__atomic_fetch_sub(&subscribers, 1, __ATOMIC_RELAXED);
+	close(c->fd);
+	c->fd = -1;
+	c->mask = 0;
+	pthread_mutex_unlock(&clients_mutex);
+}
+
+/**
+ * \brief Read and execute one message of a client
+ * \return -1 if the client has gone
+ */
+static int client_handle(struct client *c)
+{
+	struct strix_msg msg, reply;
+	ssize_t n;
+
+	n = recv(c->fd, &msg, sizeof(msg), MSG_DONTWAIT);
+	if (n < 0)
+		return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+	if (n == 0)
+		return -1;
+	if (n != sizeof(msg))
+		return 0;
+
+	switch (msg.type) {
+	case STRIX_MSG_SUBSCRIBE:
+		pthread_mutex_lock(&clients_mutex);
+		if (!c->mask && msg.flags)
+			__atomic_fetch_add(&subscribers, 1, __ATOMIC_RELAXED);
+		else if (c->mask && !msg.flags)
+			__atomic_fetch_sub(&subscribers, 1, __ATOMIC_RELAXED);
+		c->mask = msg.flags & STRIX_SUB_ALL;
+		pthread_mutex_unlock(&clients_mutex);
+		/* fall through */
+	case STRIX_MSG_GET_STATE:
+		memset(&reply, 0, sizeof(reply));
+		reply.type = STRIX_MSG_STATE;
+		server_ops->state(&reply);
+		pthread_mutex_lock(&clients_mutex);
+		client_send(c, &reply);
+		pthread_mutex_unlock(&clients_mutex);
+		break;
+	case STRIX_MSG_SET_VOLUME:
+		if (msg.value <= 100)
+			server_ops->command(&msg);
+		break;
+	case STRIX_MSG_SET_OUTPUT:
+		if (msg.output <= 1)
+			server_ops->command(&msg);
+		break;
+	}
+	return 0;
+}
+
+void *serverThread(void *vargs)
+{
+	struct pollfd pfds[SERVER_MAX_CLIENTS + 1];
+	int owner[SERVER_MAX_CLIENTS + 1];
+	int i, nfds;
+
+	while (1) {
+		nfds = 0;
+		pfds[nfds].fd = listen_fd;
+		pfds[nfds].events = POLLIN;
+		owner[nfds++] = -1;
+
+		//only this thread adds or removes clients, no lock needed to read
+		for (i = 0; i < SERVER_MAX_CLIENTS; i++) {
+			if (clients[i].fd < 0)
+				continue;
+			pfds[nfds].fd = clients[i].fd;
+			pfds[nfds].events = POLLIN;
+			owner[nfds++] = i;
+		}
+
+		if (poll(pfds, nfds, -1) < 0) {
+			if (errno != EINTR)
+				perror("poll");
+			continue;
+		}
+
+		for (i = 1; i < nfds; i++) {
+			if (pfds[i].revents & POLLIN) {
+				if (client_handle(&clients[owner[i]]) < 0) {
+					client_close(&clients[owner[i]]);
+					continue;
+				}
+			}
+			if (pfds[i].revents & (POLLHUP | POLLERR | POLLNVAL))
+				client_close(&clients[owner[i]]);
+		}
+
+		if (pfds[0].revents & POLLIN)
+			client_accept();
+	}
+	return NULL;
+}
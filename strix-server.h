@@ -0,0 +1,57 @@
+/*
+ * Unix socket service of the strix-daemon
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#ifndef STRIX_SERVER_H
+#define STRIX_SERVER_H
+
+#include "strix-socket.h"
+
+#define SERVER_MAX_CLIENTS	32
+
+/*
+ * hooks into the daemon, called from the server thread
+ */
+struct strix_server_ops {
+	/* fill in a STRIX_MSG_STATE message */
+	void (*state)(struct strix_msg *msg);
+	/* execute STRIX_MSG_SET_VOLUME or STRIX_MSG_SET_OUTPUT */
+	void (*command)(const struct strix_msg *msg);
+};
+
+/*
+ * default socket path, $XDG_RUNTIME_DIR/strixdlx.sock or /tmp/strixdlx.sock
+ */
+const char *server_default_path(void);
+
+/*
+ * create the listening socket, returns 0 on success
+ */
+int server_open(const char *path, const struct strix_server_ops *ops);
+
+/*
+ * use a listening socket passed by socket activation, returns 0 on success
+ */
+int server_adopt(int fd, const struct strix_server_ops *ops);
+
+/*
+ * thread accepting clients and executing their commands
+ */
+void *serverThread(void *vargs);
+
+/*
+ * send an event to every client subscribed to it, never blocks
+ */
+void server_publish(const struct strix_msg *msg);
+
+/*
+ * remove the socket
+ */
+void server_close(void);
+
+#endif
@@ -0,0 +1,56 @@
+/*
+ * Client protocol of the strix-daemon
+ *
+ * The daemon listens on a SOCK_SEQPACKET unix socket, by default
+ * $XDG_RUNTIME_DIR/strixdlx.sock. Every packet in both directions is one
+ * struct strix_msg. A client subscribes to the events it wants to see and
+ * gets the current state as answer, afterwards the daemon forwards every
+ * event of the control box. Commands change the volume or the output just
+ * like the knob and the button of the box do.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#ifndef STRIX_SOCKET_H
+#define STRIX_SOCKET_H
+
+#include <stdint.h>
+
+#define STRIX_SOCKET_NAME	"strixdlx.sock"
+
+struct strix_msg {
+	uint8_t type;		/* STRIX_MSG_* */
+	uint8_t output;		/* 0 = speaker, 1 = headphone */
+	uint8_t value;		/* volume in percent */
+	uint8_t flags;		/* STRIX_BUTTON_* for button events, STRIX_STATE_* for state */
+};
+
+/*
+ * client -> daemon
+ */
+#define STRIX_MSG_SUBSCRIBE	0x01	/* flags: mask of STRIX_SUB_*, answered with STATE */
+#define STRIX_MSG_GET_STATE	0x02	/* answered with STATE */
+#define STRIX_MSG_SET_VOLUME	0x03	/* value: volume of the active output */
+#define STRIX_MSG_SET_OUTPUT	0x04	/* output: output to switch to */
+
+/*
+ * daemon -> client
+ */
+#define STRIX_MSG_STATE		0x80	/* output, value: volume, flags: STRIX_STATE_* */
+#define STRIX_MSG_VOLUME	0x81	/* volume of the active output changed */
+#define STRIX_MSG_OUTPUT	0x82	/* relay switched, value: volume of the new output */
+#define STRIX_MSG_BUTTON	0x83	/* button pressed, flags: STRIX_BUTTON_* */
+
+#define STRIX_SUB_VOLUME	(1 << 0)
+#define STRIX_SUB_OUTPUT	(1 << 1)
+#define STRIX_SUB_BUTTON	(1 << 2)
+#define STRIX_SUB_ALL		(STRIX_SUB_VOLUME | STRIX_SUB_OUTPUT | STRIX_SUB_BUTTON)
+
+#define STRIX_STATE_CONNECTED	(1 << 0)	/* control box is present */
+
+#define STRIX_BUTTON_SONIC	1
+
+#endif
@@ -0,0 +1,166 @@
+/*
+ * Latency statistics for the strix-daemon
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "strix-stats.h"
+
+static struct strix_histogram histograms[HIST_COUNT];
+static uint64_t counters[CNT_COUNT];
+
+static const char *hist_names[HIST_COUNT] = {
+	[HIST_KNOB_TO_MIXER] = "knob -> mixer",
+	[HIST_MIXER_WRITE] = "  mixer write",
+	[HIST_MIXER_TO_BOX] = "mixer -> box",
+	[HIST_BOX_WRITE] = "  box write",
+};
+
+static const char *counter_names[CNT_COUNT] = {
+	[CNT_DEVICE_EVENTS] = "device events",
+	[CNT_MIXER_EVENTS] = "mixer events",
+	[CNT_COALESCED] = "coalesced",
+	[CNT_ECHOES] = "echoes suppressed",
+	[CNT_BOX_WRITES] = "box writes",
+	[CNT_MIXER_WRITES] = "mixer writes",
+	[CNT_RECONNECTS] = "reconnects",
+	[CNT_ERRORS] = "errors",
+};
+
+uint64_t stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * \brief Histogram bucket of a value
+ * Values below 16 have their own bucket, above that every power of two is
+ * split into 16 buckets by the four bits following the leading one.
+ */
+static unsigned int bucket_index(uint64_t v)
+{
+	unsigned int msb;
+
+	if (v < STATS_SUB_BUCKETS)
+		return (unsigned int)v;
+
+	msb = 63 - __builtin_clzll(v);
+	return (msb - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS
+		+ ((v >> (msb - STATS_SUB_BITS)) & (STATS_SUB_BUCKETS - 1));
+}
+
+/**
+ * \brief Highest value falling into a bucket
+ */
+static uint64_t bucket_upper(unsigned int idx)
+{
+	unsigned int msb;
+	uint64_t sub;
+
+	if (idx < STATS_SUB_BUCKETS)
+		return idx;
+
+	msb = idx / STATS_SUB_BUCKETS + STATS_SUB_BITS - 1;
+	sub = idx % STATS_SUB_BUCKETS;
+	return (1ull << msb) + ((sub + 1) << (msb - STATS_SUB_BITS)) - 1;
+}
+
+void stats_hist_record(struct strix_histogram *h, uint64_t ns)
+{
+	uint64_t max;
+
+	__atomic_fetch_add(&h->bucket[bucket_index(ns)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+
+	max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	while (ns > max && !__atomic_compare_exchange_n(&h->max, &max, ns, 1,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+void stats_record(enum strix_hist hist, uint64_t ns)
+{
+	stats_hist_record(&histograms[hist], ns);
+}
+
+void stats_inc(enum strix_counter counter)
+{
+	__atomic_fetch_add(&counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+uint64_t stats_counter(enum strix_counter counter)
+{
+	return __atomic_load_n(&counters[counter], __ATOMIC_RELAXED);
+}
+
+uint64_t stats_percentile(const struct strix_histogram *h, double percent)
+{
+	uint64_t seen = 0, wanted, upper;
+	unsigned int i;
+
+	if (h->count == 0)
+		return 0;
+
+	wanted = (uint64_t)(h->count * percent / 100.0 + 0.5);
+	if (wanted == 0)
+		wanted = 1;
+
+	for (i = 0; i < STATS_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen >= wanted) {
+			upper = bucket_upper(i);
+			return upper < h->max ? upper : h->max;
+		}
+	}
+	return h->max;
+}
+
+/**
+ * \brief Print a nanosecond value with a readable unit
+ */
+static void print_ns(FILE *out, const char *label, uint64_t ns)
+{
+	if (ns < 10000)
+		fprintf(out, " %s=%lluns", label, (unsigned long long)ns);
+	else if (ns < 10000000)
+		fprintf(out, " %s=%lluus", label, (unsigned long long)(ns / 1000));
+	else
+		fprintf(out, " %s=%llums", label, (unsigned long long)(ns / 1000000));
+}
+
+void stats_dump(FILE *out)
+{
+	struct strix_histogram h;
+	int i;
+
+	fprintf(out, "strix-daemon statistics\n ");
+	for (i = 0; i < CNT_COUNT; i++) {
+		fprintf(out, " %s=%llu", counter_names[i],
+			(unsigned long long)__atomic_load_n(&counters[i], __ATOMIC_RELAXED));
+	}
+	fprintf(out, "\n");
+
+	for (i = 0; i < HIST_COUNT; i++) {
+		//snapshot, recording goes on in the other threads
+		memcpy(&h, &histograms[i], sizeof(h));
+		fprintf(out, "  %-16s n=%llu", hist_names[i], (unsigned long long)h.count);
+		if (h.count) {
+			print_ns(out, "p50", stats_percentile(&h, 50.0));
+			print_ns(out, "p90", stats_percentile(&h, 90.0));
+			print_ns(out, "p99", stats_percentile(&h, 99.0));
+			print_ns(out, "p99.9", stats_percentile(&h, 99.9));
+			print_ns(out, "max", h.max);
+		}
+		fprintf(out, "\n");
+	}
+	fflush(out);
+}
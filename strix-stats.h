@@ -0,0 +1,86 @@
+/*
+ * Latency statistics for the strix-daemon
+ *
+ * Every stage of the knob -> mixer and mixer -> box path records its
+ * latency into a log-linear (HDR style) histogram: 16 sub buckets per power
+ * of two, so every recorded value is kept with better than 7% precision
+ * from 1ns up to more than a minute. Recording is lock free and may be done
+ * from any thread.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#ifndef STRIX_STATS_H
+#define STRIX_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define STATS_SUB_BITS		4
+#define STATS_SUB_BUCKETS	(1 << STATS_SUB_BITS)
+#define STATS_BUCKETS		((64 - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS)
+
+/*
+ * histograms
+ */
+enum strix_hist {
+	HIST_KNOB_TO_MIXER,	/* device event received -> mixer write completed */
+	HIST_MIXER_WRITE,	/* duration of the mixer write */
+	HIST_MIXER_TO_BOX,	/* mixer change noticed -> box write completed */
+	HIST_BOX_WRITE,		/* duration of the write() to the device */
+	HIST_COUNT
+};
+
+/*
+ * counters
+ */
+enum strix_counter {
+	CNT_DEVICE_EVENTS,	/* events read from the device */
+	CNT_MIXER_EVENTS,	/* mixer change notifications */
+	CNT_COALESCED,		/* mixer changes dropped by the debounce */
+	CNT_ECHOES,		/* changes not sent back to where they came from */
+	CNT_BOX_WRITES,		/* commands written to the device */
+	CNT_MIXER_WRITES,	/* volumes written to the mixer */
+	CNT_RECONNECTS,		/* device (re)opened */
+	CNT_ERRORS,		/* failed reads and writes */
+	CNT_COUNT
+};
+
+struct strix_histogram {
+	uint64_t count;
+	uint64_t max;
+	uint64_t bucket[STATS_BUCKETS];
+};
+
+/*
+ * current value of the monotonic clock in nanoseconds
+ */
+uint64_t stats_now(void);
+
+void stats_record(enum strix_hist hist, uint64_t ns);
+void stats_inc(enum strix_counter counter);
+
+/*
+ * current value of a counter
+ */
+uint64_t stats_counter(enum strix_counter counter);
+
+/*
+ * record into a histogram of the caller, e.g. of a benchmark
+ */
+void stats_hist_record(struct strix_histogram *h, uint64_t ns);
+
+/*
+ * value below which the given percentage of the recorded values are
+ */
+uint64_t stats_percentile(const struct strix_histogram *h, double percent);
+
+/*
+ * print all counters and histograms with percentiles
+ */
+void stats_dump(FILE *out);
+
+#endif
@@ -0,0 +1,180 @@
+/*
+ * Status of the strix-daemon in shared memory
+ *
+ * The daemon is the only writer, so the seqlock needs no lock of its own:
+ * seq is made odd, the fields are written, seq is made even again. A reader
+ * copies the fields and retries if seq was odd or changed meanwhile.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "strix-status.h"
+
+static struct strix_status *status = NULL;
+static const char *status_name = NULL;
+
+static long futex(uint32_t *addr, int op, uint32_t val, const struct timespec *timeout)
+{
+	return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+int status_open(const char *name)
+{
+	int fd;
+	void *p;
+
+	//a daemon killed before may have left it behind, start over
+	shm_unlink(name);
+	//widgets of every user may read it
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -1;
+	fchmod(fd, 0644);
+	if (ftruncate(fd, sizeof(struct strix_status)) < 0) {
+		close(fd);
+		shm_unlink(name);
+		return -1;
+	}
+	p = mmap(NULL, sizeof(struct strix_status), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		shm_unlink(name);
+		return -1;
+	}
+
+	status = p;
+	status_name = name;
+	status->output = 0;
+	memset(status->volume, STRIX_STATUS_UNKNOWN, sizeof(status->volume));
+	__atomic_store_n(&status->magic, STRIX_STATUS_MAGIC, __ATOMIC_RELEASE);
+	return 0;
+}
+
+void status_publish(const struct strix_status_data *data)
+{
+	uint32_t seq;
+	struct timespec ts;
+
+	if (status == NULL)
+		return;
+	if (status->flags == data->flags && status->output == data->output
+	    && memcmp(status->volume, data->volume, sizeof(status->volume)) == 0
+	    && status->mute == data->mute)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	seq = status->seq;
+	__atomic_store_n(&status->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	status->flags = data->flags;
+	status->output = data->output;
+	memcpy(status->volume, data->volume, sizeof(status->volume));
+	status->mute = data->mute;
+	status->updated_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	__atomic_store_n(&status->seq, seq + 2, __ATOMIC_RELEASE);
+
+	__atomic_add_fetch(&status->changes, 1, __ATOMIC_RELEASE);
+	futex(&status->changes, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+void status_close(void)
+{
+	if (status == NULL)
+		return;
+	//readers which follow the status attach again to the next daemon
+	__atomic_store_n(&status->magic, 0, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&status->changes, 1, __ATOMIC_RELEASE);
+	futex(&status->changes, FUTEX_WAKE, INT_MAX, NULL);
+	munmap(status, sizeof(*status));
+	shm_unlink(status_name);
+	status = NULL;
+}
+
+const struct strix_status *status_attach(const char *name)
+{
+	struct stat st;
+	int fd;
+	void *p;
+
+	fd = shm_open(name ? name : STRIX_STATUS_NAME, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct strix_status)) {
+		close(fd);
+		errno = ENODATA;
+		return NULL;
+	}
+	p = mmap(NULL, sizeof(struct strix_status), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return NULL;
+	if (__atomic_load_n(&((struct strix_status *)p)->magic, __ATOMIC_ACQUIRE) != STRIX_STATUS_MAGIC) {
+		munmap(p, sizeof(struct strix_status));
+		errno = ENODATA;
+		return NULL;
+	}
+	return p;
+}
+
+void status_detach(const struct strix_status *st)
+{
+	munmap((void *)st, sizeof(*st));
+}
+
+int status_valid(const struct strix_status *st)
+{
+	return __atomic_load_n(&st->magic, __ATOMIC_ACQUIRE) == STRIX_STATUS_MAGIC;
+}
+
+uint32_t status_read(const struct strix_status *st, struct strix_status_data *data)
+{
+	uint32_t seq, changes;
+
+	do {
+		changes = __atomic_load_n(&st->changes, __ATOMIC_ACQUIRE);
+		seq = __atomic_load_n(&st->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		data->flags = st->flags;
+		data->output = st->output;
+		memcpy(data->volume, (const void *)st->volume, sizeof(data->volume));
+		data->mute = st->mute;
+		data->updated_ns = st->updated_ns;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || __atomic_load_n(&st->seq, __ATOMIC_RELAXED) != seq);
+
+	return changes;
+}
+
+int status_wait(const struct strix_status *st, uint32_t changes, int timeout_ms)
+{
+	struct timespec ts, *tsp = NULL;
+
+	if (timeout_ms >= 0) {
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+		tsp = &ts;
+	}
+	//returns at once if the counter moved on already
+	while (__atomic_load_n(&st->changes, __ATOMIC_ACQUIRE) == changes) {
+		if (futex((uint32_t *)&st->changes, FUTEX_WAIT, changes, tsp) < 0
+		    && errno != EAGAIN)
+			return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * Status of the strix-daemon in shared memory
+ *
+ * The daemon publishes the active output, the volume and mute state of both
+ * outputs and whether the box is connected in the POSIX shared memory object
+ * STRIX_STATUS_NAME (/dev/shm/strixdlx-status). Status bars map it read-only
+ * and read it without any system call or socket; the fields are protected by
+ * a seqlock, a reader retries while the daemon writes.
+ *
+ * Every change increments `changes` after the new state is complete and
+ * wakes the readers sleeping on this word with FUTEX_WAIT, so a widget can
+ * block until the next change instead of polling.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#ifndef STRIX_STATUS_H
+#define STRIX_STATUS_H
+
+#include <stdint.h>
+
+#define STRIX_STATUS_NAME	"/strixdlx-status"
+#define STRIX_STATUS_MAGIC	0x53545831	/* "STX1" */
+
+#define STRIX_STATUS_OUTPUTS	2	/* 0 = speaker, 1 = headphone */
+#define STRIX_STATUS_UNKNOWN	0xff	/* volume not known yet */
+
+#define STRIX_STATUS_CONNECTED	(1 << 0)	/* control box is present */
+#define STRIX_STATUS_SEPARATE	(1 << 1)	/* every output has its own mixer element */
+
+struct strix_status {
+	uint32_t magic;		/* STRIX_STATUS_MAGIC once the daemon set it up */
+	uint32_t seq;		/* seqlock, odd while the daemon writes */
+	uint32_t changes;	/* futex word, incremented after every change */
+
+	/* protected by seq */
+	uint8_t flags;		/* STRIX_STATUS_* */
+	uint8_t output;		/* active output */
+	uint8_t volume[STRIX_STATUS_OUTPUTS];	/* percent or STRIX_STATUS_UNKNOWN */
+	uint8_t mute;		/* bit per output */
+	uint8_t reserved[3];
+	uint64_t updated_ns;	/* CLOCK_MONOTONIC of the last change */
+};
+
+/*
+ * snapshot of the protected fields
+ */
+struct strix_status_data {
+	uint8_t flags;
+	uint8_t output;
+	uint8_t volume[STRIX_STATUS_OUTPUTS];
+	uint8_t mute;
+	uint64_t updated_ns;
+};
+
+/*
+ * daemon: create (or take over) the object, returns 0 on success
+ */
+int status_open(const char *name);
+
+/*
+ * daemon: publish a new state, does nothing if it did not change
+ */
+void status_publish(const struct strix_status_data *data);
+
+/*
+ * daemon: unmap and remove the object
+ */
+void status_close(void);
+
+/*
+ * reader: map the object read-only, NULL with errno set on error
+ */
+const struct strix_status *status_attach(const char *name);
+
+/*
+ * reader: unmap the object
+ */
+void status_detach(const struct strix_status *st);
+
+/*
+ * reader: 0 once the daemon removed the object, attach again to follow the next one
+ */
+int status_valid(const struct strix_status *st);
+
+/*
+ * reader: consistent copy of the state, returns the change counter it belongs to
+ */
+uint32_t status_read(const struct strix_status *st, struct strix_status_data *data);
+
+/*
+ * reader: sleep until the change counter differs from changes, timeout_ms < 0
+ * waits forever; returns 0 on a change, -1 on timeout or signal
+ */
+int status_wait(const struct strix_status *st, uint32_t changes, int timeout_ms);
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * systemd integration of the strix-daemon
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "strix-systemd.h"
+
+int systemd_notify(const char *state)
+{
+	struct sockaddr_un addr;
+	const char *path = getenv("NOTIFY_SOCKET");
+	socklen_t len;
+	ssize_t n;
+	int fd;
+
+	//a path or an abstract socket starting with '@'
+	if (path == NULL || (path[0] != '/' && path[0] != '@'))
+		return 0;
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -1;
+
+	fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if (addr.sun_path[0] == '@')
+		addr.sun_path[0] = '\0';
+	len = offsetof(struct sockaddr_un, sun_path) + strlen(path);
+
+	n = sendto(fd, state, strlen(state), MSG_NOSIGNAL, (struct sockaddr *)&addr, len);
+	close(fd);
+	return n < 0 ? -1 : 1;
+}
+
+int systemd_listen_fd(void)
+{
+	const char *pid = getenv("LISTEN_PID");
+	const char *fds = getenv("LISTEN_FDS");
+	int fd = -1;
+
+	//the variables may have been inherited from a parent which was activated
+	if (pid != NULL && fds != NULL && atol(pid) == (long)getpid() && atoi(fds) >= 1) {
+		fd = SYSTEMD_LISTEN_FDS_START;
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+
+	unsetenv("LISTEN_PID");
+	unsetenv("LISTEN_FDS");
+	unsetenv("LISTEN_FDNAMES");
+	return fd;
+}
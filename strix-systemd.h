@@ -0,0 +1,33 @@
+/*
+ * systemd integration of the strix-daemon
+ *
+ * The two parts of the protocol the daemon needs, without linking
+ * libsystemd: readiness notification (sd_notify(3), the datagram socket in
+ * $NOTIFY_SOCKET) and socket activation (sd_listen_fds(3), descriptors
+ * passed from 3 on with $LISTEN_FDS and $LISTEN_PID).
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#ifndef STRIX_SYSTEMD_H
+#define STRIX_SYSTEMD_H
+
+//first descriptor passed by socket activation
+#define SYSTEMD_LISTEN_FDS_START	3
+
+/*
+ * send a state ("READY=1\nSTATUS=...") to the service manager,
+ * returns 1 if sent, 0 if not started by systemd, -1 on error
+ */
+int systemd_notify(const char *state);
+
+/*
+ * listening socket passed by socket activation, -1 if there is none;
+ * clears the environment so children do not take it as theirs
+ */
+int systemd_listen_fd(void);
+
+#endif
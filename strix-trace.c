@@ -0,0 +1,146 @@
+/*
+ * Event trace of the strix-daemon
+ *
+ * Records are collected in a buffer and written out when it is full, so
+ * tracing costs a lock and a copy per record and no system call.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "strix-trace.h"
+#include "strix-stats.h"
+
+#define TRACE_BUFFER_RECORDS	512
+
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int trace_fd = -1;
+static struct strix_trace_record buffer[TRACE_BUFFER_RECORDS];
+static int buffered;
+
+static const char *type_names[TRACE_TYPES] = {
+	[TRACE_DEVICE_EVENT] = "device event",
+	[TRACE_MIXER_NOTIFY] = "mixer notify",
+	[TRACE_CLIENT_VOLUME] = "client volume",
+	[TRACE_CLIENT_OUTPUT] = "client output",
+	[TRACE_MIXER_WRITE] = "mixer write",
+	[TRACE_BOX_WRITE] = "box write",
+	[TRACE_COALESCED] = "coalesced",
+	[TRACE_ECHO] = "echo",
+};
+
+/**
+ * \brief Write out the buffer, called with trace_mutex held
+ */
+static void trace_flush(void)
+{
+	const char *p = (const char *)buffer;
+	size_t left = buffered * sizeof(buffer[0]);
+	ssize_t n;
+
+	while (left > 0) {
+		n = write(trace_fd, p, left);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		p += n;
+		left -= n;
+	}
+	buffered = 0;
+}
+
+int trace_open(const char *path)
+{
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -1;
+	if (write(fd, STRIX_TRACE_MAGIC, STRIX_TRACE_MAGIC_SIZE) != STRIX_TRACE_MAGIC_SIZE) {
+		close(fd);
+		return -1;
+	}
+
+	pthread_mutex_lock(&trace_mutex);
+	trace_fd = fd;
+	buffered = 0;
+	pthread_mutex_unlock(&trace_mutex);
+	return 0;
+}
+
+void trace_record(enum strix_trace_type type, int output, int value, int flags)
+{
+	struct strix_trace_record *rec;
+
+	//no trace, the usual case
+	if (__atomic_load_n(&trace_fd, __ATOMIC_RELAXED) < 0)
+		return;
+
+	pthread_mutex_lock(&trace_mutex);
+	if (trace_fd >= 0) {
+		rec = &buffer[buffered++];
+		rec->ns = stats_now();
+		rec->type = type;
+		rec->output = output < 0 ? 0 : output;
+		rec->value = value;
+		rec->flags = flags;
+		if (buffered == TRACE_BUFFER_RECORDS)
+			trace_flush();
+	}
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+void trace_close(void)
+{
+	pthread_mutex_lock(&trace_mutex);
+	if (trace_fd >= 0) {
+		trace_flush();
+		close(trace_fd);
+		trace_fd = -1;
+	}
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+FILE *trace_read_open(const char *path)
+{
+	char magic[STRIX_TRACE_MAGIC_SIZE];
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (f == NULL)
+		return NULL;
+	if (fread(magic, sizeof(magic), 1, f) != 1
+	    || memcmp(magic, STRIX_TRACE_MAGIC, sizeof(magic)) != 0) {
+		fclose(f);
+		errno = EINVAL;
+		return NULL;
+	}
+	return f;
+}
+
+int trace_read(FILE *f, struct strix_trace_record *rec)
+{
+	while (fread(rec, sizeof(*rec), 1, f) == 1) {
+		//skip records of newer versions
+		if (rec->type < TRACE_TYPES)
+			return 0;
+	}
+	return -1;
+}
+
+const char *trace_type_name(int type)
+{
+	if (type < 0 || type >= TRACE_TYPES)
+		return "unknown";
+	return type_names[type];
+}
@@ -0,0 +1,82 @@
+/*
+ * Event trace of the strix-daemon
+ *
+ * With --trace the daemon records every input (device event, mixer
+ * notification, client command) and every resulting action (mixer write,
+ * box command, coalesced or suppressed update) with its CLOCK_MONOTONIC
+ * timestamp. --replay feeds the inputs of such a trace back into the daemon
+ * with a mock device and the null backend.
+ *
+ * The file starts with STRIX_TRACE_MAGIC, followed by fixed size records in
+ * host byte order.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#ifndef STRIX_TRACE_H
+#define STRIX_TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define STRIX_TRACE_MAGIC	"STRIXTR1"
+#define STRIX_TRACE_MAGIC_SIZE	8
+
+/*
+ * record types, inputs first
+ */
+enum strix_trace_type {
+	TRACE_DEVICE_EVENT,	/* event read from the device: value, output, flags = event */
+	TRACE_MIXER_NOTIFY,	/* mixer notification: value = mixer volume */
+	TRACE_CLIENT_VOLUME,	/* client sets the volume: value */
+	TRACE_CLIENT_OUTPUT,	/* client switches the output: output */
+	TRACE_INPUTS,
+	TRACE_MIXER_WRITE = TRACE_INPUTS,	/* mixer set to value */
+	TRACE_BOX_WRITE,	/* command byte value sent to the box */
+	TRACE_COALESCED,	/* mixer change value replaced a pending one */
+	TRACE_ECHO,		/* update with value suppressed, the box shows it */
+	TRACE_TYPES
+};
+
+struct strix_trace_record {
+	uint64_t ns;		/* CLOCK_MONOTONIC */
+	uint8_t type;		/* enum strix_trace_type */
+	uint8_t output;
+	uint8_t value;
+	uint8_t flags;
+} __attribute__((packed));
+
+/*
+ * start recording into a new file, returns 0 on success
+ */
+int trace_open(const char *path);
+
+/*
+ * add a record, does nothing if no trace is open; may be called from any thread
+ */
+void trace_record(enum strix_trace_type type, int output, int value, int flags);
+
+/*
+ * write out the buffered records and close the file
+ */
+void trace_close(void);
+
+/*
+ * open a trace for reading, NULL with errno set if it is no trace
+ */
+FILE *trace_read_open(const char *path);
+
+/*
+ * next record, returns 0 or -1 at the end of the trace
+ */
+int trace_read(FILE *f, struct strix_trace_record *rec);
+
+/*
+ * name of a record type for messages
+ */
+const char *trace_type_name(int type);
+
+#endif
@@ -0,0 +1,333 @@
+/*
+ * Protocol of the ASUS Strix Raid DLX control box and of /dev/strixdlx
+ *
+ * Shared by the kernel module and the userspace programs: the USB side (ids,
+ * control requests, led frames, interrupt reports) and the device side (the
+ * event lines read() returns and the command bytes write() takes).
+ * Everything here is constant or a pure function, see strixdlx.c for the
+ * description of the messages.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#ifndef STRIXDLX_PROTO_H
+#define STRIXDLX_PROTO_H
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/types.h>
+#else
+#include <stdio.h>
+#include <string.h>
+#include <linux/types.h>
+#endif
+
+/*
+ * ******	USB side	******
+ */
+
+/*
+ * Asus STRIX Raid DLX Device ID, the control box is interface 4
+ */
+#define STRIXDLX_VENDOR_ID	0x0B05
+#define STRIXDLX_PRODUCT_ID	0x180C
+#define STRIXDLX_INTERFACE	4
+
+/*
+ * values for the urb control message for switching the relay between headphone
+ * and speaker
+ */
+#define STRIXDLX_CTRL_BUFFER_SIZE 	2
+#define STRIXDLX_CTRL_REQUEST_TYPE	0x21
+#define STRIXDLX_CTRL_REQUEST		0x01
+#define STRIXDLX_CTRL_VALUE		0x0800
+#define STRIXDLX_CTRL_INDEX		0x0700
+
+/*
+ * values for the urb control message for setting the sound leds
+ */
+#define STRIXDLX_CTRL_VOLUME_BUFFER_SIZE 	16
+#define STRIXDLX_CTRL_VOLUME_REQUEST_TYPE	0x21
+#define STRIXDLX_CTRL_VOLUME_REQUEST	0x09
+#define STRIXDLX_CTRL_VOLUME_VALUE		0x0200
+#define STRIXDLX_CTRL_VOLUME_INDEX		0x0004
+
+/*
+ * urb data array for setting the volume to max (all led on)
+ */
+static const __u8 STRIXDLX_VOLUME_SPEAKER[] = {0x09, 0xc5, 0x2d, 0x00, 0x04, 0x03, 0x08, 0xff, 0x1f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+static const __u8 STRIXDLX_VOLUME_HEADPHONE[] = {0x09, 0xc5, 0x27, 0x00, 0x04, 0x03, 0x02, 0xff, 0x1f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+
+/*
+ * urb data array for switching relay between speaker and headphone
+ */
+static const __u8 STRIXDLX_DATA_SPEAKER[] = {0x01, 0x03 };
+static const __u8 STRIXDLX_DATA_HEADPHONE[] = {0x02, 0x03 };
+
+/*
+ * volume leds on the panel, bytes 7 (led 1-8) and 8 (led 9-13) of the led frame
+ */
+#define STRIXDLX_LEDS		13
+
+/*
+ * interrupt reports of the control box, see strixdlx_decode_report()
+ */
+#define STRIXDLX_REPORT_SIZE	16
+#define STRIXDLX_REPORT_NONE	0	/* unknown or unexpected */
+#define STRIXDLX_REPORT_HELLO	1	/* 01 c5: an action report follows */
+#define STRIXDLX_REPORT_ACK	2	/* 05 05 xx 03: box accepted our message */
+#define STRIXDLX_REPORT_UP	3	/* 05 05 xx 01: knob turned up */
+#define STRIXDLX_REPORT_DOWN	4	/* 05 06 xx 01: knob turned down */
+#define STRIXDLX_REPORT_UNINIT	5	/* 05 04: box not initialised */
+#define STRIXDLX_REPORT_SWITCH	6	/* 05 03: big button, switch output */
+#define STRIXDLX_REPORT_SONIC	7	/* 05 02: sonic button */
+
+/*
+ * volume change per knob step
+ */
+#define STRIXDLX_KNOB_STEP	3
+
+/*
+ * lowest volume for 1, 2, ... 13 volume leds
+ */
+static const __u8 STRIXDLX_LED_THRESHOLD[STRIXDLX_LEDS] = {1, 8, 15, 22, 29, 36, 43, 51, 60, 68, 76, 84, 92};
+
+/*
+ * Number of volume leds shown for a volume of 0-100
+ */
+static inline int strixdlx_volume_leds(int volume)
+{
+	int leds = 0;
+
+	while (leds < STRIXDLX_LEDS && volume >= STRIXDLX_LED_THRESHOLD[leds])
+		leds++;
+	return leds;
+}
+
+/*
+ * Build the 16 byte led frame for an output and a volume
+ * Byte 2 is the sum of the bytes 3-15, the tables in strixdlx.c are
+ * generated by exactly this.
+ * int control: 0 if speaker, 1 if headphone
+ */
+static inline void strixdlx_volume_frame(__u8 *buf, int control, int volume)
+{
+	unsigned int mask = (1 << strixdlx_volume_leds(volume)) - 1;
+	__u8 sum = 0;
+	int i;
+
+	memcpy(buf, control == 1 ? STRIXDLX_VOLUME_HEADPHONE : STRIXDLX_VOLUME_SPEAKER,
+			STRIXDLX_CTRL_VOLUME_BUFFER_SIZE);
+	buf[7] = mask & 0xff;
+	buf[8] = mask >> 8;
+
+	for (i = 3; i < STRIXDLX_CTRL_VOLUME_BUFFER_SIZE; i++)
+		sum += buf[i];
+	buf[2] = sum;
+}
+
+/*
+ * New volume after one knob step, the knob moves in 3% steps within 0-100
+ */
+static inline int strixdlx_step_volume(int volume, int step)
+{
+	volume += step;
+	if (volume > 100)
+		return 100;
+	if (volume < 0)
+		return 0;
+	return volume;
+}
+
+/*
+ * New volume after the sonic button: a mute for the poor man
+ */
+static inline int strixdlx_sonic_volume(int volume)
+{
+	return volume > 0 ? 0 : 100;
+}
+
+/*
+ * What an interrupt report of the control box means
+ * The box sends a "hello" (01 c5) before every action report (05 xx),
+ * int registered: a hello was seen and the action report is expected
+ */
+static inline int strixdlx_decode_report(const __u8 *data, int registered)
+{
+	if (!registered)
+		return (data[0] == 0x01 && data[1] == 0xc5) ? STRIXDLX_REPORT_HELLO : STRIXDLX_REPORT_NONE;
+
+	if (data[0] != 0x05)
+		return STRIXDLX_REPORT_NONE;
+
+	switch (data[1]) {
+	case 0x05:
+		if (data[3] == 0x03)
+			return STRIXDLX_REPORT_ACK;
+		if (data[3] == 0x01)
+			return STRIXDLX_REPORT_UP;
+		break;
+	case 0x06:
+		if (data[3] == 0x01)
+			return STRIXDLX_REPORT_DOWN;
+		break;
+	case 0x04:
+		return STRIXDLX_REPORT_UNINIT;
+	case 0x03:
+		return STRIXDLX_REPORT_SWITCH;
+	case 0x02:
+		return STRIXDLX_REPORT_SONIC;
+	}
+	return STRIXDLX_REPORT_NONE;
+}
+
+/*
+ * Registration state for the next report, after the driver handled one
+ * A hello registers, the ack and every action the driver answered end the
+ * registration. An unknown report changes nothing, neither does an action
+ * whose led frame or relay request could not be sent: the next report of
+ * the box is taken as action again.
+ * int kind: STRIXDLX_REPORT_* of strixdlx_decode_report()
+ * int sent: the answer to an action went out
+ */
+static inline int strixdlx_next_registered(int registered, int kind, int sent)
+{
+	switch (kind) {
+	case STRIXDLX_REPORT_HELLO:
+		return 1;
+	case STRIXDLX_REPORT_ACK:
+		return 0;
+	case STRIXDLX_REPORT_UP:
+	case STRIXDLX_REPORT_DOWN:
+	case STRIXDLX_REPORT_SWITCH:
+	case STRIXDLX_REPORT_SONIC:
+		return sent ? 0 : registered;
+	}
+	return registered;
+}
+
+/*
+ * ******	Device side	******
+ */
+
+/*
+ * messages for the userspace program
+ * Every read returns one line "<volume> <output> <event> <seq>". The volume
+ * (0-100) is the one of the active output, output is 0 for speaker and 1 for
+ * headphone. seq counts the events of the device, a gap means missed events.
+ */
+#define STRIXDLX_EVENT_VOLUME	0	/* volume changed by knob or write() */
+#define STRIXDLX_EVENT_OUTPUT	1	/* relay switched to the other output */
+#define STRIXDLX_EVENT_SONIC	2	/* sonic button pressed */
+#define STRIXDLX_EVENT_INIT	3	/* device probed */
+
+/* longest event line including the terminating 0 */
+#define STRIXDLX_EVENT_LINE_SIZE	32
+
+/*
+ * commands of the userspace program, written as one byte
+ * 0 - 100 sets the volume of the active output
+ */
+#define STRIXDLX_CMD_SPEAKER	0x80	/* switch relay to speaker */
+#define STRIXDLX_CMD_HEADPHONE	0x81	/* switch relay to headphone */
+
+/*
+ * two byte commands {0x82 | output, volume}: set the volume of one output,
+ * the leds only change if it is the active one
+ */
+#define STRIXDLX_CMD_VOLUME_SPEAKER	0x82
+#define STRIXDLX_CMD_VOLUME_HEADPHONE	0x83
+#define STRIXDLX_CMD_MAX_SIZE		2
+
+/*
+ * generic netlink family: every event is also multicast to the group
+ * STRIXDLX_GENL_MCGRP, for listeners which do not hold the device open
+ * One message STRIXDLX_GENL_CMD_EVENT per event with the attributes below.
+ */
+#define STRIXDLX_GENL_NAME		"strixdlx"
+#define STRIXDLX_GENL_VERSION		1
+#define STRIXDLX_GENL_MCGRP		"events"
+
+#define STRIXDLX_GENL_CMD_UNSPEC	0
+#define STRIXDLX_GENL_CMD_EVENT		1
+
+#define STRIXDLX_GENL_A_UNSPEC		0
+#define STRIXDLX_GENL_A_DEVICE		1	/* u32: N of /dev/strixdlxN */
+#define STRIXDLX_GENL_A_EVENT		2	/* u8: STRIXDLX_EVENT_* */
+#define STRIXDLX_GENL_A_OUTPUT		3	/* u8: 0 = speaker, 1 = headphone */
+#define STRIXDLX_GENL_A_VOLUME		4	/* u8: 0-100, of the active output */
+#define STRIXDLX_GENL_A_SEQ		5	/* u32: sequence number, as in the event line */
+#define STRIXDLX_GENL_A_TIMESTAMP	6	/* u64: CLOCK_MONOTONIC in ns */
+#define STRIXDLX_GENL_A_PAD		7	/* alignment of the u64 */
+#define STRIXDLX_GENL_A_MAX		7
+
+struct strixdlx_event {
+	int volume;		/* 0-100, of the active output */
+	int output;		/* 0 = speaker, 1 = headphone, -1 if not known */
+	int event;		/* STRIXDLX_EVENT_* */
+	unsigned int seq;	/* sequence number, 0 if the module does not send it */
+};
+
+/*
+ * Format an event line, returns its length
+ */
+static inline int strixdlx_format_event(char *buf, size_t size, const struct strixdlx_event *ev)
+{
+	return snprintf(buf, size, "%d %d %d %u\n", ev->volume, ev->output, ev->event, ev->seq);
+}
+
+/*
+ * Parse one event line, output, event and seq may be missing
+ * Stops at the end of the line, returns 0 or -1 if it is no event line.
+ */
+static inline int strixdlx_parse_event(const char *line, struct strixdlx_event *ev)
+{
+	char buf[STRIXDLX_EVENT_LINE_SIZE];
+	size_t len = strcspn(line, "\n");
+
+	if (len >= sizeof(buf))
+		return -1;
+	memcpy(buf, line, len);
+	buf[len] = '\0';
+
+	ev->output = -1;
+	ev->event = STRIXDLX_EVENT_VOLUME;
+	ev->seq = 0;
+	if (sscanf(buf, "%d %d %d %u", &ev->volume, &ev->output, &ev->event, &ev->seq) < 1)
+		return -1;
+	if (ev->volume < 0 || ev->volume > 100)
+		return -1;
+	return 0;
+}
+
+/*
+ * Command byte for a volume of 0-100
+ */
+static inline __u8 strixdlx_volume_cmd(int volume)
+{
+	return volume < 0 ? 0 : volume > 100 ? 100 : volume;
+}
+
+/*
+ * Command byte for an output, 0 = speaker, 1 = headphone
+ */
+static inline __u8 strixdlx_output_cmd(int output)
+{
+	return output ? STRIXDLX_CMD_HEADPHONE : STRIXDLX_CMD_SPEAKER;
+}
+
+/*
+ * Two byte command setting the volume of one output, returns its length
+ */
+static inline int strixdlx_output_volume_cmd(__u8 *buf, int output, int volume)
+{
+	buf[0] = output ? STRIXDLX_CMD_VOLUME_HEADPHONE : STRIXDLX_CMD_VOLUME_SPEAKER;
+	buf[1] = strixdlx_volume_cmd(volume);
+	return 2;
+}
+
+#endif
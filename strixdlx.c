@@ -94,6 +94,7 @@
  * 
  * Byte 7 is used for the speaker/headphone led (0x02 = headphone, 0x08 = speaker)
  * Bytes 3, 8 and 9 represent the state of the volume control, how many leds are on.
+ * Byte 3 is the sum of bytes 4-16 (truncated to 8 bit), bytes 8 and 9 are the led mask.
  * 
  * Full table for headphone (from zero led to 13)
  * 
@@ -129,7 +130,31 @@
  * 09 c5 1d 00 04 03 08 ff 0f 00 00 00 00 00 00 00
  * 09 c5 2d 00 04 03 08 ff 1f 00 00 00 00 00 00 00	- speaker led on, all 13 volume leds on
  * 
+ * ******	Userspace part	******
  * 
+ * Every control box is its own /dev/strixdlxN (N counts the boxes, other usbmisc
+ * drivers like usblp take minors from the same pool) with its
+ * own event slot, wait queue and counters, so boxes never wake the readers of
+ * each other. The udev rule adds stable links by usb port and /dev/strixdlx
+ * for the first box.
+ * 
+ * read() returns one line "<volume> <output> <event> <seq>" for the last thing that
+ * happened: volume 0-100 of the active output, output 0 = speaker, 1 = headphone,
+ * event 0 = volume, 1 = output switched, 2 = sonic button, 3 = device probed.
+ * Every open file has its own cursor: it gets the last event once, a file
+ * opened afterwards gets it too, so a short-lived reader takes nothing away
+ * from the daemon and learns the current state with its first read. It
+ * returns 0 until the next event.
+ * A file opened before the box was unplugged gets POLLHUP and -ENODEV, the
+ * device is freed with the last file.
+ * 
+ * Every event is also multicast with generic netlink (family "strixdlx",
+ * group "events", see strixdlx-proto.h) to listeners which do not open the
+ * device at all.
+ * 
+ * write() takes one byte: 0-100 sets the volume of the active output,
+ * 0x80 switches to speaker and 0x81 to headphone. Two bytes 0x82 (speaker)
+ * or 0x83 (headphone) followed by 0-100 set the volume of that output only.
  * 
  */
 
@@ -138,12 +163,17 @@
 
 #include <linux/slab.h>			/* kmalloc() */
 #include <linux/usb.h>			/* USB stuff */
-#include <linux/mutex.h>		/* mutexes */
+#include <linux/kref.h>
+#include <linux/xarray.h>		/* boxes by minor */
 #include <linux/ioctl.h>
 
 #include <linux/uaccess.h>		/* copy_*_user */
 #include <linux/poll.h>			/* polling */
 #include <linux/wait.h>			/* wait queue */
+#include <linux/ktime.h>
+#include <net/genetlink.h>		/* event multicast */
+
+#include "strixdlx-proto.h"		/* protocol shared with userspace */
 
 
 #define DEBUG_LEVEL_DEBUG		0x1F
@@ -177,47 +207,22 @@ if ((debug_level & DEBUG_LEVEL_CRITICAL) == DEBUG_LEVEL_CRITICAL) \
 			__FUNCTION__, __LINE__, ## args)
 
 
-/*
- * Asus STRIX Raid DLX Device ID
- */
-#define STRIXDLX_VENDOR_ID	0x0B05
-#define STRIXDLX_PRODUCT_ID	0x180C
-
-/*
- * values for the urb control message for switching the relay between headphone 
- * and speaker
- */
-#define STRIXDLX_CTRL_BUFFER_SIZE 	2
-#define STRIXDLX_CTRL_REQUEST_TYPE	0x21
-#define STRIXDLX_CTRL_REQUEST		0x01
-#define STRIXDLX_CTRL_VALUE		0x0800
-#define STRIXDLX_CTRL_INDEX		0x0700
-
-/*
- * values for the urb control message for setting the sound leds
- */
-#define STRIXDLX_CTRL_VOLUME_BUFFER_SIZE 	16
-#define STRIXDLX_CTRL_VOLUME_REQUEST_TYPE	0x21
-#define STRIXDLX_CTRL_VOLUME_REQUEST	0x09
-#define STRIXDLX_CTRL_VOLUME_VALUE		0x0200
-#define STRIXDLX_CTRL_VOLUME_INDEX		0x0004
+#define STRIXDLX_MINOR_BASE	0
 
-/*
- * urb data array for setting the volume to max (all led on)
- */
-const u8 STRIXDLX_VOLUME_SPEAKER[] = {0x09, 0xc5, 0x2d, 0x00, 0x04, 0x03, 0x08, 0xff, 0x1f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
-const u8 STRIXDLX_VOLUME_HEADPHONE[] = {0x09, 0xc5, 0x27, 0x00, 0x04, 0x03, 0x02, 0xff, 0x1f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
 
 /*
- * urb data array for switching relay between speaker and headphone
+ * counters for benchmarks, shown in the sysfs attribute "stats" of the interface
  */
-const u8 STRIXDLX_DATA_SPEAKER[] = {0x01, 0x03 };
-const u8 STRIXDLX_DATA_HEADPHONE[] = {0x02, 0x03 };
-
-
-
-#define STRIXDLX_MINOR_BASE	0
-
+struct strixdlx_stats {
+	atomic_t	commands;	/* commands accepted by write() */
+	atomic_t	rejected;	/* commands refused by write() */
+	atomic_t	relay_urbs;	/* relay control messages submitted */
+	atomic_t	volume_urbs;	/* led control messages submitted */
+	atomic_t	urb_errors;	/* failed submits, e.g. urb still in flight */
+	atomic_t	events;		/* events for the userspace program */
+	atomic_t	sem_contended;	/* write() had to wait for the device lock */
+	atomic_t	multicasts;	/* events sent to netlink listeners */
+};
 
 /*
  * structure to hold all data
@@ -225,42 +230,57 @@ const u8 STRIXDLX_DATA_HEADPHONE[] = {0x02, 0x03 };
 struct strixdlx_usb{
 	struct usb_device 	*udev;
 	struct usb_interface 	*interface;
+	struct usb_device	*dma_dev;	/* referenced until the coherent buffers are freed */
 	unsigned char		minor;
+	int			index;		/* N of /dev/strixdlxN */
+	char			name[16];	/* strixdlxN */
+	struct usb_class_driver	class;		/* strixdlx_class with the name of this box */
 	
-	int				open_count;     /* count how often a program is connected */
+	struct kref		kref;		/* the interface and every open file */
+	struct rcu_head		rcu;		/* open() may still look at it after the last put */
 	struct 			semaphore sem;	/* Locks this structure */
 	spinlock_t		ctrl_spinlock;	/* lock for ctrl_volume_buffer  */
-	spinlock_t		volume_spinlock;
+	spinlock_t		volume_spinlock;	/* lock for the volumes, the interrupt callback changes them */
+	spinlock_t		event_spinlock;	/* lock for readbuf and event_seq, the urb callbacks notify too */
 
 	char				*int_in_buffer;
+	dma_addr_t			int_in_dma;
+	int				int_in_size;
 	struct usb_endpoint_descriptor  *int_in_endpoint;
 	struct urb 			*int_in_urb;
 	int				int_in_running;
 
 	char			*ctrl_buffer; /* 2 byte buffer for switch control message */
+	dma_addr_t		ctrl_dma;
 	struct urb		*ctrl_urb;	  /* ctrl urb for relay control */	
 	struct usb_ctrlrequest  *ctrl_dr;     /* Setup packet information for control message*/
 	
 	char			*ctrl_volume_buffer; /* 16 byte buffer for volume control message */
+	dma_addr_t		ctrl_volume_dma;
 	struct urb		*ctrl_volume_urb;	  /* ctrl urb for volume control */	
 	struct usb_ctrlrequest  *ctrl_volume_dr;     /* Setup packet information for volume message*/
 
 	int 			box_int_registered; /* contains if box control box has send an interrupt */
 	int 			control_setting; /* switch status: speaker = 0, headphone = 1 */
 
-	char			readbuf[16];	/* read buffer for messages from userspace program */
+	char			readbuf[STRIXDLX_EVENT_LINE_SIZE];	/* read buffer for messages from userspace program */
 	size_t			readbuflen;		/* buffer length of readbuf */
 
 	int				volume_speaker; /* volume of speaker: 0-100 */
 	int				volume_headphone; /* volume of headphone: 0 -100 */
 
-	
+	u32			event_seq;	/* sequence number of the last event */
+	wait_queue_head_t	waitqueue;	/* readers of this device wait here for an event */
+	struct strixdlx_stats	stats;
 };
 
 /*
- * waiting queue for userspace program
+ * state of one open file
  */
-static wait_queue_head_t waitqueue;
+struct strixdlx_file {
+	struct strixdlx_usb	*dev;
+	u32			event_seq;	/* sequence number of the last event read */
+};
 
 /*
  * driver id table
@@ -282,12 +302,17 @@ module_param(debug_trace, int, S_IRUGO | S_IWUSR);
 MODULE_PARM_DESC(debug_level, "debug level (bitmask)");
 MODULE_PARM_DESC(debug_trace, "enable function tracing");
 
-/* Prevent races between open() and disconnect */
-static DEFINE_MUTEX(disconnect_mutex);
 /*
- * stuct usb driver
+ * probed boxes by usb minor, open() looks them up under rcu without a lock
+ * A box is in here from usb_register_dev() until disconnect() and holds a
+ * reference of its own while it is.
+ */
+static DEFINE_XARRAY(strixdlx_devices);
+
+/*
+ * N of /dev/strixdlxN, the first box is strixdlx0 whatever else holds a usb minor
  */
-static struct usb_driver strixdlx_driver;
+static DEFINE_IDA(strixdlx_ida);
 
 /*
  *	printout for urb data
@@ -313,177 +338,16 @@ static inline void strixdlx_debug_data(const char *function, int size,
  */
 static void SetVolume(struct strixdlx_usb *dev, int control){
 
-	int i;
-	u8 buf_volume[16];
+	u8 buf_volume[STRIXDLX_CTRL_VOLUME_BUFFER_SIZE];
+	unsigned long flags;
 
-	if (control == 1 ) {
-		// fill out the complete array
-		for (i = 0; i<16; i++ ) {
-        	buf_volume[i] = STRIXDLX_VOLUME_HEADPHONE[i];
-		}
-		// check volume and modify bytes 2, 7 and 9. All other bytes are already set correctly
-		if (dev->volume_headphone == 0) {
-			buf_volume[2] = 0x09;
-			buf_volume[7] = 0x00;
-			buf_volume[8] = 0x00;
-		}
-		else if (dev->volume_headphone > 0 && dev->volume_headphone < 8) {
-			buf_volume[2] = 0x0a;
-			buf_volume[7] = 0x01;
-			buf_volume[8] = 0x00;
-		}
-		else if (dev->volume_headphone > 7 && dev->volume_headphone < 15) {
-			buf_volume[2] = 0x0c;
-			buf_volume[7] = 0x03;
-			buf_volume[8] = 0x00;
-		}
-		else if (dev->volume_headphone > 14 && dev->volume_headphone < 22) {
-			buf_volume[2] = 0x10;
-			buf_volume[7] = 0x07;
-			buf_volume[8] = 0x00;
-		}	
-		else if (dev->volume_headphone > 21 && dev->volume_headphone < 29) {
-			buf_volume[2] = 0x18;
-			buf_volume[7] = 0x0f;
-			buf_volume[8] = 0x00;
-		}
-		else if (dev->volume_headphone > 28 && dev->volume_headphone < 36) {
-			buf_volume[2] = 0x28;
-			buf_volume[7] = 0x1f;
-			buf_volume[8] = 0x00;
-		}
-		else if (dev->volume_headphone > 35 && dev->volume_headphone < 43) {
-			buf_volume[2] = 0x48;
-			buf_volume[7] = 0x3f;
-			buf_volume[8] = 0x00;
-		}
-		else if (dev->volume_headphone > 42 && dev->volume_headphone < 51) {
-			buf_volume[2] = 0x88;
-			buf_volume[7] = 0x7f;
-			buf_volume[8] = 0x00;
-		}
-		else if (dev->volume_headphone > 50 && dev->volume_headphone < 60) {
-			buf_volume[2] = 0x08;
-			buf_volume[7] = 0xff;
-			buf_volume[8] = 0x00;
-		}
-		else if (dev->volume_headphone > 59 && dev->volume_headphone < 68) {
-			buf_volume[2] = 0x09;
-			buf_volume[7] = 0xff;
-			buf_volume[8] = 0x01;
-		}
-		else if (dev->volume_headphone > 67 && dev->volume_headphone < 76) {
-			buf_volume[2] = 0x0b;
-			buf_volume[7] = 0xff;
-			buf_volume[8] = 0x03;
-		}
-		else if (dev->volume_headphone > 75 && dev->volume_headphone < 84) {
-			buf_volume[2] = 0x0f;
-			buf_volume[7] = 0xff;
-			buf_volume[8] = 0x07;
-		}
-		else if (dev->volume_headphone > 83 && dev->volume_headphone < 92) {
-			buf_volume[2] = 0x17;
-			buf_volume[7] = 0xff;
-			buf_volume[8] = 0x0f;
-		}
-		//dev->volume > 91
-		else {
-			buf_volume[2] = 0x27;
-			buf_volume[7] = 0xff;
-			buf_volume[8] = 0x1f;
-		}
-		//lock ctrl_volume_buffer and copy date into it
-		spin_lock(&dev->ctrl_spinlock);
-		memcpy(dev->ctrl_volume_buffer, &buf_volume, 16);
-		spin_unlock(&dev->ctrl_spinlock);
+	strixdlx_volume_frame(buf_volume, control,
+			control == 1 ? dev->volume_headphone : dev->volume_speaker);
 
-
-	}
-	else {
-		// fill out the complete array
-		for (i = 0; i<16; i++ ) {
-            buf_volume[i] = STRIXDLX_VOLUME_SPEAKER[i];
-		}
-		// check volume and modify bytes 2, 7 and 9. All other bytes are already set correctly
-		if (dev->volume_speaker == 0) {
-			buf_volume[2] = 0x0f;
-			buf_volume[7] = 0x00;
-			buf_volume[8] = 0x00;
-		}
-		else if (dev->volume_speaker > 0 && dev->volume_speaker < 8) {
-			buf_volume[2] = 0x10;
-			buf_volume[7] = 0x01;
-			buf_volume[8] = 0x00;
-		}
-		else if (dev->volume_speaker > 7 && dev->volume_speaker < 15) {
-			buf_volume[2] = 0x12;
-			buf_volume[7] = 0x03;
-			buf_volume[8] = 0x00;
-		}
-		else if (dev->volume_speaker > 14 && dev->volume_speaker < 22) {
-			buf_volume[2] = 0x16;
-			buf_volume[7] = 0x07;
-			buf_volume[8] = 0x00;
-		}	
-		else if (dev->volume_speaker > 21 && dev->volume_speaker < 29) {
-			buf_volume[2] = 0x1e;
-			buf_volume[7] = 0x0f;
-			buf_volume[8] = 0x00;
-		}
-		else if (dev->volume_speaker > 28 && dev->volume_speaker < 36) {
-			buf_volume[2] = 0x2e;
-			buf_volume[7] = 0x1f;
-			buf_volume[8] = 0x00;
-		}
-		else if (dev->volume_speaker > 35 && dev->volume_speaker < 43) {
-			buf_volume[2] = 0x4e;
-			buf_volume[7] = 0x3f;
-			buf_volume[8] = 0x00;
-		}
-		else if (dev->volume_speaker > 42 && dev->volume_speaker < 51) {
-			buf_volume[2] = 0x8e;
-			buf_volume[7] = 0x7f;
-			buf_volume[8] = 0x00;
-		}
-		else if (dev->volume_speaker > 50 && dev->volume_speaker < 60) {
-			buf_volume[2] = 0x0e;
-			buf_volume[7] = 0xff;
-			buf_volume[8] = 0x00;
-		}
-		else if (dev->volume_speaker > 59 && dev->volume_speaker < 68) {
-			buf_volume[2] = 0x0f;
-			buf_volume[7] = 0xff;
-			buf_volume[8] = 0x01;
-		}
-		else if (dev->volume_speaker > 67 && dev->volume_speaker < 76) {
-			buf_volume[2] = 0x11;
-			buf_volume[7] = 0xff;
-			buf_volume[8] = 0x03;
-		}
-		else if (dev->volume_speaker > 75 && dev->volume_speaker < 84) {
-			buf_volume[2] = 0x05;
-			buf_volume[7] = 0xff;
-			buf_volume[8] = 0x07;
-		}
-		else if (dev->volume_speaker > 83 && dev->volume_speaker < 92) {
-			buf_volume[2] = 0x1d;
-			buf_volume[7] = 0xff;
-			buf_volume[8] = 0x0f;
-		}
-		//dev->volume > 91
-		else {
-			buf_volume[2] = 0x2d;
-			buf_volume[7] = 0xff;
-			buf_volume[8] = 0x1f;
-		}
-		//lock ctrl_volume_buffer and copy date into it
-		spin_lock(&dev->ctrl_spinlock);
-		memcpy(dev->ctrl_volume_buffer, &buf_volume, 16);
-		spin_unlock(&dev->ctrl_spinlock);
-	}
-
-	
+	//lock ctrl_volume_buffer and copy date into it, write() and the interrupt callback both send
+	spin_lock_irqsave(&dev->ctrl_spinlock, flags);
+	memcpy(dev->ctrl_volume_buffer, &buf_volume, STRIXDLX_CTRL_VOLUME_BUFFER_SIZE);
+	spin_unlock_irqrestore(&dev->ctrl_spinlock, flags);
 }
 
 /*
@@ -495,6 +359,173 @@ static void strixdlx_ctrl_callback(struct urb *urb)
 	
 }
 
+/*
+ * generic netlink family, it has no operations: listeners only join the group
+ */
+static const struct genl_multicast_group strixdlx_genl_mcgrps[] = {
+	{ .name = STRIXDLX_GENL_MCGRP, },
+};
+
+static struct genl_family strixdlx_genl_family __ro_after_init = {
+	.module = THIS_MODULE,
+	.name = STRIXDLX_GENL_NAME,
+	.version = STRIXDLX_GENL_VERSION,
+	.maxattr = STRIXDLX_GENL_A_MAX,
+	.mcgrps = strixdlx_genl_mcgrps,
+	.n_mcgrps = ARRAY_SIZE(strixdlx_genl_mcgrps),
+};
+
+/*
+ * Multicast an event to the netlink listeners
+ * Runs in the urb callback, nothing may sleep. Without a listener no message
+ * is built, a listener too slow to read loses messages in its own socket.
+ */
+static void strixdlx_genl_event(struct strixdlx_usb *dev, const struct strixdlx_event *ev)
+{
+	struct sk_buff *skb;
+	void *hdr;
+
+	if (! genl_has_listeners(&strixdlx_genl_family, &init_net, 0))
+		return;
+
+	skb = genlmsg_new(nla_total_size(sizeof(u32)) * 2 + nla_total_size(sizeof(u8)) * 3
+			+ nla_total_size_64bit(sizeof(u64)), GFP_ATOMIC);
+	if (! skb)
+		return;
+
+	hdr = genlmsg_put(skb, 0, 0, &strixdlx_genl_family, 0, STRIXDLX_GENL_CMD_EVENT);
+	if (! hdr)
+		goto error;
+	if (nla_put_u32(skb, STRIXDLX_GENL_A_DEVICE, dev->index)
+	    || nla_put_u8(skb, STRIXDLX_GENL_A_EVENT, ev->event)
+	    || nla_put_u8(skb, STRIXDLX_GENL_A_OUTPUT, ev->output)
+	    || nla_put_u8(skb, STRIXDLX_GENL_A_VOLUME, ev->volume)
+	    || nla_put_u32(skb, STRIXDLX_GENL_A_SEQ, ev->seq)
+	    || nla_put_u64_64bit(skb, STRIXDLX_GENL_A_TIMESTAMP, ktime_get_ns(), STRIXDLX_GENL_A_PAD))
+		goto error;
+	genlmsg_end(skb, hdr);
+
+	genlmsg_multicast(&strixdlx_genl_family, skb, 0, 0, GFP_ATOMIC);
+	atomic_inc(&dev->stats.multicasts);
+	return;
+
+error:
+	nlmsg_free(skb);
+}
+
+/*
+ * Tell the userspace program the volume of the active output and what happened
+ * int event: one of STRIXDLX_EVENT_*
+ */
+static void strixdlx_notify(struct strixdlx_usb *dev, int event)
+{
+	struct strixdlx_event ev;
+	unsigned long flags;
+	int volume;
+
+	if (dev->control_setting == 1)
+		volume = dev->volume_headphone;
+	else
+		volume = dev->volume_speaker;
+
+	ev.volume = volume;
+	ev.output = dev->control_setting;
+	ev.event = event;
+	atomic_inc(&dev->stats.events);
+	/* write() and the interrupt callback notify concurrently, each event gets its own number */
+	spin_lock_irqsave(&dev->event_spinlock, flags);
+	ev.seq = dev->event_seq + 1;
+	dev->readbuflen = strixdlx_format_event(dev->readbuf, sizeof(dev->readbuf), &ev);
+	WRITE_ONCE(dev->event_seq, ev.seq);
+	spin_unlock_irqrestore(&dev->event_spinlock, flags);
+	wake_up(&dev->waitqueue);
+	strixdlx_genl_event(dev, &ev);
+}
+
+/*
+ * Switch the relay to an output and show the volume of it on the leds
+ * int control: 0 if speaker, 1 if headphone
+ */
+static int strixdlx_switch_output(struct strixdlx_usb *dev, int control, gfp_t mem_flags)
+{
+	struct usb_device *udev = READ_ONCE(dev->udev);
+	int retval;
+
+	//disconnect() is on its way, it kills the urbs after this
+	if (! udev)
+		return -ENODEV;
+
+	if (control == 1)
+		memcpy(dev->ctrl_buffer, STRIXDLX_DATA_HEADPHONE, STRIXDLX_CTRL_BUFFER_SIZE);
+	else
+		memcpy(dev->ctrl_buffer, STRIXDLX_DATA_SPEAKER, STRIXDLX_CTRL_BUFFER_SIZE);
+
+	SetVolume(dev, control);
+
+	//fill out urb for switching output
+	usb_fill_control_urb(dev->ctrl_urb, udev,
+		usb_sndctrlpipe(udev, 0),
+		(unsigned char *)dev->ctrl_dr,
+		dev->ctrl_buffer,
+		STRIXDLX_CTRL_BUFFER_SIZE,
+		strixdlx_ctrl_callback,
+		dev);
+	//submit ctrl switch urb
+	retval = usb_submit_urb(dev->ctrl_urb, mem_flags);
+	if (retval < 0) {
+		atomic_inc(&dev->stats.urb_errors);
+		return retval;
+	}
+	atomic_inc(&dev->stats.relay_urbs);
+
+	//fill out urb for volume
+	usb_fill_control_urb(dev->ctrl_volume_urb, udev,
+		usb_sndctrlpipe(udev, 0),
+		(unsigned char *)dev->ctrl_volume_dr,
+		dev->ctrl_volume_buffer,
+		STRIXDLX_CTRL_VOLUME_BUFFER_SIZE,
+		strixdlx_ctrl_callback,
+		dev);
+	//submit volume urb
+	retval = usb_submit_urb(dev->ctrl_volume_urb, mem_flags);
+	if (retval < 0) {
+		atomic_inc(&dev->stats.urb_errors);
+		return retval;
+	}
+	atomic_inc(&dev->stats.volume_urbs);
+
+	dev->control_setting = control;
+	return 0;
+}
+
+/*
+ * Show the volume of the active output on the leds
+ */
+static int strixdlx_send_volume(struct strixdlx_usb *dev, gfp_t mem_flags)
+{
+	struct usb_device *udev = READ_ONCE(dev->udev);
+	int retval;
+
+	if (! udev)
+		return -ENODEV;
+
+	SetVolume(dev, dev->control_setting);
+
+	usb_fill_control_urb(dev->ctrl_volume_urb, udev,
+		usb_sndctrlpipe(udev, 0),
+		(unsigned char *)dev->ctrl_volume_dr,
+		dev->ctrl_volume_buffer,
+		STRIXDLX_CTRL_VOLUME_BUFFER_SIZE,
+		strixdlx_ctrl_callback,
+		dev);
+	retval = usb_submit_urb(dev->ctrl_volume_urb, mem_flags);
+	if (retval < 0)
+		atomic_inc(&dev->stats.urb_errors);
+	else
+		atomic_inc(&dev->stats.volume_urbs);
+	return retval;
+}
+
 /*
  * interrupt callback for receiving messages
  */
@@ -503,8 +534,9 @@ static void strixdlx_int_in_callback(struct urb *urb)
 
 	struct strixdlx_usb *dev = urb->context;
 	int retval = 0;
-	u8 buf[2];
 	unsigned char *data;
+	unsigned long flags;
+	int report, step;
 	
 	DBG_DEBUG("strixdlx_int_in_callback entered");
 		
@@ -527,309 +559,97 @@ static void strixdlx_int_in_callback(struct urb *urb)
 	/*
 	 * we got a message from the control box and need to analyse it 
 	 */
-
+	report = strixdlx_decode_report(data, dev->box_int_registered);
+	switch (report) {
 
 	//DATA = 0x01 0xC5 ..... -> control box has send a message
 	//it's like a "hello" message
 	//we will will except this and set box_int_registered to 1
-	if (data[0] == 0x01 && data[1] == 0xc5 && dev->box_int_registered == 0) {
-		dev->box_int_registered = 1;
+	case STRIXDLX_REPORT_HELLO:
 		DBG_DEBUG("Data = 0x01 0xC5 -> box_int_registered");
-		goto resubmit;
-	}
-
-	// DATA = 0x05 ..... and we have a message before so we check the message
-	if (data[0] == 0x05 && dev->box_int_registered == 1) {
-		DBG_DEBUG("Data = 0x05 .... we check the rest of the message");
-
-		//DATA = 0x05 0x05 XX 0x03
-		//Control box accepts our message and is finished with work
-		if (data[1] == 0x05 && data[3] == 0x03) {
-			DBG_DEBUG("Data = 0x05 0x05 x 0x03: box finished");
-			dev->box_int_registered = 0;
-		}
-
-		//DATA = 0x05 0x05 0xXX 0x01
-		//control box tells us to increase volume
-		if (data[1] == 0x05 && data[3] == 0x01) {
-			DBG_DEBUG("Data = 0x05 0x05 0xXX 0x01: increase volume");
-			//headphone setting
-			if (dev->control_setting == 1) {
-				
-				//we increase in 3% steps. set it at max to 100
-				if (dev->volume_headphone >= 97){
-					spin_lock(&dev->volume_spinlock);
-					dev->volume_headphone = 100;
-					spin_unlock(&dev->volume_spinlock);
-				} 
-				else {
-					spin_lock(&dev->volume_spinlock);
-					dev->volume_headphone = dev->volume_headphone + 3;
-					spin_unlock(&dev->volume_spinlock);
-				}
-				SetVolume(dev, 1);
-			}
-			//speaker setting
-			else {
-				//we increase in 3% steps. set it at max to 100
-				if (dev->volume_speaker >= 97){
-					spin_lock(&dev->volume_spinlock);
-					dev->volume_speaker = 100;
-					spin_unlock(&dev->volume_spinlock);
-
-				} 
-				else {
-					spin_lock(&dev->volume_spinlock);
-					dev->volume_speaker = dev->volume_speaker + 3;
-					spin_unlock(&dev->volume_spinlock);
-				}
-				SetVolume(dev, 0);
-			}
-			
-			//fill out urb and send it
-			usb_fill_control_urb(dev->ctrl_volume_urb, dev->udev,
-				usb_sndctrlpipe(dev->udev, 0),
-				(unsigned char *)dev->ctrl_volume_dr,
-				dev->ctrl_volume_buffer,
-				STRIXDLX_CTRL_VOLUME_BUFFER_SIZE,
-				strixdlx_ctrl_callback,
-				dev);
-			
-			retval = usb_submit_urb(dev->ctrl_volume_urb, GFP_ATOMIC);
-
-			if (retval < 0) {
-				DBG_ERR("usb_control_msg volume failed (%d)", retval);
-				goto resubmit;
-			}
-
-			//wake up the userspace program and send new volume
-			if (dev->control_setting == 1) {
-				dev->readbuflen = snprintf(dev->readbuf, sizeof(dev->readbuf), "%d", dev->volume_headphone);
-			}
-			else {
-				dev->readbuflen = snprintf(dev->readbuf, sizeof(dev->readbuf), "%d", dev->volume_speaker);
-			}
-			wake_up(&waitqueue);
-
-			//we got our message from the box, we wait till the next "hello" message
-			dev->box_int_registered = 0;
+		break;
+
+	//DATA = 0x05 0x05 XX 0x03
+	//Control box accepts our message and is finished with work
+	case STRIXDLX_REPORT_ACK:
+		DBG_DEBUG("Data = 0x05 0x05 x 0x03: box finished");
+		break;
+
+	//DATA = 0x05 0x05 0xXX 0x01 increase volume
+	//DATA = 0x05 0x06 0xXX 0x01 decrease volume
+	case STRIXDLX_REPORT_UP:
+	case STRIXDLX_REPORT_DOWN:
+		step = report == STRIXDLX_REPORT_UP ? STRIXDLX_KNOB_STEP : -STRIXDLX_KNOB_STEP;
+		DBG_DEBUG("Data = 0x05 0x%02x 0xXX 0x01: change volume by %d", data[1], step);
+
+		spin_lock_irqsave(&dev->volume_spinlock, flags);
+		if (dev->control_setting == 1)
+			dev->volume_headphone = strixdlx_step_volume(dev->volume_headphone, step);
+		else
+			dev->volume_speaker = strixdlx_step_volume(dev->volume_speaker, step);
+		spin_unlock_irqrestore(&dev->volume_spinlock, flags);
+
+		retval = strixdlx_send_volume(dev, GFP_ATOMIC);
+		if (retval < 0) {
+			DBG_ERR("usb_control_msg volume failed (%d)", retval);
+			break;
 		}
 
-		//DATA = 0x05 0x06 0xXX 0x01
-		//control box tells us to increase volume
-		if (data[1] == 0x06 && data[3] == 0x01) {
-			DBG_DEBUG("Data = 0x05 0x05 0xXX 0x01: decrease volume");
-
-			//headphone
-			if (dev->control_setting == 1) {
-				
-				//we decrease in 3% steps. We cannot got lower than 0
-				if (dev->volume_headphone <= 3){
-					spin_lock(&dev->volume_spinlock);
-					dev->volume_headphone = 0;
-					spin_unlock(&dev->volume_spinlock);
-					
-				} 
-				else {
-					spin_lock(&dev->volume_spinlock);
-					dev->volume_headphone = dev->volume_headphone - 3;
-					spin_unlock(&dev->volume_spinlock);
-				}
-				SetVolume(dev, 1);
-			}
-			//speaker
-			else {
-				//we decrease in 3% steps. We cannot got lower than 0
-				if (dev->volume_speaker <= 3){
-					spin_lock(&dev->volume_spinlock);
-					dev->volume_speaker = 0;
-					spin_unlock(&dev->volume_spinlock);
-				} 
-				else {
-					spin_lock(&dev->volume_spinlock);
-					dev->volume_speaker = dev->volume_speaker - 3;
-					spin_unlock(&dev->volume_spinlock);
-				}
-				SetVolume(dev, 0);
-			}
-
-			//fill out urb control message for volume and send it
-			usb_fill_control_urb(dev->ctrl_volume_urb, dev->udev,
-				usb_sndctrlpipe(dev->udev, 0),
-				(unsigned char *)dev->ctrl_volume_dr,
-				dev->ctrl_volume_buffer,
-				STRIXDLX_CTRL_VOLUME_BUFFER_SIZE,
-				strixdlx_ctrl_callback,
-				dev);
-			
-			retval = usb_submit_urb(dev->ctrl_volume_urb, GFP_ATOMIC);
-
-			if (retval < 0) {
-				DBG_ERR("usb_control_msg volume failed (%d)", retval);
-				goto resubmit;
-			}
-
-			//wake up userspace program and send new volume
-			if (dev->control_setting == 1) {
-				dev->readbuflen = snprintf(dev->readbuf, sizeof(dev->readbuf), "%d", dev->volume_headphone);
-			}
-			else {
-				dev->readbuflen = snprintf(dev->readbuf, sizeof(dev->readbuf), "%d", dev->volume_speaker);
-			}
-			wake_up(&waitqueue);
-
-			//we got our message from the box, we wait till the next "hello" message
-			dev->box_int_registered = 0;
+		//wake up the userspace program and send new volume
+		strixdlx_notify(dev, STRIXDLX_EVENT_VOLUME);
+		break;
+
+	//DATA = 0x05 0x04 ....
+	//only happens if box is not initalisiert, could not happen cause we set the volume at probe()
+	case STRIXDLX_REPORT_UNINIT:
+		DBG_DEBUG("Data = 0x05 0x04: control box not initialized");
+		break;
+
+	//DATA = 0x05 0x03 ....
+	//big button on control box is pressed, change output to either headphone or speaker
+	case STRIXDLX_REPORT_SWITCH:
+		DBG_DEBUG("Data = 0x05 0x03: change sound output to either speaker or headphone");
+
+		//if setting is 1, then we are already on headphones and want to switch to speaker
+		//if setting is 0, then we are on speaker and want to switch to headphone
+		retval = strixdlx_switch_output(dev, !dev->control_setting, GFP_ATOMIC);
+		if (retval < 0) {
+			DBG_ERR("usb_control_msg failed (%d)", retval);
+			break;
 		}
-
-
-		//DATA = 0x05 0x04 ....
-		//only happens if box is not initalisiert, could not happen cause we set the volume at probe()
-		if (data[1] == 0x04) {
-			DBG_DEBUG("Data = 0x05 0x04: control box not initialized");
-		}
-
-
-		//DATA = 0x05 0x03 ....
-		//big button on control box is pressed, change output to either headphone or speaker
-		if (data[1] == 0x03)  {
-			DBG_DEBUG("Data = 0x05 0x03: change sound output to either speaker or headphone");
-
-			//if setting is 1, then we are already on headphones and want to switch to speaker
-			if (dev->control_setting == 1) {
-
-				buf[0] = STRIXDLX_DATA_SPEAKER[0];
-				buf[1] = STRIXDLX_DATA_SPEAKER[1];
-
-				SetVolume(dev, 0);
-			//if setting is 0, then we are on speaker and want to switch to headphone
-			} else {
-
-				buf[0] = STRIXDLX_DATA_HEADPHONE[0];
-				buf[1] = STRIXDLX_DATA_HEADPHONE[1];
-
-				SetVolume(dev, 1);
-
-			}
-			//copy buffer to urb control buffer
-			memcpy(dev->ctrl_buffer, &buf, 2);
-
-			//fill out urb for switching output
-			usb_fill_control_urb(dev->ctrl_urb, dev->udev,
-				usb_sndctrlpipe(dev->udev, 0),
-				(unsigned char *)dev->ctrl_dr,
-				dev->ctrl_buffer,
-				STRIXDLX_CTRL_BUFFER_SIZE,
-				strixdlx_ctrl_callback,
-				dev);
-			//submit ctrl switch urb
-			retval = usb_submit_urb(dev->ctrl_urb, GFP_ATOMIC);
-
-			if (retval < 0) {
-				DBG_ERR("usb_control_msg failed (%d)", retval);
-				goto resubmit;
-			}
-			
-			//fill out urb for volume
-			usb_fill_control_urb(dev->ctrl_volume_urb, dev->udev,
-				usb_sndctrlpipe(dev->udev, 0),
-				(unsigned char *)dev->ctrl_volume_dr,
-				dev->ctrl_volume_buffer,
-				STRIXDLX_CTRL_VOLUME_BUFFER_SIZE,
-				strixdlx_ctrl_callback,
-				dev);
-			
-			//submit volume urb
-			retval = usb_submit_urb(dev->ctrl_volume_urb, GFP_ATOMIC);
-
-			if (retval < 0) {
-				DBG_ERR("usb_control_msg volume failed (%d)", retval);
-				goto resubmit;
-			}
-			else {
-				//relay is switched, now switch internal and tell the userspace the correct volume for this output
-				if (dev->control_setting == 1) {
-					dev->control_setting = 0;
-					dev->readbuflen = snprintf(dev->readbuf, sizeof(dev->readbuf), "%d", dev->volume_speaker);
-					wake_up(&waitqueue);
-				} else {
-					dev->control_setting = 1;
-					dev->readbuflen = snprintf(dev->readbuf, sizeof(dev->readbuf), "%d", dev->volume_headphone);
-					wake_up(&waitqueue);
-				}
-			}
-			dev->box_int_registered = 0;		
-
-		}
-		//DATA = 0x05 0x02 ....
-		//Sonic Button on the control box is pressed. Since we don't have such software we use it for something else
-		//We set the soundvolume to 0 if bigger than 0, else to 100
-		//I would say: a mute for the poor man
-		if (data[1] == 0x02) {
-			DBG_DEBUG("Data = 0x05 0x02: Sonic Button; We set the volume to 0 or 100");
-			dev->box_int_registered = 0;
-
-			//headphone
-			if (dev->control_setting == 1) {
-				
-				if (dev->volume_headphone > 0) {
-					spin_lock(&dev->volume_spinlock);
-					dev->volume_headphone = 0;
-					spin_unlock(&dev->volume_spinlock);
-				}
-				else {
-					spin_lock(&dev->volume_spinlock);
-					dev->volume_headphone = 100;
-					spin_unlock(&dev->volume_spinlock);
-				}
-				SetVolume(dev, 1);
-			}
-			//speaker
-			else {
-
-				if (dev->volume_speaker > 0) {
-					spin_lock(&dev->volume_spinlock);
-					dev->volume_speaker = 0;
-					spin_unlock(&dev->volume_spinlock);
-				}
-				else {
-					spin_lock(&dev->volume_spinlock);
-					dev->volume_speaker = 100;
-					spin_unlock(&dev->volume_spinlock);
-				}
-				SetVolume(dev, 0);
-			}
-
-			//fill urb volume message
-			usb_fill_control_urb(dev->ctrl_volume_urb, dev->udev,
-			usb_sndctrlpipe(dev->udev, 0),
-			(unsigned char *)dev->ctrl_volume_dr,
-			dev->ctrl_volume_buffer,
-			STRIXDLX_CTRL_VOLUME_BUFFER_SIZE,
-			strixdlx_ctrl_callback,
-			dev);
-			//and submit urb
-			retval = usb_submit_urb(dev->ctrl_volume_urb, GFP_ATOMIC);
-			if (retval < 0) {
-				DBG_ERR("usb_control_msg volume failed (%d)", retval);
-				goto resubmit;
-			}
-			//inform userspace program about new volume
-			if (dev->control_setting == 1) {
-				dev->readbuflen = snprintf(dev->readbuf, sizeof(dev->readbuf), "%d", dev->volume_headphone);
-			}
-			else {
-				dev->readbuflen = snprintf(dev->readbuf, sizeof(dev->readbuf), "%d", dev->volume_speaker);
-			}
-			wake_up(&waitqueue);
+		//relay is switched, tell the userspace the correct volume for this output
+		strixdlx_notify(dev, STRIXDLX_EVENT_OUTPUT);
+		break;
+
+	//DATA = 0x05 0x02 ....
+	//Sonic Button on the control box is pressed. Since we don't have such software we use it for something else
+	//We set the soundvolume to 0 if bigger than 0, else to 100
+	case STRIXDLX_REPORT_SONIC:
+		DBG_DEBUG("Data = 0x05 0x02: Sonic Button; We set the volume to 0 or 100");
+
+		spin_lock_irqsave(&dev->volume_spinlock, flags);
+		if (dev->control_setting == 1)
+			dev->volume_headphone = strixdlx_sonic_volume(dev->volume_headphone);
+		else
+			dev->volume_speaker = strixdlx_sonic_volume(dev->volume_speaker);
+		spin_unlock_irqrestore(&dev->volume_spinlock, flags);
+
+		retval = strixdlx_send_volume(dev, GFP_ATOMIC);
+		if (retval < 0) {
+			DBG_ERR("usb_control_msg volume failed (%d)", retval);
+			break;
 		}
+		//inform userspace program about new volume
+		strixdlx_notify(dev, STRIXDLX_EVENT_SONIC);
+		break;
 	}
 
-
+	//we got our message from the box, we wait till the next "hello" message
+	dev->box_int_registered = strixdlx_next_registered(dev->box_int_registered, report, retval >= 0);
 
 //resubmit urb so we get new messages from control box (if there are any)
 resubmit:
-	if (dev->int_in_running && dev->udev) {
+	if (dev->int_in_running && READ_ONCE(dev->udev)) {
 		retval = usb_submit_urb(dev->int_in_urb, GFP_ATOMIC);
 		if (retval) {
 			DBG_ERR("resubmitting urb failed (%d)", retval);
@@ -845,72 +665,67 @@ resubmit:
  */
 static int strixdlx_open(struct inode *inode, struct file *file)
 {
-    struct strixdlx_usb *dev = NULL;
-	struct usb_interface *interface;
-	int subminor;
-	int retval = 0;
+	struct strixdlx_usb *dev;
+	struct strixdlx_file *f;
 
-    DBG_INFO("Open device");
-	subminor = iminor(inode);
+	DBG_INFO("Open device");
 
-    mutex_lock(&disconnect_mutex);
+	f = kzalloc(sizeof(*f), GFP_KERNEL);
+	if (! f)
+		return -ENOMEM;
 
-    interface = usb_find_interface(&strixdlx_driver, subminor);
-    if (! interface) {
-		DBG_ERR("can't find device for minor %d", subminor);
-		retval = -ENODEV;
-		goto exit;
-	}
+	/* a box being disconnected has no references left to take */
+	rcu_read_lock();
+	dev = xa_load(&strixdlx_devices, iminor(inode));
+	if (dev && ! kref_get_unless_zero(&dev->kref))
+		dev = NULL;
+	rcu_read_unlock();
 
-    dev = usb_get_intfdata(interface);
 	if (! dev) {
-		retval = -ENODEV;
-		goto exit;
+		DBG_ERR("can't find device for minor %d", iminor(inode));
+		kfree(f);
+		return -ENODEV;
 	}
 
-    /* lock this device */
-	if (down_interruptible (&dev->sem)) {
-		DBG_ERR("sem down failed");
-		retval = -ERESTARTSYS;
-		goto exit;
-	}
-
-    /* Increment usage count */
-	++dev->open_count;
-	if (dev->open_count > 1)
-		DBG_DEBUG("open_count = %d", dev->open_count);
-
-	/* Save our object in the file's private structure. */
-	file->private_data = dev;
-
-	up(&dev->sem);
-
-exit:
-	mutex_unlock(&disconnect_mutex);
-	return retval;
+	/* Save our object in the file's private structure, nothing read yet. */
+	f->dev = dev;
+	file->private_data = f;
+	return 0;
 }
 
 
 /*
  * userspace program uses this function to read the current volume
- * gets values between 0-100
+ * gets a line "<volume> <output> <event> <seq>", volume between 0-100
  */
 static ssize_t strixdlx_read(struct file *file, char __user *user_buf, size_t len, loff_t *off) {
 
 
-	struct strixdlx_usb *dev;
+	struct strixdlx_file *f = file->private_data;
+	struct strixdlx_usb *dev = f->dev;
+	char line[STRIXDLX_EVENT_LINE_SIZE];
+	unsigned long flags;
 	ssize_t ret;
+	u32 seq;
 
-	dev = file->private_data;
-	//copy to userspace
-	if (copy_to_user(user_buf, dev->readbuf, dev->readbuflen )) {
+	if (! READ_ONCE(dev->udev))
+		return -ENODEV;
 
-		ret = -EFAULT;
-	} else {
-		ret = dev->readbuflen;
-	}
-	//reset buf length
-	dev->readbuflen = 0;
+	//take the line and its number together, a notify may replace both any time
+	spin_lock_irqsave(&dev->event_spinlock, flags);
+	seq = dev->event_seq;
+	ret = min(len, dev->readbuflen);
+	memcpy(line, dev->readbuf, ret);
+	spin_unlock_irqrestore(&dev->event_spinlock, flags);
+
+	//this file has seen the last event already
+	if (seq == f->event_seq)
+		return 0;
+
+	//copy to userspace
+	if (copy_to_user(user_buf, line, ret))
+		return -EFAULT;
+	f->event_seq = seq;
 	return ret;
 
 }
@@ -921,13 +736,14 @@ static ssize_t strixdlx_read(struct file *file, char __user *user_buf, size_t le
  */
 unsigned int strixdlx_poll(struct file *file, struct poll_table_struct *wait) {
 
-	struct strixdlx_usb *dev;
-
-	dev = file->private_data;
+	struct strixdlx_file *f = file->private_data;
 
 	//wait until new data is ready
-	poll_wait(file, &waitqueue, wait);
-	if (dev->readbuflen)
+	poll_wait(file, &f->dev->waitqueue, wait);
+	//the box is gone, disconnect() woke us up
+	if (! READ_ONCE(f->dev->udev))
+		return POLLHUP | POLLERR;
+	if (READ_ONCE(f->dev->event_seq) != f->event_seq)
 		return POLLIN;
 	else
 		return 0;
@@ -936,7 +752,7 @@ unsigned int strixdlx_poll(struct file *file, struct poll_table_struct *wait) {
 
 /*
  * userspace program uses this function to submit new volume
- * allowed are values between 0 and 100
+ * allowed are values between 0 and 100, or STRIXDLX_CMD_* to switch the output
  */
 static ssize_t strixdlx_write(struct file *file, const char __user *user_buf, size_t
 		count, loff_t *ppos)
@@ -944,14 +760,20 @@ static ssize_t strixdlx_write(struct file *file, const char __user *user_buf, si
 	struct strixdlx_usb *dev;
 	int retval = 0;
 	bool policy;
-    int cmd = 0;    
-
-	dev = file->private_data;
-
-	/* Lock this object. */
-	if (down_interruptible(&dev->sem)) {
-		retval = -ERESTARTSYS;
-		goto exit;
+	u8 buf[STRIXDLX_CMD_MAX_SIZE];
+	int cmd;
+	int output;
+	unsigned long flags;
+
+	dev = ((struct strixdlx_file *)file->private_data)->dev;
+
+	/* Lock this object, count how often somebody else holds it. */
+	if (down_trylock(&dev->sem)) {
+		atomic_inc(&dev->stats.sem_contended);
+		if (down_interruptible(&dev->sem)) {
+			retval = -ERESTARTSYS;
+			goto exit;
+		}
 	}
 
 	/* Verify that the device wasn't unplugged. */
@@ -965,18 +787,60 @@ static ssize_t strixdlx_write(struct file *file, const char __user *user_buf, si
 	if (count == 0)
 		goto unlock_exit;
 
-	/* We only accept maximum 3 byte writes. */
-	if (count > 1)
-		count = 1;
+	/* We only accept maximum 2 byte writes. */
+	if (count > STRIXDLX_CMD_MAX_SIZE)
+		count = STRIXDLX_CMD_MAX_SIZE;
 
 	// copy from user
-	if (copy_from_user(&cmd, user_buf, count)) {
+	if (copy_from_user(buf, user_buf, count)) {
 		retval = -EFAULT;
 		goto unlock_exit;
 	}
+	cmd = buf[0];
+
+	//volume of one output, the leds only follow the active one
+	if (cmd == STRIXDLX_CMD_VOLUME_SPEAKER || cmd == STRIXDLX_CMD_VOLUME_HEADPHONE) {
+		if (count < 2 || buf[1] > 100) {
+			DBG_ERR("illegal output volume command issued");
+			retval = -EINVAL;
+			goto unlock_exit;
+		}
+		output = cmd == STRIXDLX_CMD_VOLUME_HEADPHONE;
+		spin_lock_irqsave(&dev->volume_spinlock, flags);
+		if (output)
+			dev->volume_headphone = buf[1];
+		else
+			dev->volume_speaker = buf[1];
+		spin_unlock_irqrestore(&dev->volume_spinlock, flags);
+
+		if (dev->control_setting == output) {
+			retval = strixdlx_send_volume(dev, GFP_KERNEL);
+			if (retval < 0) {
+				DBG_ERR("usb_control_msg failed (%d)", retval);
+				goto unlock_exit;
+			}
+		}
+		retval = 2;
+		goto unlock_exit;
+	}
+
+	//all other commands are one byte
+	count = 1;
+
+	//switch relay, the userspace gets the volume of the new output
+	if (cmd == STRIXDLX_CMD_SPEAKER || cmd == STRIXDLX_CMD_HEADPHONE) {
+		retval = strixdlx_switch_output(dev, cmd == STRIXDLX_CMD_HEADPHONE, GFP_KERNEL);
+		if (retval < 0) {
+			DBG_ERR("usb_control_msg failed (%d)", retval);
+			goto unlock_exit;
+		}
+		strixdlx_notify(dev, STRIXDLX_EVENT_OUTPUT);
+		retval = count;
+		goto unlock_exit;
+	}
 
 	//if values are between 0 to 100, everything is ok
-	policy = (cmd >= 0 || cmd <= 100);
+	policy = (cmd >= 0 && cmd <= 100);
 
 	if (!policy) {
 		DBG_ERR("illegal command issued");
@@ -986,30 +850,19 @@ static ssize_t strixdlx_write(struct file *file, const char __user *user_buf, si
 
 	//headphone active: set new volume
 	if (dev->control_setting == 1) {
-		spin_lock(&dev->volume_spinlock);
+		spin_lock_irqsave(&dev->volume_spinlock, flags);
 		dev->volume_headphone = cmd;
-		spin_unlock(&dev->volume_spinlock);
+		spin_unlock_irqrestore(&dev->volume_spinlock, flags);
 	}
 	//speaker active: set new volume
 	else {
-		spin_lock(&dev->volume_spinlock);
+		spin_lock_irqsave(&dev->volume_spinlock, flags);
 		dev->volume_speaker = cmd;
-		spin_unlock(&dev->volume_spinlock);
+		spin_unlock_irqrestore(&dev->volume_spinlock, flags);
 	}
 
-	SetVolume(dev, dev->control_setting);
-	
-	//fill volume urb (leds neeed to be set correctly)
-	usb_fill_control_urb(dev->ctrl_volume_urb, dev->udev,
-		usb_sndctrlpipe(dev->udev, 0),
-		(unsigned char *)dev->ctrl_volume_dr,
-		dev->ctrl_volume_buffer,
-		STRIXDLX_CTRL_VOLUME_BUFFER_SIZE,
-		strixdlx_ctrl_callback,
-		dev);
-	
-	//submit volume urb
-	retval = usb_submit_urb(dev->ctrl_volume_urb, GFP_KERNEL);
+	//leds neeed to be set correctly
+	retval = strixdlx_send_volume(dev, GFP_KERNEL);
 
 	if (retval < 0) {
 		DBG_ERR("usb_control_msg failed (%d)", retval);
@@ -1021,13 +874,48 @@ static ssize_t strixdlx_write(struct file *file, const char __user *user_buf, si
 unlock_exit:
 	up(&dev->sem);
 
+	if (retval > 0)
+		atomic_inc(&dev->stats.commands);
+	else if (retval < 0)
+		atomic_inc(&dev->stats.rejected);
 exit:
 	return retval;
 }
 
+/*
+ * sysfs attribute "stats" of the interface: the counters of the device
+ * The driver core creates it after probe() succeeded and removes it before
+ * disconnect() runs, kernfs waits for a running read, so the intfdata is
+ * set and the device alive for as long as the attribute can be read.
+ */
+static ssize_t stats_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+	struct strixdlx_usb *dev = usb_get_intfdata(to_usb_interface(d));
+
+	return scnprintf(buf, PAGE_SIZE,
+			"commands %d\nrejected %d\nrelay_urbs %d\nvolume_urbs %d\n"
+			"urb_errors %d\nevents %d\nsem_contended %d\nmulticasts %d\n",
+			atomic_read(&dev->stats.commands),
+			atomic_read(&dev->stats.rejected),
+			atomic_read(&dev->stats.relay_urbs),
+			atomic_read(&dev->stats.volume_urbs),
+			atomic_read(&dev->stats.urb_errors),
+			atomic_read(&dev->stats.events),
+			atomic_read(&dev->stats.sem_contended),
+			atomic_read(&dev->stats.multicasts));
+}
+static DEVICE_ATTR_RO(stats);
+
+static struct attribute *strixdlx_attrs[] = {
+	&dev_attr_stats.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(strixdlx);
+
 
 /*
- * abort all transfers
+ * abort all transfers and wait for their callbacks
+ * Also after the device is gone, its urbs may still be on their way back.
  */
 static void strixdlx_abort_transfers(struct strixdlx_usb *dev)
 {
@@ -1036,26 +924,16 @@ static void strixdlx_abort_transfers(struct strixdlx_usb *dev)
 		return;
 	}
 
-	if (! dev->udev) {
-		DBG_ERR("udev is NULL");
-		return;
-	}
-
-	if (dev->udev->state == USB_STATE_NOTATTACHED) {
-		DBG_ERR("udev not attached");
-		return;
-	}
-
-	/* Shutdown transfer */
-	if (dev->int_in_running) {
-		dev->int_in_running = 0;
-		mb();
-		if (dev->int_in_urb)
-			usb_kill_urb(dev->int_in_urb);
-	}
+	/* no resubmit from the interrupt callback */
+	dev->int_in_running = 0;
+	mb();
 
+	if (dev->int_in_urb)
+		usb_kill_urb(dev->int_in_urb);
 	if (dev->ctrl_urb)
 		usb_kill_urb(dev->ctrl_urb);
+	if (dev->ctrl_volume_urb)
+		usb_kill_urb(dev->ctrl_volume_urb);
 }
 
 /*
@@ -1066,17 +944,29 @@ static inline void strixdlx_delete(struct strixdlx_usb *dev)
 	//at first abort all transfers
 	strixdlx_abort_transfers(dev);
 
-	if (dev->int_in_urb)
-		usb_free_urb(dev->int_in_urb);
-	if (dev->ctrl_urb)
-		usb_free_urb(dev->ctrl_urb);
-
-	kfree(dev->int_in_buffer);
-	kfree(dev->ctrl_buffer);
+	usb_free_urb(dev->int_in_urb);
+	usb_free_urb(dev->ctrl_urb);
+	usb_free_urb(dev->ctrl_volume_urb);
+
+	if (dev->int_in_buffer)
+		usb_free_coherent(dev->dma_dev, dev->int_in_size, dev->int_in_buffer, dev->int_in_dma);
+	if (dev->ctrl_buffer)
+		usb_free_coherent(dev->dma_dev, STRIXDLX_CTRL_BUFFER_SIZE, dev->ctrl_buffer, dev->ctrl_dma);
+	if (dev->ctrl_volume_buffer)
+		usb_free_coherent(dev->dma_dev, STRIXDLX_CTRL_VOLUME_BUFFER_SIZE,
+				dev->ctrl_volume_buffer, dev->ctrl_volume_dma);
 	kfree(dev->ctrl_dr);
-	kfree(dev->ctrl_volume_buffer);
 	kfree(dev->ctrl_volume_dr);
-	kfree(dev);
+	usb_put_dev(dev->dma_dev);
+	kfree_rcu(dev, rcu);
+}
+
+/*
+ * the last reference is gone, called by kref_put()
+ */
+static void strixdlx_free(struct kref *kref)
+{
+	strixdlx_delete(container_of(kref, struct strixdlx_usb, kref));
 }
 
 /*
@@ -1084,48 +974,14 @@ static inline void strixdlx_delete(struct strixdlx_usb *dev)
  */
 static int strixdlx_release(struct inode *inode, struct file *file)
 {
-	struct strixdlx_usb *dev = NULL;
-	int retval = 0;
+	struct strixdlx_file *f = file->private_data;
 
 	DBG_INFO("Release strixdlx");
-	dev = file->private_data;
-
-	if (! dev) {
-		DBG_ERR("dev is NULL");
-		retval =  -ENODEV;
-		goto exit;
-	}
-
-	/* Lock our device */
-	if (down_interruptible(&dev->sem)) {
-		retval = -ERESTARTSYS;
-		goto exit;
-	}
-
-	if (dev->open_count <= 0) {
-		DBG_ERR("device not opened");
-		retval = -ENODEV;
-		goto unlock_exit;
-	}
-
-	if (! dev->udev) {
-		DBG_DEBUG("device unplugged before the file was released");
-		up (&dev->sem);
-		//delete & free structures
-		strixdlx_delete(dev);
-		goto exit;
-	}
-
-	if (dev->open_count > 1)
-		DBG_DEBUG("open_count = %d", dev->open_count);
 
-	--dev->open_count;
-
-unlock_exit:
-	up(&dev->sem);
-
-exit:
-	return retval;
+	//the last file of an unplugged box frees it
+	kref_put(&f->dev->kref, strixdlx_free);
+	kfree(f);
+	return 0;
 }
 
 /*
@@ -1142,9 +998,11 @@ static struct file_operations strixdlx_fops = {
 
 /*
  * strixdlx class
+ * usb_register_dev() would name the node after the usb minor, every box gets
+ * a copy with its own name instead.
  */
 static struct usb_class_driver strixdlx_class = {
-	.name = "strixdlx",
+	.name = "strixdlx%d",
 	.fops = &strixdlx_fops,
 	.minor_base = STRIXDLX_MINOR_BASE,
 };
@@ -1162,10 +1020,11 @@ static int strixdlx_probe(struct usb_interface *interface, const struct usb_devi
 	int i, int_end_size;
 	u8 buf[2];				//buffer for relay
 	u8 buf_volume[16];		//buffer for volume
+	unsigned long flags;
 
     DBG_INFO("Probe strix dlx driver");
 
-    if (interface->cur_altsetting->desc.bInterfaceNumber != 4) {
+    if (interface->cur_altsetting->desc.bInterfaceNumber != STRIXDLX_INTERFACE) {
         goto exit;
     }
 
@@ -1181,10 +1040,16 @@ static int strixdlx_probe(struct usb_interface *interface, const struct usb_devi
 		goto exit;
 	}
     
+    kref_init(&dev->kref);
+    dev->index = -1;
     sema_init(&dev->sem, 1);
 	spin_lock_init(&dev->ctrl_spinlock);
+	spin_lock_init(&dev->volume_spinlock);
+	spin_lock_init(&dev->event_spinlock);
+	init_waitqueue_head(&dev->waitqueue);
 
     dev->udev = udev;
+	dev->dma_dev = usb_get_dev(udev);
 	dev->interface = interface;
 	iface_desc = interface->cur_altsetting;
 
@@ -1207,7 +1072,11 @@ static int strixdlx_probe(struct usb_interface *interface, const struct usb_devi
 
     int_end_size = le16_to_cpu(dev->int_in_endpoint->wMaxPacketSize);
 
-    dev->int_in_buffer = kmalloc(int_end_size, GFP_KERNEL);
+	/*
+	 * All transfer buffers are coherent and allocated once, the urbs are
+	 * submitted with URB_NO_TRANSFER_DMA_MAP and are not mapped every time.
+	 */
+    dev->int_in_buffer = usb_alloc_coherent(udev, int_end_size, GFP_KERNEL, &dev->int_in_dma);
 	if (! dev->int_in_buffer) {
 		DBG_ERR("could not allocate int_in_buffer");
 		retval = -ENOMEM;
@@ -1220,6 +1089,7 @@ static int strixdlx_probe(struct usb_interface *interface, const struct usb_devi
 		retval = -ENOMEM;
 		goto error;
 	}
+	dev->int_in_size = int_end_size;
 
 	/* allocate control urb for switching between speaker and headphone */
 	dev->ctrl_urb = usb_alloc_urb(0, GFP_KERNEL);
@@ -1230,7 +1100,7 @@ static int strixdlx_probe(struct usb_interface *interface, const struct usb_devi
 	}
 
 	/* allocate buffer for switching between speaker and headphone */
-	dev->ctrl_buffer = kzalloc(STRIXDLX_CTRL_BUFFER_SIZE, GFP_KERNEL);
+	dev->ctrl_buffer = usb_alloc_coherent(udev, STRIXDLX_CTRL_BUFFER_SIZE, GFP_KERNEL, &dev->ctrl_dma);
 	if (! dev->ctrl_buffer) {
 		DBG_ERR("could not allocate ctrl_buffer");
 		retval = -ENOMEM;
@@ -1254,7 +1124,8 @@ static int strixdlx_probe(struct usb_interface *interface, const struct usb_devi
 	}
 
 	/* allocate buffer for changing volume*/
-	dev->ctrl_volume_buffer = kzalloc(STRIXDLX_CTRL_VOLUME_BUFFER_SIZE, GFP_KERNEL);
+	dev->ctrl_volume_buffer = usb_alloc_coherent(udev, STRIXDLX_CTRL_VOLUME_BUFFER_SIZE, GFP_KERNEL,
+			&dev->ctrl_volume_dma);
 	if (! dev->ctrl_volume_buffer) {
 		DBG_ERR("could not allocate ctrl_volume_buffer");
 		retval = -ENOMEM;
@@ -1269,6 +1140,14 @@ static int strixdlx_probe(struct usb_interface *interface, const struct usb_devi
 		goto error;
 	}
 
+	//the urbs keep their buffers, usb_fill_*_urb() does not touch these
+	dev->int_in_urb->transfer_dma = dev->int_in_dma;
+	dev->int_in_urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+	dev->ctrl_urb->transfer_dma = dev->ctrl_dma;
+	dev->ctrl_urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+	dev->ctrl_volume_urb->transfer_dma = dev->ctrl_volume_dma;
+	dev->ctrl_volume_urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+
 	//fill buffer for initial relay setting to speaker
 	buf[0] = STRIXDLX_DATA_SPEAKER[0];
 	buf[1] = STRIXDLX_DATA_SPEAKER[1];
@@ -1341,10 +1220,10 @@ static int strixdlx_probe(struct usb_interface *interface, const struct usb_devi
 	dev->control_setting = 0;
 
 	//set both volumes to 100% internally
-	spin_lock(&dev->volume_spinlock);
+	spin_lock_irqsave(&dev->volume_spinlock, flags);
 	dev->volume_speaker = 100;
 	dev->volume_headphone = 100;
-	spin_unlock(&dev->volume_spinlock);
+	spin_unlock_irqrestore(&dev->volume_spinlock, flags);
 	
 	
 	//send receiving interrupt urb
@@ -1359,8 +1238,18 @@ static int strixdlx_probe(struct usb_interface *interface, const struct usb_devi
     /* Save our data pointer in this interface device. */
 	usb_set_intfdata(interface, dev);
 
+	dev->index = ida_alloc(&strixdlx_ida, GFP_KERNEL);
+	if (dev->index < 0) {
+		retval = dev->index;
+		usb_set_intfdata(interface, NULL);
+		goto error;
+	}
+	snprintf(dev->name, sizeof(dev->name), "strixdlx%d", dev->index);
+	dev->class = strixdlx_class;
+	dev->class.name = dev->name;
+
     /* We can register the device now, as it is ready. */
-	retval = usb_register_dev(interface, &strixdlx_class);
+	retval = usb_register_dev(interface, &dev->class);
 	if (retval) {
 		DBG_ERR("not able to get a minor for this device.");
 		usb_set_intfdata(interface, NULL);
@@ -1369,24 +1258,28 @@ static int strixdlx_probe(struct usb_interface *interface, const struct usb_devi
 
     dev->minor = interface->minor;
 
-	//init waiting queue
-	init_waitqueue_head(&waitqueue);
+	/* open() finds it from now on, an open() before got -ENODEV */
+	kref_get(&dev->kref);
+	retval = xa_err(xa_store(&strixdlx_devices, dev->minor, dev, GFP_KERNEL));
+	if (retval) {
+		DBG_ERR("could not publish the device (%d)", retval);
+		kref_put(&dev->kref, strixdlx_free);
+		usb_deregister_dev(interface, &dev->class);
+		usb_set_intfdata(interface, NULL);
+		goto error;
+	}
 
 	//tell our userspace program the new volumes
-	if (dev->control_setting == 1) {
-		dev->readbuflen = snprintf(dev->readbuf, sizeof(dev->readbuf), "%d", dev->volume_headphone);
-	}
-	else {
-		dev->readbuflen = snprintf(dev->readbuf, sizeof(dev->readbuf), "%d", dev->volume_speaker);
-	}
-	wake_up(&waitqueue);
+	strixdlx_notify(dev, STRIXDLX_EVENT_INIT);
 
-	DBG_INFO("strixdlx_driver now attached to /dev/strixdlx");
+	DBG_INFO("strixdlx_driver now attached to /dev/%s", dev->name);
 
 exit:
     return retval;    
 
 error:
+	if (dev->index >= 0)
+		ida_free(&strixdlx_ida, dev->index);
 
     strixdlx_delete(dev);
     return retval;   
@@ -1397,38 +1290,38 @@ error:
  */
 static void strixdlx_disconnect(struct usb_interface *interface)
 {
-    struct strixdlx_usb *dev;
-	int minor;
-
-	mutex_lock(&disconnect_mutex);
+	struct strixdlx_usb *dev;
+	int minor, index;
 
 	dev = usb_get_intfdata(interface);
-	usb_unlink_urb(dev->int_in_urb);
-	usb_unlink_urb(dev->ctrl_urb);
-	usb_set_intfdata(interface, NULL);
-	
+	minor = dev->minor;
+	index = dev->index;
+
+	/* no new open(), the files already open keep their reference */
+	xa_erase(&strixdlx_devices, minor);
+	kref_put(&dev->kref, strixdlx_free);
+
+	/* wait for a running write(), the next one sees the device is gone */
 	down(&dev->sem);
-	dev->int_in_running = 0;
+	WRITE_ONCE(dev->udev, NULL);
+	up(&dev->sem);
 
-    minor = dev->minor;
+	//nothing submits anymore, no urb is in flight afterwards
+	//an open file may keep dev for a while
+	strixdlx_abort_transfers(dev);
+	usb_set_intfdata(interface, NULL);
 
-	/* Give back our minor. */
-	usb_deregister_dev(interface, &strixdlx_class);
+	/* Give back our minor and N, the next box plugged in gets it again */
+	usb_deregister_dev(interface, &dev->class);
+	ida_free(&strixdlx_ida, index);
 
-    /* If the device is not opened, then we clean up right now. */
-	if (! dev->open_count) {
-		up(&dev->sem);
-		strixdlx_delete(dev);
-	} else {
-		dev->udev = NULL;
-		up(&dev->sem);
-	}
+	/* readers blocked in poll() get POLLHUP */
+	wake_up(&dev->waitqueue);
 
-    mutex_unlock(&disconnect_mutex);
+	/* the reference of the interface, dev is freed now if no file is open */
+	kref_put(&dev->kref, strixdlx_free);
 
-	DBG_INFO("strixdlx_dlx /dev/strixdlx now disconnected");
-	//DBG_INFO("strixdlx_dlx /dev/strixdlx%d now disconnected",
-	//		minor - STRIXDLX_MINOR_BASE);
+	DBG_INFO("strixdlx_dlx /dev/strixdlx%d now disconnected", index);
 
 }
 
@@ -1440,13 +1333,9 @@ static int strixdlx_suspend(struct usb_interface *interface, pm_message_t messag
 {
 
 	struct strixdlx_usb *dev;
-	mutex_lock(&disconnect_mutex);
 
 	dev = usb_get_intfdata(interface);
-	usb_unlink_urb(dev->int_in_urb);
-	usb_unlink_urb(dev->ctrl_urb);
-
-	mutex_unlock(&disconnect_mutex);
+	strixdlx_abort_transfers(dev);
 
 	DBG_INFO("strixdlx driver going to suspend");
 	
@@ -1489,14 +1378,14 @@ static int strixdlx_resume(struct usb_interface *interface)
 	retval = usb_submit_urb(dev->int_in_urb, GFP_KERNEL);
 	if (retval) {
 		DBG_ERR("could not send int_in_urb");
-		usb_set_intfdata(interface, NULL);
+		//dev stays bound, disconnect() frees it
+		dev->int_in_running = 0;
 		goto error;
 	}
 
     return retval;    
 
 error:
-    strixdlx_delete(dev);
     return retval;   
 
 }
@@ -1512,6 +1401,7 @@ static struct usb_driver strixdlx_driver =
     .disconnect = strixdlx_disconnect,
 	.suspend = strixdlx_suspend,
 	.resume = strixdlx_resume,
+	.dev_groups = strixdlx_groups,
 };
 
 /*
@@ -1521,10 +1411,18 @@ static int __init strixdlx_init(void)
 {
 	int result;
 
+	/* the family first, probe() already sends an event */
+	result = genl_register_family(&strixdlx_genl_family);
+	if (result) {
+		DBG_ERR("registering netlink family failed (%d)", result);
+		return result;
+	}
+
 	DBG_INFO("Register strixdlx driver");
 	result = usb_register(&strixdlx_driver);
 	if (result) {
 		DBG_ERR("registering strixdlx driver failed");
+		genl_unregister_family(&strixdlx_genl_family);
 	} else {
 		DBG_INFO("driver strixdlx registered successfully");
 	}
@@ -1537,6 +1435,7 @@ static int __init strixdlx_init(void)
 static void __exit strixdlx_exit(void)
 {
     usb_deregister(&strixdlx_driver);
+	genl_unregister_family(&strixdlx_genl_family);
 	DBG_INFO("driver strixdlx deregistered");
 }
 
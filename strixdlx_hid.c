@@ -0,0 +1,679 @@
+/*
+ * HID driver for the control box of Asus Strix Raid DLX Soundcard
+ *
+ *
+ * Copyright (C) 2020 Tobias Wingerath
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ * Alternative build of strixdlx.c (make HID=1), the protocol of the box is
+ * described there. Interface 4 of the card is a HID interface, so instead of
+ * keeping usbhid away with a quirk and handling the urbs itself, this module
+ * is a driver on the HID bus:
+ *
+ * - hid-core polls the interrupt endpoint and hands every report of the box
+ *   to raw_event(), which decodes it like the interrupt callback of
+ *   strixdlx.c does
+ * - the led frame is an output report (SET_REPORT, wValue 0x0200, wIndex 4),
+ *   sent with hid_hw_raw_request(). The descriptor has no report ids, so the
+ *   report number 0 in front of the frame is not sent.
+ * - the relay is an audio class request to the card, not a HID request, it
+ *   goes out with usb_control_msg() on the usb device of the interface
+ * - /dev/hidrawN of the box stays usable, e.g. for protocol captures
+ * - the other HID interfaces of the card are handled like hid-generic does
+ *
+ * raw_event() runs in interrupt context, the leds and the relay are sent from
+ * a work item. Knob steps which arrive while it is pending are merged into
+ * one led frame.
+ *
+ * ******	Userspace part	******
+ *
+ * Every control box is a misc device /dev/strixdlxN with the read(), poll()
+ * and write() protocol of strixdlx.c, the daemon and the other programs work
+ * with both builds. A file opened before the box was unplugged gets POLLHUP
+ * and -ENODEV from then on.
+ *
+ * Not in this build: the sysfs attribute "stats" and the netlink multicast.
+ *
+ */
+
+#include <linux/module.h>
+#include <linux/init.h>
+
+#include <linux/slab.h>			/* kmalloc() */
+#include <linux/usb.h>			/* usb_control_msg() for the relay */
+#include <linux/hid.h>			/* HID stuff */
+#include <linux/miscdevice.h>		/* /dev/strixdlxN */
+#include <linux/idr.h>			/* N of /dev/strixdlxN */
+#include <linux/kref.h>
+#include <linux/mutex.h>		/* mutexes */
+#include <linux/workqueue.h>
+
+#include <linux/uaccess.h>		/* copy_*_user */
+#include <linux/poll.h>			/* polling */
+#include <linux/wait.h>			/* wait queue */
+
+#include "strixdlx-proto.h"		/* protocol shared with userspace */
+
+
+#define DEBUG_LEVEL_DEBUG		0x1F
+#define DEBUG_LEVEL_INFO		0x0F
+#define DEBUG_LEVEL_WARN		0x07
+#define DEBUG_LEVEL_ERROR		0x03
+#define DEBUG_LEVEL_CRITICAL	0x01
+
+/*
+ * kernel messages
+ */
+#define DBG_DEBUG(fmt, args...) \
+if ((debug_level & DEBUG_LEVEL_DEBUG) == DEBUG_LEVEL_DEBUG) \
+	printk( KERN_DEBUG "[debug] %s(%d): " fmt "\n", \
+			__FUNCTION__, __LINE__, ## args)
+#define DBG_INFO(fmt, args...) \
+if ((debug_level & DEBUG_LEVEL_INFO) == DEBUG_LEVEL_INFO) \
+	printk( KERN_DEBUG "[info]  %s(%d): " fmt "\n", \
+			__FUNCTION__, __LINE__, ## args)
+#define DBG_ERR(fmt, args...) \
+if ((debug_level & DEBUG_LEVEL_ERROR) == DEBUG_LEVEL_ERROR) \
+	printk( KERN_DEBUG "[err]   %s(%d): " fmt "\n", \
+			__FUNCTION__, __LINE__, ## args)
+
+/*
+ * what the work item has to send
+ */
+#define STRIXDLX_HID_SEND_LEDS		0x01
+#define STRIXDLX_HID_SEND_RELAY		0x02
+
+#define STRIXDLX_HID_NAME_SIZE		16
+
+/*
+ * structure to hold all data of one control box
+ */
+struct strixdlx_hid {
+	struct hid_device	*hdev;
+	struct usb_device	*udev;
+	struct kref		kref;		/* the HID device and every open file */
+	struct miscdevice	misc;
+	char			name[STRIXDLX_HID_NAME_SIZE];
+	int			index;		/* N of /dev/strixdlxN */
+
+	struct mutex		io_mutex;	/* serialises the control messages and write() */
+	spinlock_t		lock;		/* state below, raw_event() takes it in interrupt context */
+	struct work_struct	work;		/* sends what raw_event() decided */
+	int			pending;	/* STRIXDLX_HID_SEND_* for the work item */
+	bool			removed;	/* box unplugged, set under io_mutex and lock */
+
+	u8			*relay_buf;	/* 2 bytes, kmalloc'd for dma */
+	u8			*led_buf;	/* report number and 16 byte led frame */
+
+	int			box_int_registered; /* the box has sent its hello */
+	int			control_setting; /* switch status: speaker = 0, headphone = 1 */
+	int			volume_speaker;	/* volume of speaker: 0-100 */
+	int			volume_headphone; /* volume of headphone: 0-100 */
+
+	char			readbuf[STRIXDLX_EVENT_LINE_SIZE]; /* line of the last event */
+	size_t			readbuflen;
+	u32			event_seq;	/* sequence number of the last event */
+	wait_queue_head_t	waitqueue;	/* readers of this box wait here for an event */
+};
+
+/*
+ * state of one open file
+ */
+struct strixdlx_hid_file {
+	struct strixdlx_hid	*dev;
+	u32			event_seq;	/* sequence number of the last event read */
+};
+
+/*
+ * driver id table
+ */
+static const struct hid_device_id strixdlx_hid_table[] = {
+	{ HID_USB_DEVICE(STRIXDLX_VENDOR_ID, STRIXDLX_PRODUCT_ID) },
+	{ } /* Terminating entry */
+};
+MODULE_DEVICE_TABLE(hid, strixdlx_hid_table);
+
+/*
+ * internal debug
+ */
+static int debug_level = DEBUG_LEVEL_INFO;
+module_param(debug_level, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(debug_level, "debug level (bitmask)");
+
+static DEFINE_IDA(strixdlx_hid_ida);
+
+/*
+ * free the box after the last user, called by kref_put()
+ */
+static void strixdlx_hid_free(struct kref *kref)
+{
+	struct strixdlx_hid *dev = container_of(kref, struct strixdlx_hid, kref);
+
+	kfree(dev->relay_buf);
+	kfree(dev->led_buf);
+	kfree(dev);
+}
+
+/*
+ * Volume of the active output, the lock is held
+ */
+static int strixdlx_hid_volume(struct strixdlx_hid *dev)
+{
+	return dev->control_setting == 1 ? dev->volume_headphone : dev->volume_speaker;
+}
+
+/*
+ * Tell the readers the volume of the active output and what happened
+ * The lock is held. int event: one of STRIXDLX_EVENT_*
+ */
+static void strixdlx_hid_notify(struct strixdlx_hid *dev, int event)
+{
+	struct strixdlx_event ev;
+
+	ev.volume = strixdlx_hid_volume(dev);
+	ev.output = dev->control_setting;
+	ev.event = event;
+	ev.seq = dev->event_seq + 1;
+	dev->readbuflen = strixdlx_format_event(dev->readbuf, sizeof(dev->readbuf), &ev);
+	dev->event_seq = ev.seq;
+	wake_up(&dev->waitqueue);
+}
+
+/*
+ * Send the relay setting and the leds of the active output to the box
+ * io_mutex is held. bool relay: switch the relay too
+ */
+static int strixdlx_hid_send(struct strixdlx_hid *dev, bool relay)
+{
+	unsigned long flags;
+	int control, volume;
+	int retval;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	control = dev->control_setting;
+	volume = strixdlx_hid_volume(dev);
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	if (relay) {
+		memcpy(dev->relay_buf, control == 1 ? STRIXDLX_DATA_HEADPHONE : STRIXDLX_DATA_SPEAKER,
+				STRIXDLX_CTRL_BUFFER_SIZE);
+		retval = usb_control_msg(dev->udev, usb_sndctrlpipe(dev->udev, 0),
+				STRIXDLX_CTRL_REQUEST, STRIXDLX_CTRL_REQUEST_TYPE,
+				STRIXDLX_CTRL_VALUE, STRIXDLX_CTRL_INDEX,
+				dev->relay_buf, STRIXDLX_CTRL_BUFFER_SIZE, USB_CTRL_SET_TIMEOUT);
+		if (retval < 0) {
+			DBG_ERR("relay control message failed (%d)", retval);
+			return retval;
+		}
+	}
+
+	//report number 0 is not sent, the frame goes out as it is
+	dev->led_buf[0] = 0;
+	strixdlx_volume_frame(dev->led_buf + 1, control, volume);
+	retval = hid_hw_raw_request(dev->hdev, 0, dev->led_buf,
+			STRIXDLX_CTRL_VOLUME_BUFFER_SIZE + 1,
+			HID_OUTPUT_REPORT, HID_REQ_SET_REPORT);
+	if (retval < 0) {
+		DBG_ERR("led output report failed (%d)", retval);
+		return retval;
+	}
+	return 0;
+}
+
+/*
+ * work item: send what raw_event() has decided since the last run
+ */
+static void strixdlx_hid_work(struct work_struct *work)
+{
+	struct strixdlx_hid *dev = container_of(work, struct strixdlx_hid, work);
+	unsigned long flags;
+	int pending;
+
+	mutex_lock(&dev->io_mutex);
+	spin_lock_irqsave(&dev->lock, flags);
+	pending = dev->pending;
+	dev->pending = 0;
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	if (pending && !dev->removed)
+		strixdlx_hid_send(dev, pending & STRIXDLX_HID_SEND_RELAY);
+	mutex_unlock(&dev->io_mutex);
+}
+
+/*
+ * every input report of the box, in interrupt context
+ * Returns 0, so hidraw gets the report as well.
+ */
+static int strixdlx_hid_raw_event(struct hid_device *hdev, struct hid_report *report,
+		u8 *data, int size)
+{
+	struct strixdlx_hid *dev = hid_get_drvdata(hdev);
+	unsigned long flags;
+	int send = 0, event = -1;
+	int kind, step;
+
+	//another interface of the card
+	if (! dev || size < 4)
+		return 0;
+
+	DBG_DEBUG("report %02x %02x %02x %02x, size %d", data[0], data[1], data[2], data[3], size);
+
+	spin_lock_irqsave(&dev->lock, flags);
+	kind = strixdlx_decode_report(data, dev->box_int_registered);
+	switch (kind) {
+
+	case STRIXDLX_REPORT_UP:
+	case STRIXDLX_REPORT_DOWN:
+		step = kind == STRIXDLX_REPORT_UP ? STRIXDLX_KNOB_STEP : -STRIXDLX_KNOB_STEP;
+		if (dev->control_setting == 1)
+			dev->volume_headphone = strixdlx_step_volume(dev->volume_headphone, step);
+		else
+			dev->volume_speaker = strixdlx_step_volume(dev->volume_speaker, step);
+		send = STRIXDLX_HID_SEND_LEDS;
+		event = STRIXDLX_EVENT_VOLUME;
+		break;
+
+	//could not happen, the box is initialised at probe()
+	case STRIXDLX_REPORT_UNINIT:
+		DBG_DEBUG("control box not initialized");
+		break;
+
+	//big button: the other output
+	case STRIXDLX_REPORT_SWITCH:
+		dev->control_setting = !dev->control_setting;
+		send = STRIXDLX_HID_SEND_RELAY | STRIXDLX_HID_SEND_LEDS;
+		event = STRIXDLX_EVENT_OUTPUT;
+		break;
+
+	//sonic button: volume to 0 if bigger than 0, else to 100
+	case STRIXDLX_REPORT_SONIC:
+		if (dev->control_setting == 1)
+			dev->volume_headphone = strixdlx_sonic_volume(dev->volume_headphone);
+		else
+			dev->volume_speaker = strixdlx_sonic_volume(dev->volume_speaker);
+		send = STRIXDLX_HID_SEND_LEDS;
+		event = STRIXDLX_EVENT_SONIC;
+		break;
+	}
+
+	//hello and ack only change the registration, the work sends the answer of an action
+	dev->box_int_registered = strixdlx_next_registered(dev->box_int_registered, kind, 1);
+
+	dev->pending |= send;
+	if (event >= 0)
+		strixdlx_hid_notify(dev, event);
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	if (send)
+		schedule_work(&dev->work);
+	return 0;
+}
+
+/*
+ * Userspace program uses this function to access the box
+ * misc_open() holds the misc lock, remove() can not run in between.
+ */
+static int strixdlx_hid_open(struct inode *inode, struct file *file)
+{
+	struct strixdlx_hid *dev = container_of(file->private_data, struct strixdlx_hid, misc);
+	struct strixdlx_hid_file *f;
+
+	f = kzalloc(sizeof(*f), GFP_KERNEL);
+	if (! f)
+		return -ENOMEM;
+
+	kref_get(&dev->kref);
+	f->dev = dev;
+	file->private_data = f;
+	return 0;
+}
+
+/*
+ * Release the file, the box goes away with the last one
+ */
+static int strixdlx_hid_release(struct inode *inode, struct file *file)
+{
+	struct strixdlx_hid_file *f = file->private_data;
+
+	kref_put(&f->dev->kref, strixdlx_hid_free);
+	kfree(f);
+	return 0;
+}
+
+/*
+ * userspace program uses this function to read the current volume
+ * gets a line "<volume> <output> <event> <seq>", volume between 0-100
+ */
+static ssize_t strixdlx_hid_read(struct file *file, char __user *user_buf, size_t len, loff_t *off)
+{
+	struct strixdlx_hid_file *f = file->private_data;
+	struct strixdlx_hid *dev = f->dev;
+	char line[STRIXDLX_EVENT_LINE_SIZE];
+	unsigned long flags;
+	ssize_t ret;
+	u32 seq;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	if (dev->removed) {
+		spin_unlock_irqrestore(&dev->lock, flags);
+		return -ENODEV;
+	}
+	seq = dev->event_seq;
+	ret = min(len, dev->readbuflen);
+	memcpy(line, dev->readbuf, ret);
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	//this file has seen the last event already
+	if (seq == f->event_seq)
+		return 0;
+
+	if (copy_to_user(user_buf, line, ret))
+		return -EFAULT;
+	f->event_seq = seq;
+	return ret;
+}
+
+/*
+ * userspace program uses this function to poll and waits until new data is ready
+ */
+static __poll_t strixdlx_hid_poll(struct file *file, struct poll_table_struct *wait)
+{
+	struct strixdlx_hid_file *f = file->private_data;
+	struct strixdlx_hid *dev = f->dev;
+
+	poll_wait(file, &dev->waitqueue, wait);
+	if (READ_ONCE(dev->removed))
+		return EPOLLHUP | EPOLLERR;
+	if (READ_ONCE(dev->event_seq) != f->event_seq)
+		return EPOLLIN | EPOLLRDNORM;
+	return 0;
+}
+
+/*
+ * userspace program uses this function to submit new volume
+ * allowed are values between 0 and 100, or STRIXDLX_CMD_* to switch the output
+ */
+static ssize_t strixdlx_hid_write(struct file *file, const char __user *user_buf, size_t count,
+		loff_t *ppos)
+{
+	struct strixdlx_hid *dev = ((struct strixdlx_hid_file *)file->private_data)->dev;
+	u8 buf[STRIXDLX_CMD_MAX_SIZE];
+	unsigned long flags;
+	bool relay = false, leds = true;
+	int retval, cmd, output;
+
+	if (count == 0)
+		return 0;
+	if (count > STRIXDLX_CMD_MAX_SIZE)
+		count = STRIXDLX_CMD_MAX_SIZE;
+	if (copy_from_user(buf, user_buf, count))
+		return -EFAULT;
+	cmd = buf[0];
+
+	//volume of one output, two bytes
+	if (cmd == STRIXDLX_CMD_VOLUME_SPEAKER || cmd == STRIXDLX_CMD_VOLUME_HEADPHONE) {
+		if (count < 2 || buf[1] > 100) {
+			DBG_ERR("illegal output volume command issued");
+			return -EINVAL;
+		}
+	} else {
+		//all other commands are one byte
+		count = 1;
+		if (cmd > 100 && cmd != STRIXDLX_CMD_SPEAKER && cmd != STRIXDLX_CMD_HEADPHONE) {
+			DBG_ERR("illegal command issued");
+			return -EINVAL;
+		}
+	}
+
+	if (mutex_lock_interruptible(&dev->io_mutex))
+		return -ERESTARTSYS;
+
+	/* Verify that the device wasn't unplugged. */
+	if (dev->removed) {
+		retval = -ENODEV;
+		goto unlock_exit;
+	}
+
+	spin_lock_irqsave(&dev->lock, flags);
+	switch (cmd) {
+	case STRIXDLX_CMD_VOLUME_SPEAKER:
+	case STRIXDLX_CMD_VOLUME_HEADPHONE:
+		output = cmd == STRIXDLX_CMD_VOLUME_HEADPHONE;
+		if (output)
+			dev->volume_headphone = buf[1];
+		else
+			dev->volume_speaker = buf[1];
+		//the leds follow the active output only
+		leds = dev->control_setting == output;
+		break;
+	case STRIXDLX_CMD_SPEAKER:
+	case STRIXDLX_CMD_HEADPHONE:
+		dev->control_setting = cmd == STRIXDLX_CMD_HEADPHONE;
+		relay = true;
+		break;
+	default:
+		if (dev->control_setting == 1)
+			dev->volume_headphone = cmd;
+		else
+			dev->volume_speaker = cmd;
+		break;
+	}
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	if (leds) {
+		retval = strixdlx_hid_send(dev, relay);
+		if (retval < 0)
+			goto unlock_exit;
+	}
+
+	//switching the output is an event, the userspace gets the volume of the new output
+	if (relay) {
+		spin_lock_irqsave(&dev->lock, flags);
+		strixdlx_hid_notify(dev, STRIXDLX_EVENT_OUTPUT);
+		spin_unlock_irqrestore(&dev->lock, flags);
+	}
+	retval = count;
+
+unlock_exit:
+	mutex_unlock(&dev->io_mutex);
+	return retval;
+}
+
+/*
+ * fops structure
+ */
+static const struct file_operations strixdlx_hid_fops = {
+	.owner =	THIS_MODULE,
+	.write =	strixdlx_hid_write,	/* write function for userspace; set volume */
+	.open =		strixdlx_hid_open,	/* open device function for userspace */
+	.release =	strixdlx_hid_release,	/* free device for userspace */
+	.read =		strixdlx_hid_read,	/* read function for userspace; get volume */
+	.poll =		strixdlx_hid_poll,	/* poll function for userspace */
+	.llseek =	noop_llseek,
+};
+
+/*
+ * Probe function for the HID driver
+ */
+static int strixdlx_hid_probe(struct hid_device *hdev, const struct hid_device_id *id)
+{
+	struct usb_interface *interface;
+	struct strixdlx_hid *dev;
+	int retval;
+
+	if (! hid_is_usb(hdev))
+		return -EINVAL;
+
+	retval = hid_parse(hdev);
+	if (retval) {
+		DBG_ERR("parsing the report descriptor failed (%d)", retval);
+		return retval;
+	}
+
+	//not the control box, behave like hid-generic
+	interface = to_usb_interface(hdev->dev.parent);
+	if (interface->cur_altsetting->desc.bInterfaceNumber != STRIXDLX_INTERFACE)
+		return hid_hw_start(hdev, HID_CONNECT_DEFAULT);
+
+	DBG_INFO("Probe strix dlx HID driver");
+
+	dev = kzalloc(sizeof(struct strixdlx_hid), GFP_KERNEL);
+	if (! dev)
+		return -ENOMEM;
+
+	kref_init(&dev->kref);
+	mutex_init(&dev->io_mutex);
+	spin_lock_init(&dev->lock);
+	init_waitqueue_head(&dev->waitqueue);
+	INIT_WORK(&dev->work, strixdlx_hid_work);
+	dev->hdev = hdev;
+	dev->udev = hid_to_usb_dev(hdev);
+	dev->index = -1;
+
+	dev->relay_buf = kzalloc(STRIXDLX_CTRL_BUFFER_SIZE, GFP_KERNEL);
+	dev->led_buf = kzalloc(STRIXDLX_CTRL_VOLUME_BUFFER_SIZE + 1, GFP_KERNEL);
+	if (! dev->relay_buf || ! dev->led_buf) {
+		DBG_ERR("could not allocate the control buffers");
+		retval = -ENOMEM;
+		goto error;
+	}
+
+	//initial status is speaker, both volumes at 100%
+	dev->control_setting = 0;
+	dev->volume_speaker = 100;
+	dev->volume_headphone = 100;
+	hid_set_drvdata(hdev, dev);
+
+	//reports only, the box is no input device
+	retval = hid_hw_start(hdev, HID_CONNECT_HIDRAW);
+	if (retval) {
+		DBG_ERR("hid_hw_start failed (%d)", retval);
+		goto error;
+	}
+
+	//poll the interrupt endpoint also while nobody has hidraw open
+	retval = hid_hw_open(hdev);
+	if (retval) {
+		DBG_ERR("hid_hw_open failed (%d)", retval);
+		goto stop;
+	}
+
+	mutex_lock(&dev->io_mutex);
+	retval = strixdlx_hid_send(dev, true);
+	mutex_unlock(&dev->io_mutex);
+	if (retval < 0)
+		goto close;
+
+	dev->index = ida_alloc(&strixdlx_hid_ida, GFP_KERNEL);
+	if (dev->index < 0) {
+		retval = dev->index;
+		goto close;
+	}
+	snprintf(dev->name, sizeof(dev->name), "strixdlx%d", dev->index);
+	dev->misc.minor = MISC_DYNAMIC_MINOR;
+	dev->misc.name = dev->name;
+	dev->misc.fops = &strixdlx_hid_fops;
+	dev->misc.parent = &hdev->dev;
+
+	retval = misc_register(&dev->misc);
+	if (retval) {
+		DBG_ERR("not able to register /dev/%s (%d)", dev->name, retval);
+		goto close;
+	}
+
+	//tell our userspace program the new volumes
+	spin_lock_irq(&dev->lock);
+	strixdlx_hid_notify(dev, STRIXDLX_EVENT_INIT);
+	spin_unlock_irq(&dev->lock);
+
+	DBG_INFO("strixdlx_hid now attached to /dev/%s", dev->name);
+	return 0;
+
+close:
+	hid_hw_close(hdev);
+stop:
+	hid_hw_stop(hdev);
+error:
+	cancel_work_sync(&dev->work);
+	hid_set_drvdata(hdev, NULL);
+	if (dev->index >= 0)
+		ida_free(&strixdlx_hid_ida, dev->index);
+	kref_put(&dev->kref, strixdlx_hid_free);
+	return retval;
+}
+
+/*
+ * Remove function when the box is unplugged or the module is removed
+ */
+static void strixdlx_hid_remove(struct hid_device *hdev)
+{
+	struct strixdlx_hid *dev = hid_get_drvdata(hdev);
+
+	if (! dev) {
+		hid_hw_stop(hdev);
+		return;
+	}
+
+	//no control message from now on, readers get POLLHUP
+	mutex_lock(&dev->io_mutex);
+	spin_lock_irq(&dev->lock);
+	dev->removed = true;
+	spin_unlock_irq(&dev->lock);
+	mutex_unlock(&dev->io_mutex);
+	wake_up(&dev->waitqueue);
+
+	misc_deregister(&dev->misc);
+	hid_hw_close(hdev);
+	hid_hw_stop(hdev);
+	//raw_event() can not queue it again after hid_hw_stop()
+	cancel_work_sync(&dev->work);
+	hid_set_drvdata(hdev, NULL);
+
+	DBG_INFO("strixdlx_hid /dev/%s now disconnected", dev->name);
+	ida_free(&strixdlx_hid_ida, dev->index);
+	kref_put(&dev->kref, strixdlx_hid_free);
+}
+
+#ifdef CONFIG_PM
+/*
+ * The box lost its state while the card was reset, send relay and leds again
+ */
+static int strixdlx_hid_reset_resume(struct hid_device *hdev)
+{
+	struct strixdlx_hid *dev = hid_get_drvdata(hdev);
+	unsigned long flags;
+
+	if (! dev)
+		return 0;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	dev->box_int_registered = 0;
+	dev->pending |= STRIXDLX_HID_SEND_RELAY | STRIXDLX_HID_SEND_LEDS;
+	spin_unlock_irqrestore(&dev->lock, flags);
+	schedule_work(&dev->work);
+	return 0;
+}
+#endif
+
+/*
+ * driver struct
+ */
+static struct hid_driver strixdlx_hid_driver = {
+	.name = "strixdlx_hid",
+	.id_table = strixdlx_hid_table,
+	.probe = strixdlx_hid_probe,
+	.remove = strixdlx_hid_remove,
+	.raw_event = strixdlx_hid_raw_event,
+#ifdef CONFIG_PM
+	.reset_resume = strixdlx_hid_reset_resume,
+#endif
+};
+module_hid_driver(strixdlx_hid_driver);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Tobias Wingerath");
+MODULE_DESCRIPTION("HID Driver for Asus Strix Raid DLX Control Box");
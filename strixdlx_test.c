@@ -0,0 +1,382 @@
+/*
+ * KUnit tests for the protocol of the control box (strixdlx-proto.h)
+ *
+ * Needs no hardware, the functions under test are pure:
+ *
+ * - strixdlx_volume_frame() against the led tables of strixdlx.c, for every
+ *   volume 0-100 on both outputs, and the checksum in byte 2
+ * - strixdlx_decode_report() for every report type and unknown reports
+ * - strixdlx_next_registered(), the hello/action state both drivers keep, for
+ *   every report, a recorded stream and an answer that could not be sent
+ * - strixdlx_step_volume() and strixdlx_sonic_volume() at the limits
+ * - micro-benchmarks of the led frame, the led lookup and the decoding,
+ *   timed with ktime and printed as ns per call
+ *
+ * Run in UML, see README.md:
+ *
+ *   ./tools/testing/kunit/kunit.py run --kunitconfig=drivers/misc/strixdlx
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ */
+
+#include <kunit/test.h>
+#include <linux/module.h>
+#include <linux/ktime.h>
+
+#include "strixdlx-proto.h"		/* protocol under test */
+
+#define BENCH_LOOPS		100000
+
+/*
+ * the led tables of the header comment of strixdlx.c, row n has n volume leds
+ */
+static const u8 headphone_frames[STRIXDLX_LEDS + 1][STRIXDLX_CTRL_VOLUME_BUFFER_SIZE] = {
+	{0x09, 0xc5, 0x09, 0x00, 0x04, 0x03, 0x02, 0x00, 0x00},
+	{0x09, 0xc5, 0x0a, 0x00, 0x04, 0x03, 0x02, 0x01, 0x00},
+	{0x09, 0xc5, 0x0c, 0x00, 0x04, 0x03, 0x02, 0x03, 0x00},
+	{0x09, 0xc5, 0x10, 0x00, 0x04, 0x03, 0x02, 0x07, 0x00},
+	{0x09, 0xc5, 0x18, 0x00, 0x04, 0x03, 0x02, 0x0f, 0x00},
+	{0x09, 0xc5, 0x28, 0x00, 0x04, 0x03, 0x02, 0x1f, 0x00},
+	{0x09, 0xc5, 0x48, 0x00, 0x04, 0x03, 0x02, 0x3f, 0x00},
+	{0x09, 0xc5, 0x88, 0x00, 0x04, 0x03, 0x02, 0x7f, 0x00},
+	{0x09, 0xc5, 0x08, 0x00, 0x04, 0x03, 0x02, 0xff, 0x00},
+	{0x09, 0xc5, 0x09, 0x00, 0x04, 0x03, 0x02, 0xff, 0x01},
+	{0x09, 0xc5, 0x0b, 0x00, 0x04, 0x03, 0x02, 0xff, 0x03},
+	{0x09, 0xc5, 0x0f, 0x00, 0x04, 0x03, 0x02, 0xff, 0x07},
+	{0x09, 0xc5, 0x17, 0x00, 0x04, 0x03, 0x02, 0xff, 0x0f},
+	{0x09, 0xc5, 0x27, 0x00, 0x04, 0x03, 0x02, 0xff, 0x1f},
+};
+
+static const u8 speaker_frames[STRIXDLX_LEDS + 1][STRIXDLX_CTRL_VOLUME_BUFFER_SIZE] = {
+	{0x09, 0xc5, 0x0f, 0x00, 0x04, 0x03, 0x08, 0x00, 0x00},
+	{0x09, 0xc5, 0x10, 0x00, 0x04, 0x03, 0x08, 0x01, 0x00},
+	{0x09, 0xc5, 0x12, 0x00, 0x04, 0x03, 0x08, 0x03, 0x00},
+	{0x09, 0xc5, 0x16, 0x00, 0x04, 0x03, 0x08, 0x07, 0x00},
+	{0x09, 0xc5, 0x1e, 0x00, 0x04, 0x03, 0x08, 0x0f, 0x00},
+	{0x09, 0xc5, 0x2e, 0x00, 0x04, 0x03, 0x08, 0x1f, 0x00},
+	{0x09, 0xc5, 0x4e, 0x00, 0x04, 0x03, 0x08, 0x3f, 0x00},
+	{0x09, 0xc5, 0x8e, 0x00, 0x04, 0x03, 0x08, 0x7f, 0x00},
+	{0x09, 0xc5, 0x0e, 0x00, 0x04, 0x03, 0x08, 0xff, 0x00},
+	{0x09, 0xc5, 0x0f, 0x00, 0x04, 0x03, 0x08, 0xff, 0x01},
+	{0x09, 0xc5, 0x11, 0x00, 0x04, 0x03, 0x08, 0xff, 0x03},
+	{0x09, 0xc5, 0x15, 0x00, 0x04, 0x03, 0x08, 0xff, 0x07},
+	{0x09, 0xc5, 0x1d, 0x00, 0x04, 0x03, 0x08, 0xff, 0x0f},
+	{0x09, 0xc5, 0x2d, 0x00, 0x04, 0x03, 0x08, 0xff, 0x1f},
+};
+
+/*
+ * lowest volume of each row, written down independently of STRIXDLX_LED_THRESHOLD
+ */
+static const int bucket_start[STRIXDLX_LEDS + 1] = {0, 1, 8, 15, 22, 29, 36, 43, 51, 60, 68, 76, 84, 92};
+
+static int bucket_of(int volume)
+{
+	int n = STRIXDLX_LEDS;
+
+	while (volume < bucket_start[n])
+		n--;
+	return n;
+}
+
+/*
+ * interrupt reports as the box sends them
+ */
+static const u8 report_hello[] = {0x01, 0xc5, 0x00, 0x00, 0x01, 0x01, 0x0e, 0x0e};
+static const u8 report_switch[] = {0x05, 0x03, 0x00, 0x01, 0x01, 0x01, 0x0e, 0x0e};
+static const u8 report_sonic[] = {0x05, 0x02, 0x00, 0x01, 0x01, 0x00, 0x0e, 0x0e};
+static const u8 report_down[] = {0x05, 0x06, 0x00, 0x01, 0x01, 0x04, 0x0e, 0x0e};
+static const u8 report_up[] = {0x05, 0x05, 0x00, 0x01, 0x01, 0x03, 0x01, 0x0e};
+static const u8 report_uninit[] = {0x05, 0x04, 0x00, 0x01, 0x01, 0x03, 0x01, 0x0e};
+static const u8 report_ack[] = {0x05, 0x05, 0x00, 0x03, 0x01, 0x01, 0x01, 0x0e};
+
+struct decode_case {
+	const char *name;
+	const u8 *data;
+	int registered;
+	int expected;
+};
+
+static const u8 report_unknown_first[] = {0x07, 0x05, 0x00, 0x01};
+static const u8 report_unknown_action[] = {0x05, 0x07, 0x00, 0x01};
+static const u8 report_unknown_up[] = {0x05, 0x05, 0x00, 0x02};
+static const u8 report_unknown_down[] = {0x05, 0x06, 0x00, 0x03};
+static const u8 report_zero[] = {0x00, 0x00, 0x00, 0x00};
+
+static const struct decode_case decode_cases[] = {
+	{ "hello",			report_hello,		0, STRIXDLX_REPORT_HELLO },
+	{ "switch",			report_switch,		1, STRIXDLX_REPORT_SWITCH },
+	{ "sonic",			report_sonic,		1, STRIXDLX_REPORT_SONIC },
+	{ "down",			report_down,		1, STRIXDLX_REPORT_DOWN },
+	{ "up",				report_up,		1, STRIXDLX_REPORT_UP },
+	{ "uninit",			report_uninit,		1, STRIXDLX_REPORT_UNINIT },
+	{ "ack",			report_ack,		1, STRIXDLX_REPORT_ACK },
+	//an action report without a hello before is ignored
+	{ "switch without hello",	report_switch,		0, STRIXDLX_REPORT_NONE },
+	{ "up without hello",		report_up,		0, STRIXDLX_REPORT_NONE },
+	{ "ack without hello",		report_ack,		0, STRIXDLX_REPORT_NONE },
+	//a second hello is no action
+	{ "hello after hello",		report_hello,		1, STRIXDLX_REPORT_NONE },
+	{ "unknown first byte",		report_unknown_first,	1, STRIXDLX_REPORT_NONE },
+	{ "unknown action",		report_unknown_action,	1, STRIXDLX_REPORT_NONE },
+	{ "unknown 05 05",		report_unknown_up,	1, STRIXDLX_REPORT_NONE },
+	{ "unknown 05 06",		report_unknown_down,	1, STRIXDLX_REPORT_NONE },
+	{ "zeros",			report_zero,		0, STRIXDLX_REPORT_NONE },
+	{ "zeros registered",		report_zero,		1, STRIXDLX_REPORT_NONE },
+};
+
+struct registered_case {
+	int kind;
+	int sent;
+	int before;
+	int expected;
+};
+
+/*
+ * every report with and without a registration, actions also with a failed send
+ */
+static const struct registered_case registered_cases[] = {
+	{ STRIXDLX_REPORT_NONE,		1, 0, 0 },
+	{ STRIXDLX_REPORT_NONE,		1, 1, 1 },
+	{ STRIXDLX_REPORT_HELLO,	1, 0, 1 },
+	{ STRIXDLX_REPORT_HELLO,	1, 1, 1 },
+	{ STRIXDLX_REPORT_ACK,		1, 1, 0 },
+	{ STRIXDLX_REPORT_UNINIT,	1, 1, 1 },
+	{ STRIXDLX_REPORT_UP,		1, 1, 0 },
+	{ STRIXDLX_REPORT_UP,		0, 1, 1 },
+	{ STRIXDLX_REPORT_DOWN,		1, 1, 0 },
+	{ STRIXDLX_REPORT_DOWN,		0, 1, 1 },
+	{ STRIXDLX_REPORT_SWITCH,	1, 1, 0 },
+	{ STRIXDLX_REPORT_SWITCH,	0, 1, 1 },
+	{ STRIXDLX_REPORT_SONIC,	1, 1, 0 },
+	{ STRIXDLX_REPORT_SONIC,	0, 1, 1 },
+};
+
+static void strixdlx_test_frame_tables(struct kunit *test)
+{
+	u8 buf[STRIXDLX_CTRL_VOLUME_BUFFER_SIZE];
+	int volume, n;
+
+	for (volume = 0; volume <= 100; volume++) {
+		n = bucket_of(volume);
+
+		strixdlx_volume_frame(buf, 0, volume);
+		KUNIT_EXPECT_MEMEQ_MSG(test, buf, speaker_frames[n], sizeof(buf),
+				"speaker, volume %d, %d leds", volume, n);
+
+		strixdlx_volume_frame(buf, 1, volume);
+		KUNIT_EXPECT_MEMEQ_MSG(test, buf, headphone_frames[n], sizeof(buf),
+				"headphone, volume %d, %d leds", volume, n);
+	}
+}
+
+static void strixdlx_test_frame_checksum(struct kunit *test)
+{
+	u8 buf[STRIXDLX_CTRL_VOLUME_BUFFER_SIZE];
+	int volume, control, i;
+	u8 sum;
+
+	for (control = 0; control <= 1; control++) {
+		for (volume = 0; volume <= 100; volume++) {
+			strixdlx_volume_frame(buf, control, volume);
+			for (sum = 0, i = 3; i < STRIXDLX_CTRL_VOLUME_BUFFER_SIZE; i++)
+				sum += buf[i];
+			KUNIT_EXPECT_EQ_MSG(test, buf[2], sum, "output %d, volume %d", control, volume);
+		}
+	}
+}
+
+static void strixdlx_test_frame_full(struct kunit *test)
+{
+	//the frames probe() starts with are the ones of 100%
+	KUNIT_EXPECT_MEMEQ(test, STRIXDLX_VOLUME_SPEAKER, speaker_frames[STRIXDLX_LEDS],
+			STRIXDLX_CTRL_VOLUME_BUFFER_SIZE);
+	KUNIT_EXPECT_MEMEQ(test, STRIXDLX_VOLUME_HEADPHONE, headphone_frames[STRIXDLX_LEDS],
+			STRIXDLX_CTRL_VOLUME_BUFFER_SIZE);
+}
+
+static void strixdlx_test_volume_leds(struct kunit *test)
+{
+	int n;
+
+	for (n = 0; n <= STRIXDLX_LEDS; n++) {
+		KUNIT_EXPECT_EQ(test, strixdlx_volume_leds(bucket_start[n]), n);
+		if (n > 0)
+			KUNIT_EXPECT_EQ(test, strixdlx_volume_leds(bucket_start[n] - 1), n - 1);
+	}
+	KUNIT_EXPECT_EQ(test, strixdlx_volume_leds(100), STRIXDLX_LEDS);
+}
+
+static void strixdlx_test_decode(struct kunit *test)
+{
+	const struct decode_case *c;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(decode_cases); i++) {
+		c = &decode_cases[i];
+		KUNIT_EXPECT_EQ_MSG(test, strixdlx_decode_report(c->data, c->registered), c->expected,
+				"%s", c->name);
+	}
+}
+
+static void strixdlx_test_decode_sequence(struct kunit *test)
+{
+	//knob up, a stray action, button, sonic and the acks of the box
+	static const u8 *stream[] = {
+		report_hello, report_up, report_hello, report_ack,
+		report_switch,
+		report_hello, report_switch, report_hello, report_ack,
+		report_hello, report_hello, report_sonic,
+	};
+	static const int expected[] = {
+		STRIXDLX_REPORT_HELLO, STRIXDLX_REPORT_UP, STRIXDLX_REPORT_HELLO, STRIXDLX_REPORT_ACK,
+		STRIXDLX_REPORT_NONE,
+		STRIXDLX_REPORT_HELLO, STRIXDLX_REPORT_SWITCH, STRIXDLX_REPORT_HELLO, STRIXDLX_REPORT_ACK,
+		STRIXDLX_REPORT_HELLO, STRIXDLX_REPORT_NONE, STRIXDLX_REPORT_SONIC,
+	};
+	int registered = 0, report, i;
+
+	for (i = 0; i < ARRAY_SIZE(stream); i++) {
+		report = strixdlx_decode_report(stream[i], registered);
+		KUNIT_EXPECT_EQ_MSG(test, report, expected[i], "report %d of the stream", i);
+		registered = strixdlx_next_registered(registered, report, 1);
+	}
+	KUNIT_EXPECT_EQ(test, registered, 0);
+}
+
+static void strixdlx_test_next_registered(struct kunit *test)
+{
+	const struct registered_case *c;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(registered_cases); i++) {
+		c = &registered_cases[i];
+		KUNIT_EXPECT_EQ_MSG(test, strixdlx_next_registered(c->before, c->kind, c->sent), c->expected,
+				    "report %d, registered %d, sent %d", c->kind, c->before, c->sent);
+	}
+}
+
+static void strixdlx_test_failed_send(struct kunit *test)
+{
+	int registered = 0, report;
+
+	//the led frame of the knob step could not be sent, the box repeats the step
+	report = strixdlx_decode_report(report_hello, registered);
+	registered = strixdlx_next_registered(registered, report, 1);
+	report = strixdlx_decode_report(report_up, registered);
+	KUNIT_EXPECT_EQ(test, report, STRIXDLX_REPORT_UP);
+	registered = strixdlx_next_registered(registered, report, 0);
+	KUNIT_EXPECT_EQ(test, registered, 1);
+
+	//its hello is no action, the step after it is
+	report = strixdlx_decode_report(report_hello, registered);
+	KUNIT_EXPECT_EQ(test, report, STRIXDLX_REPORT_NONE);
+	registered = strixdlx_next_registered(registered, report, 1);
+	report = strixdlx_decode_report(report_up, registered);
+	KUNIT_EXPECT_EQ(test, report, STRIXDLX_REPORT_UP);
+	registered = strixdlx_next_registered(registered, report, 1);
+	KUNIT_EXPECT_EQ(test, registered, 0);
+}
+
+static void strixdlx_test_step_volume(struct kunit *test)
+{
+	KUNIT_EXPECT_EQ(test, strixdlx_step_volume(50, STRIXDLX_KNOB_STEP), 53);
+	KUNIT_EXPECT_EQ(test, strixdlx_step_volume(50, -STRIXDLX_KNOB_STEP), 47);
+	KUNIT_EXPECT_EQ(test, strixdlx_step_volume(98, STRIXDLX_KNOB_STEP), 100);
+	KUNIT_EXPECT_EQ(test, strixdlx_step_volume(100, STRIXDLX_KNOB_STEP), 100);
+	KUNIT_EXPECT_EQ(test, strixdlx_step_volume(2, -STRIXDLX_KNOB_STEP), 0);
+	KUNIT_EXPECT_EQ(test, strixdlx_step_volume(0, -STRIXDLX_KNOB_STEP), 0);
+	KUNIT_EXPECT_EQ(test, strixdlx_step_volume(97, STRIXDLX_KNOB_STEP), 100);
+	KUNIT_EXPECT_EQ(test, strixdlx_step_volume(3, -STRIXDLX_KNOB_STEP), 0);
+}
+
+static void strixdlx_test_sonic_volume(struct kunit *test)
+{
+	KUNIT_EXPECT_EQ(test, strixdlx_sonic_volume(0), 100);
+	KUNIT_EXPECT_EQ(test, strixdlx_sonic_volume(1), 0);
+	KUNIT_EXPECT_EQ(test, strixdlx_sonic_volume(100), 0);
+	KUNIT_EXPECT_EQ(test, strixdlx_sonic_volume(strixdlx_sonic_volume(40)), 100);
+}
+
+/*
+ * Print the time per call of a benchmark loop
+ */
+static void bench_report(struct kunit *test, const char *name, u64 ns, u32 sink)
+{
+	kunit_info(test, "%s: %llu ns per call (%d calls, sink %u)\n", name,
+			ns / BENCH_LOOPS, BENCH_LOOPS, sink);
+}
+
+static void strixdlx_bench_volume_frame(struct kunit *test)
+{
+	u8 buf[STRIXDLX_CTRL_VOLUME_BUFFER_SIZE];
+	u32 sink = 0;
+	u64 start;
+	int i;
+
+	start = ktime_get_ns();
+	for (i = 0; i < BENCH_LOOPS; i++) {
+		strixdlx_volume_frame(buf, i & 1, i % 101);
+		sink += buf[2];
+	}
+	bench_report(test, "strixdlx_volume_frame", ktime_get_ns() - start, sink);
+}
+
+static void strixdlx_bench_volume_leds(struct kunit *test)
+{
+	u32 sink = 0;
+	u64 start;
+	int i;
+
+	start = ktime_get_ns();
+	for (i = 0; i < BENCH_LOOPS; i++)
+		sink += strixdlx_volume_leds(i % 101);
+	bench_report(test, "strixdlx_volume_leds", ktime_get_ns() - start, sink);
+}
+
+static void strixdlx_bench_decode(struct kunit *test)
+{
+	static const u8 *stream[] = {
+		report_hello, report_up, report_hello, report_down,
+		report_hello, report_switch, report_hello, report_ack,
+	};
+	int registered = 0, report, i;
+	u32 sink = 0;
+	u64 start;
+
+	start = ktime_get_ns();
+	for (i = 0; i < BENCH_LOOPS; i++) {
+		report = strixdlx_decode_report(stream[i % ARRAY_SIZE(stream)], registered);
+		registered = strixdlx_next_registered(registered, report, 1);
+		sink += report;
+	}
+	bench_report(test, "strixdlx_decode_report", ktime_get_ns() - start, sink);
+}
+
+static struct kunit_case strixdlx_test_cases[] = {
+	KUNIT_CASE(strixdlx_test_frame_tables),
+	KUNIT_CASE(strixdlx_test_frame_checksum),
+	KUNIT_CASE(strixdlx_test_frame_full),
+	KUNIT_CASE(strixdlx_test_volume_leds),
+	KUNIT_CASE(strixdlx_test_decode),
+	KUNIT_CASE(strixdlx_test_decode_sequence),
+	KUNIT_CASE(strixdlx_test_next_registered),
+	KUNIT_CASE(strixdlx_test_failed_send),
+	KUNIT_CASE(strixdlx_test_step_volume),
+	KUNIT_CASE(strixdlx_test_sonic_volume),
+	KUNIT_CASE(strixdlx_bench_volume_frame),
+	KUNIT_CASE(strixdlx_bench_volume_leds),
+	KUNIT_CASE(strixdlx_bench_decode),
+	{}
+};
+
+static struct kunit_suite strixdlx_test_suite = {
+	.name = "strixdlx",
+	.test_cases = strixdlx_test_cases,
+};
+kunit_test_suite(strixdlx_test_suite);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("KUnit tests for the Asus Strix Raid DLX Control Box protocol");